@@ -0,0 +1,303 @@
+/*
+bk_math_bench.c - Microbenchmarks for bk_math.h
+
+Measures every bkm_* function in two modes:
+  - latency:    each call consumes the previous call's output, so the
+                figure is the length of the dependency chain per op
+  - throughput: calls are independent, so the figure is how many can
+                be kept in flight per second
+
+and with two working sets:
+  - hot:  64 elements, stays resident in L1
+  - cold: a buffer several times larger than the last-level cache,
+          streamed so that every element comes from DRAM
+
+On x86 builds with GCC or Clang every kernel is also compiled for each
+ISA level the CPU supports (baseline, sse4.2, avx2, avx512) and the
+levels are reported side by side. The "nop" row is the harness overhead
+(loop, chaining and indexing) and should be subtracted when comparing
+cheap functions.
+
+Results are written to stdout as a single JSON document.
+
+Build:
+  cc -O2 -o bk_math_bench bench/bk_math_bench.c -lm
+
+Usage:
+  bk_math_bench [--filter substr] [--ms per_run] [--cold-mb size]
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../bk_math.h"
+
+#define BENCH_STRIDE 16 // floats per element, enough for any mat4 argument
+#define BENCH_HOT_ELEMS 64
+#define BENCH_REPEATS 5
+
+typedef struct {
+	float* a;
+	float* b;
+	float* out;
+	size_t n;
+	float zero; // opaque 0.0f used to chain latency runs
+} bench_set;
+
+typedef void (*bench_fn)(bench_set* s, size_t iters, int chain);
+
+typedef struct {
+	const char* name;
+	bench_fn fn;
+} bench_op;
+
+typedef struct {
+	const char* name;
+	const bench_op* ops;
+	int supported;
+} bench_isa;
+
+// Every kernel reads its inputs from A and B and writes to D. Inputs are
+// filled with values in [0.25, 1.25) so that no function sees a zero
+// length vector, a degenerate frustum or a coincident eye and center.
+#define BKM_BENCH_OPS(X) \
+	X(nop,                D[0] = A[0]) \
+	X(bkm_deg,            D[0] = bkm_deg(A[0])) \
+	X(bkm_rad,            D[0] = bkm_rad(A[0])) \
+	X(bkm_clamp,          D[0] = bkm_clamp(A[0], 0.5f, 1.0f)) \
+	X(bkm_add,            bkm_add(A, B, D)) \
+	X(bkm_vec3_sub,       bkm_vec3_sub(A, B, D)) \
+	X(bkm_vec3_scale,     bkm_vec3_scale(A, B[0], D)) \
+	X(bkm_vec3_dot,       D[0] = bkm_vec3_dot(A, B)) \
+	X(bkm_vec3_cross,     bkm_vec3_cross(A, B, D)) \
+	X(bkm_vec3_len,       D[0] = bkm_vec3_len(A)) \
+	X(bkm_vec3_copy,      bkm_vec3_copy(A, D)) \
+	X(bkm_vec3_set,       bkm_vec3_set(D, A[0], A[1], A[2])) \
+	X(bkm_vec3_normalize, bkm_vec3_normalize(A, D)) \
+	X(bkm_mat4_identity,  bkm_mat4_identity(D)) \
+	X(bkm_mat4_translate, bkm_mat4_translate(A, D)) \
+	X(bkm_mat4_scale,     bkm_mat4_scale(A, D)) \
+	X(bkm_mat4_rotate_x,  bkm_mat4_rotate_x(A[0], D)) \
+	X(bkm_mat4_rotate_y,  bkm_mat4_rotate_y(A[0], D)) \
+	X(bkm_mat4_rotate_z,  bkm_mat4_rotate_z(A[0], D)) \
+	X(bkm_mat4_mul,       bkm_mat4_mul(A, B, D)) \
+	X(mat4_perspective,   mat4_perspective(A[0], A[1], 0.1f * A[2], 100.0f + A[3], D)) \
+	X(bkm_mat4_lookat,    bkm_mat4_lookat(A, B, A + 4, D)) \
+	X(bkm_mat4_model,     bkm_mat4_model(A, A + 4, A + 8, D)) \
+	X(bkm_mat4_mulv,      bkm_mat4_mulv(A, B, 1.0f, D))
+
+#define BENCH_CAT_(a, b) a##b
+#define BENCH_CAT(a, b) BENCH_CAT_(a, b)
+
+#define BENCH_DEFINE(name, body) \
+	static BENCH_ATTR void BENCH_CAT(bench_##name, BENCH_ISA)(bench_set* s, size_t iters, int chain) { \
+		float carry = 0.0f; \
+		float zero = s->zero; \
+		size_t i = 0; \
+		if (chain) { \
+			for (size_t k = 0; k < iters; k++) { \
+				float* A = s->a + i * BENCH_STRIDE; \
+				float* B = s->b + i * BENCH_STRIDE; \
+				float* D = s->out + i * BENCH_STRIDE; \
+				(void)B; \
+				A[0] += carry; \
+				body; \
+				carry = D[0] * zero; \
+				if (++i == s->n) i = 0; \
+			} \
+		} else { \
+			for (size_t k = 0; k < iters; k++) { \
+				float* A = s->a + i * BENCH_STRIDE; \
+				float* B = s->b + i * BENCH_STRIDE; \
+				float* D = s->out + i * BENCH_STRIDE; \
+				(void)A; (void)B; \
+				body; \
+				if (++i == s->n) i = 0; \
+			} \
+		} \
+	}
+
+#define BENCH_ENTRY(name, body) { #name, BENCH_CAT(bench_##name, BENCH_ISA) },
+
+#define BENCH_DEFINE_ISA \
+	BKM_BENCH_OPS(BENCH_DEFINE) \
+	static const bench_op BENCH_CAT(bench_ops, BENCH_ISA)[] = { BKM_BENCH_OPS(BENCH_ENTRY) { NULL, NULL } };
+
+#if defined(__GNUC__)
+#define BENCH_FLATTEN __attribute__((flatten))
+#else
+#define BENCH_FLATTEN
+#endif
+
+#define BENCH_ISA _baseline
+#define BENCH_ATTR BENCH_FLATTEN
+BENCH_DEFINE_ISA
+#undef BENCH_ISA
+#undef BENCH_ATTR
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BENCH_X86 1
+
+#define BENCH_ISA _sse42
+#define BENCH_ATTR BENCH_FLATTEN __attribute__((target("sse4.2")))
+BENCH_DEFINE_ISA
+#undef BENCH_ISA
+#undef BENCH_ATTR
+
+#define BENCH_ISA _avx2
+#define BENCH_ATTR BENCH_FLATTEN __attribute__((target("avx2,fma")))
+BENCH_DEFINE_ISA
+#undef BENCH_ISA
+#undef BENCH_ATTR
+
+#define BENCH_ISA _avx512
+#define BENCH_ATTR BENCH_FLATTEN __attribute__((target("avx512f,avx512vl,fma")))
+BENCH_DEFINE_ISA
+#undef BENCH_ISA
+#undef BENCH_ATTR
+#endif
+
+double bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int bench_set_alloc(bench_set* s, size_t n) {
+	size_t bytes = n * BENCH_STRIDE * sizeof(float);
+	s->a = malloc(bytes);
+	s->b = malloc(bytes);
+	s->out = malloc(bytes);
+	s->n = n;
+	if (!s->a || !s->b || !s->out) return 0;
+
+	uint32_t seed = 0x9E3779B9u;
+	for (size_t i = 0; i < n * BENCH_STRIDE; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		s->a[i] = 0.25f + (seed >> 8) * (1.0f / 16777216.0f);
+		seed = seed * 1664525u + 1013904223u;
+		s->b[i] = 0.25f + (seed >> 8) * (1.0f / 16777216.0f);
+	}
+	memset(s->out, 0, bytes);
+	return 1;
+}
+
+void bench_set_free(bench_set* s) {
+	free(s->a);
+	free(s->b);
+	free(s->out);
+}
+
+// Returns the best ns/op over BENCH_REPEATS runs of roughly 'ms' each.
+double bench_measure(bench_fn fn, bench_set* s, int chain, double ms) {
+	size_t iters = s->n < 1024 ? 1024 : s->n;
+
+	// Calibrate until one run takes at least a tenth of the budget
+	for (;;) {
+		double t0 = bench_now_ns();
+		fn(s, iters, chain);
+		double dt = bench_now_ns() - t0;
+		if (dt >= ms * 1e5 || iters >= ((size_t)1 << 40)) {
+			iters = (size_t)(iters * (ms * 1e6 / (dt > 1.0 ? dt : 1.0)));
+			break;
+		}
+		iters *= 4;
+	}
+	if (iters < s->n) iters = s->n;
+
+	double best = 0.0;
+	for (int r = 0; r < BENCH_REPEATS; r++) {
+		double t0 = bench_now_ns();
+		fn(s, iters, chain);
+		double ns = (bench_now_ns() - t0) / iters;
+		if (r == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	const char* filter = NULL;
+	double ms = 20.0;
+	size_t cold_mb = 256;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+		else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) ms = atof(argv[++i]);
+		else if (strcmp(argv[i], "--cold-mb") == 0 && i + 1 < argc) cold_mb = strtoul(argv[++i], NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [--filter substr] [--ms per_run] [--cold-mb size]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bench_isa isas[] = {
+		{ "baseline", bench_ops_baseline, 1 },
+#ifdef BENCH_X86
+		{ "sse4.2", bench_ops_sse42, __builtin_cpu_supports("sse4.2") },
+		{ "avx2", bench_ops_avx2, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") },
+		{ "avx512", bench_ops_avx512, __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") },
+#endif
+	};
+	const int n_isas = sizeof(isas) / sizeof(isas[0]);
+
+	// The three cold buffers together span cold_mb
+	size_t cold_elems = cold_mb * 1024 * 1024 / (3 * BENCH_STRIDE * sizeof(float));
+	if (cold_elems < BENCH_HOT_ELEMS) cold_elems = BENCH_HOT_ELEMS;
+
+	bench_set sets[2] = {0};
+	const char* cache_names[2] = { "hot", "cold" };
+	if (!bench_set_alloc(&sets[0], BENCH_HOT_ELEMS) || !bench_set_alloc(&sets[1], cold_elems)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	volatile float opaque_zero = 0.0f;
+	sets[0].zero = sets[1].zero = opaque_zero;
+
+	printf("{\n");
+	printf("  \"hot_elems\": %d,\n", BENCH_HOT_ELEMS);
+	printf("  \"cold_elems\": %zu,\n", cold_elems);
+	printf("  \"isa_levels\": [");
+	int first = 1;
+	for (int k = 0; k < n_isas; k++) {
+		if (!isas[k].supported) continue;
+		printf("%s\"%s\"", first ? "" : ", ", isas[k].name);
+		first = 0;
+	}
+	printf("],\n");
+	printf("  \"results\": [");
+
+	first = 1;
+	for (int op = 0; bench_ops_baseline[op].name; op++) {
+		const char* name = bench_ops_baseline[op].name;
+		if (filter && !strstr(name, filter) && strcmp(name, "nop") != 0) continue;
+
+		for (int k = 0; k < n_isas; k++) {
+			if (!isas[k].supported) continue;
+			for (int c = 0; c < 2; c++) {
+				for (int chain = 1; chain >= 0; chain--) {
+					double ns = bench_measure(isas[k].ops[op].fn, &sets[c], chain, ms);
+					printf("%s\n    {\"fn\": \"%s\", \"isa\": \"%s\", \"cache\": \"%s\", \"mode\": \"%s\", "
+						"\"ns_per_op\": %.3f, \"ops_per_s\": %.0f}",
+						first ? "" : ",", name, isas[k].name, cache_names[c],
+						chain ? "latency" : "throughput", ns, ns > 0.0 ? 1e9 / ns : 0.0);
+					fflush(stdout);
+					first = 0;
+				}
+			}
+		}
+	}
+
+	// Fold the outputs into the report so no kernel can be discarded
+	float checksum = 0.0f;
+	for (int c = 0; c < 2; c++) {
+		for (size_t i = 0; i < sets[c].n; i++) checksum += sets[c].out[i * BENCH_STRIDE];
+	}
+	printf("\n  ],\n  \"checksum\": %g\n}\n", checksum);
+
+	bench_set_free(&sets[0]);
+	bench_set_free(&sets[1]);
+	return 0;
+}
@@ -0,0 +1,456 @@
+/*
+bk_atlas.h - Texture atlas builder for the Brickate project
+
+This header packs many PNG images into one RGBA8 atlas. The images are
+never decoded into buffers of their own: every input's IHDR is probed
+first, the rectangles are packed, the atlas is allocated once, and then
+each PNG is decoded straight into its slot.
+
+Features:
+  - Skyline bottom-left packing, tallest images first, into the smallest
+    power-of-two atlas that fits (up to a caller-supplied limit)
+  - Optional padding around every image, filled by repeating its edge
+    texels so bilinear filtering does not pull in neighbours
+  - Parallel decoding on a bk_job pool through bkp_load_png_into
+  - Pixel and UV rectangles for every input, in input order
+  - Alpha bleeding: the RGB of fully transparent texels is filled from
+    the nearest visible texel (jump flooding, 8 texels per iteration),
+    so filtering and mips do not pull dark fringes into sprite edges.
+    Usable on any RGBA8 image, or per image while building an atlas.
+
+Unused atlas texels are transparent black.
+*/
+
+#ifndef BK_ATLAS_H
+#define BK_ATLAS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bk_png.h"
+#include "bk_simd.h"
+#include "bk_job.h"
+
+BK_SIMD_BEGIN
+
+// bka_build flags
+#define BKA_BLEED 1
+
+#define BKA_BAND_ROWS 16
+
+typedef struct {
+	int x, y;   // top-left texel of the image, inside its padding
+	int w, h;
+	float u0, v0, u1, v1;
+} bka_rect;
+
+typedef struct {
+	unsigned char* pixels; // RGBA8, width * 4 bytes per row
+	int width;
+	int height;
+	bka_rect* rects;       // one per input
+	int n_rects;
+} bka_atlas;
+
+typedef struct {
+	int x, y, w;
+} bka_skyline_node;
+
+typedef struct {
+	bka_skyline_node* nodes;
+	int n_nodes;
+	int width;
+	int height;
+} bka_skyline;
+
+typedef struct {
+	int w, h; // including padding
+	int index;
+} bka_item;
+
+void bka_free(bka_atlas* atlas) {
+	free(atlas->pixels);
+	free(atlas->rects);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+// 'nodes' must have room for one more node than rectangles to insert
+void bka_skyline_init(bka_skyline* sk, bka_skyline_node* nodes, int width, int height) {
+	sk->nodes = nodes;
+	sk->nodes[0] = (bka_skyline_node){0, 0, width};
+	sk->n_nodes = 1;
+	sk->width = width;
+	sk->height = height;
+}
+
+// Lowest y at which a w x h rectangle fits with its left edge on node i
+int bka_skyline_fit(const bka_skyline* sk, int i, int w, int h, int* out_y) {
+	int x = sk->nodes[i].x;
+	if (x + w > sk->width) return 0;
+
+	int y = 0, left = w;
+	while (left > 0) {
+		if (sk->nodes[i].y > y) y = sk->nodes[i].y;
+		if (y + h > sk->height) return 0;
+		left -= sk->nodes[i].w;
+		i++;
+	}
+	*out_y = y;
+	return 1;
+}
+
+void bka_skyline_remove(bka_skyline* sk, int i) {
+	memmove(&sk->nodes[i], &sk->nodes[i + 1], (sk->n_nodes - i - 1) * sizeof(bka_skyline_node));
+	sk->n_nodes--;
+}
+
+int bka_skyline_insert(bka_skyline* sk, int w, int h, int* out_x, int* out_y) {
+	int best = -1, best_y = 0, best_top = INT_MAX, best_w = INT_MAX;
+	for (int i = 0; i < sk->n_nodes; i++) {
+		int y;
+		if (!bka_skyline_fit(sk, i, w, h, &y)) continue;
+		if (y + h < best_top || (y + h == best_top && sk->nodes[i].w < best_w)) {
+			best = i;
+			best_y = y;
+			best_top = y + h;
+			best_w = sk->nodes[i].w;
+		}
+	}
+	if (best < 0) return 0;
+
+	int x = sk->nodes[best].x;
+	memmove(&sk->nodes[best + 1], &sk->nodes[best], (sk->n_nodes - best) * sizeof(bka_skyline_node));
+	sk->nodes[best] = (bka_skyline_node){x, best_y + h, w};
+	sk->n_nodes++;
+
+	// Cut the new segment out of the nodes it now covers
+	for (int i = best + 1; i < sk->n_nodes; ) {
+		bka_skyline_node* n = &sk->nodes[i];
+		int cover = x + w - n->x;
+		if (cover <= 0) break;
+		if (n->w <= cover) {
+			bka_skyline_remove(sk, i);
+			continue;
+		}
+		n->x += cover;
+		n->w -= cover;
+		break;
+	}
+
+	for (int i = 0; i + 1 < sk->n_nodes; ) {
+		if (sk->nodes[i].y == sk->nodes[i + 1].y) {
+			sk->nodes[i].w += sk->nodes[i + 1].w;
+			bka_skyline_remove(sk, i + 1);
+		} else {
+			i++;
+		}
+	}
+
+	*out_x = x;
+	*out_y = best_y;
+	return 1;
+}
+
+int bka_item_cmp(const void* a, const void* b) {
+	const bka_item* p = a;
+	const bka_item* q = b;
+	if (p->h != q->h) return q->h - p->h;
+	if (p->w != q->w) return q->w - p->w;
+	return p->index - q->index;
+}
+
+// Packs sorted items into width x height; fills rects' x/y (of the padded box)
+int bka_pack(const bka_item* items, int n, int width, int height, bka_skyline_node* nodes, bka_rect* rects) {
+	bka_skyline sk;
+	bka_skyline_init(&sk, nodes, width, height);
+	for (int i = 0; i < n; i++) {
+		bka_rect* r = &rects[items[i].index];
+		if (!bka_skyline_insert(&sk, items[i].w, items[i].h, &r->x, &r->y)) return 0;
+	}
+	return 1;
+}
+
+// Repeats the outermost texels of a placed image into its padding
+void bka_extend_edges(unsigned char* pixels, int width, const bka_rect* r, int padding) {
+	size_t stride = (size_t)width * 4;
+	for (int y = r->y; y < r->y + r->h; y++) {
+		uint32_t* row = (uint32_t*)(pixels + y * stride);
+		for (int p = 1; p <= padding; p++) {
+			row[r->x - p] = row[r->x];
+			row[r->x + r->w - 1 + p] = row[r->x + r->w - 1];
+		}
+	}
+	size_t span = (size_t)(r->w + padding * 2) * 4;
+	unsigned char* top = pixels + r->y * stride + (size_t)(r->x - padding) * 4;
+	unsigned char* bottom = top + (size_t)(r->h - 1) * stride;
+	for (int p = 1; p <= padding; p++) {
+		memcpy(top - p * stride, top, span);
+		memcpy(bottom + p * stride, bottom, span);
+	}
+}
+
+typedef struct {
+	const int32_t* src; // nearest visible texel per texel, (y << 16) | x, or -1
+	int32_t* dst;
+	int width;
+	int height;
+	int stride;         // int32 per row, a multiple of 8; padding lanes stay -1
+	int step;
+	unsigned char* pixels;
+	size_t pixel_stride;
+	int radius;
+} bka_flood;
+
+BK_SIMD_INLINE bk_i32x8 bka_flood_load(const bka_flood* f, int x, int y) {
+	const int32_t* row = f->src + (size_t)y * f->stride;
+	if (x >= 0 && x + 8 <= f->stride) return bk_i32x8_load(row + x);
+
+	bk_i32x8 v = bk_i32x8_splat(-1);
+	for (int l = 0; l < 8; l++) {
+		if (x + l >= 0 && x + l < f->width) v[l] = row[x + l];
+	}
+	return v;
+}
+
+BK_SIMD_INLINE bk_i32x8 bka_flood_dist(bk_i32x8 seed, bk_i32x8 x, int y) {
+	bk_i32x8 dx = (seed & 0xFFFF) - x;
+	bk_i32x8 dy = (seed >> 16) - y;
+	return bk_i32x8_select(seed >= 0, dx * dx + dy * dy, bk_i32x8_splat(INT_MAX));
+}
+
+// One jump flood step: each texel keeps the closest of the seeds found by
+// itself and its 8 neighbours 'step' texels away
+void bka_flood_band(void* ctx, int band, int worker) {
+	const bka_flood* f = ctx;
+	int y0 = band * BKA_BAND_ROWS;
+	int y1 = y0 + BKA_BAND_ROWS < f->height ? y0 + BKA_BAND_ROWS : f->height;
+	(void)worker;
+
+	for (int y = y0; y < y1; y++) {
+		for (int x = 0; x < f->width; x += 8) {
+			bk_i32x8 px = bk_i32x8_iota() + x;
+			bk_i32x8 best = bk_i32x8_splat(-1);
+			bk_i32x8 best_d = bk_i32x8_splat(INT_MAX);
+
+			for (int oy = -1; oy <= 1; oy++) {
+				int ny = y + oy * f->step;
+				if (ny < 0 || ny >= f->height) continue;
+				for (int ox = -1; ox <= 1; ox++) {
+					bk_i32x8 seed = bka_flood_load(f, x + ox * f->step, ny);
+					bk_i32x8 d = bka_flood_dist(seed, px, y);
+					bk_i32x8 closer = d < best_d;
+					best = bk_i32x8_select(closer, seed, best);
+					best_d = bk_i32x8_select(closer, d, best_d);
+				}
+			}
+
+			best = bk_i32x8_select(px < f->width, best, bk_i32x8_splat(-1));
+			bk_i32x8_store(f->dst + (size_t)y * f->stride + x, best);
+		}
+	}
+}
+
+// Copies the RGB of each transparent texel's seed, keeping its alpha
+void bka_bleed_band(void* ctx, int band, int worker) {
+	const bka_flood* f = ctx;
+	int y0 = band * BKA_BAND_ROWS;
+	int y1 = y0 + BKA_BAND_ROWS < f->height ? y0 + BKA_BAND_ROWS : f->height;
+	int max_d = f->radius > 0 ? f->radius * f->radius : INT_MAX;
+	int row_words = (int)(f->pixel_stride / 4);
+	(void)worker;
+
+	for (int y = y0; y < y1; y++) {
+		uint32_t* row = (uint32_t*)(f->pixels + (size_t)y * f->pixel_stride);
+		for (int x = 0; x < f->width; x += 8) {
+			int n = f->width - x < 8 ? f->width - x : 8;
+			bk_u32x8 c = bk_u32x8_splat(0);
+			memcpy(&c, row + x, n * 4);
+
+			bk_i32x8 seed = bk_i32x8_load(f->src + (size_t)y * f->stride + x);
+			bk_i32x8 d = bka_flood_dist(seed, bk_i32x8_iota() + x, y);
+			bk_i32x8 fill = (bk_i32x8)((c >> 24) == 0) & (seed >= 0) & (d <= max_d);
+			if (!bk_i32x8_any(fill)) continue;
+
+			bk_i32x8 idx = (seed >> 16) * row_words + (seed & 0xFFFF);
+			bk_u32x8 rgb = bk_u32x8_gather(f->pixels, bk_i32x8_select(fill, idx, bk_i32x8_splat(0)));
+			c = bk_u32x8_select(fill, (rgb & 0x00FFFFFF) | (c & 0xFF000000), c);
+			memcpy(row + x, &c, n * 4);
+		}
+	}
+}
+
+// Fills the RGB of every alpha == 0 texel from the nearest texel with
+// alpha > 0, up to 'radius' texels away (0 for no limit). Alpha is left
+// unchanged. 'stride' is in bytes and must be a multiple of 4; 'pool' may
+// be NULL. Returns 1 on success.
+int bka_bleed(unsigned char* pixels, int width, int height, size_t stride, int radius, bkj_pool* pool) {
+	if (width <= 0 || height <= 0 || width > 0x8000 || height > 0x8000) return 0;
+
+	bka_flood f = {0};
+	f.width = width;
+	f.height = height;
+	f.stride = (width + 7) & ~7;
+	f.pixels = pixels;
+	f.pixel_stride = stride;
+	f.radius = radius;
+
+	size_t n = (size_t)f.stride * height;
+	int32_t* a = malloc(n * sizeof(int32_t));
+	int32_t* b = malloc(n * sizeof(int32_t));
+	if (!a || !b) {
+		free(a);
+		free(b);
+		return 0;
+	}
+
+	int any = 0;
+	for (int y = 0; y < height; y++) {
+		const unsigned char* row = pixels + (size_t)y * stride;
+		int32_t* seeds = a + (size_t)y * f.stride;
+		for (int x = 0; x < f.stride; x++) {
+			int visible = x < width && row[x * 4 + 3] != 0;
+			seeds[x] = visible ? (y << 16) | x : -1;
+			any |= visible;
+		}
+	}
+	memcpy(b, a, n * sizeof(int32_t));
+
+	if (any) {
+		// Steps halve down to 1 and must add up to the reach; a final extra
+		// step of 1 fixes most of jump flooding's misses
+		int reach = radius > 0 ? radius : (width > height ? width : height);
+		int step = 1;
+		while (step * 2 - 1 < reach) step *= 2;
+
+		int bands = (height + BKA_BAND_ROWS - 1) / BKA_BAND_ROWS;
+		for (int last = 0; !last; step /= 2) {
+			if (step == 0) {
+				step = 1;
+				last = 1;
+			}
+			f.step = step;
+			f.src = a;
+			f.dst = b;
+			bkj_parallel_for(pool, bands, bka_flood_band, &f);
+			int32_t* t = a;
+			a = b;
+			b = t;
+		}
+
+		f.src = a;
+		bkj_parallel_for(pool, bands, bka_bleed_band, &f);
+	}
+
+	free(a);
+	free(b);
+	return 1;
+}
+
+typedef struct {
+	bka_atlas* atlas;
+	const char* const* paths;
+	int padding;
+	int flags;
+	int failed;
+} bka_job;
+
+void bka_decode_one(void* ctx, int index, int worker) {
+	bka_job* j = ctx;
+	bka_atlas* a = j->atlas;
+	const bka_rect* r = &a->rects[index];
+	bkp_ihdr ihdr;
+	(void)worker;
+
+	// The file may have changed since it was probed; a smaller image would
+	// leave part of the slot unwritten
+	unsigned char* dst = a->pixels + ((size_t)r->y * a->width + r->x) * 4;
+	if (!bkp_load_png_into(j->paths[index], dst, (size_t)a->width * 4, r->w, r->h, &ihdr)
+		|| ihdr.width != (uint32_t)r->w || ihdr.height != (uint32_t)r->h) {
+		__atomic_store_n(&j->failed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (j->padding > 0) bka_extend_edges(a->pixels, a->width, r, j->padding);
+
+	// Bleed within the padded box only, while it is still in cache
+	if (j->flags & BKA_BLEED) {
+		unsigned char* box = a->pixels + ((size_t)(r->y - j->padding) * a->width + r->x - j->padding) * 4;
+		bka_bleed(box, r->w + j->padding * 2, r->h + j->padding * 2, (size_t)a->width * 4, 0, NULL);
+	}
+}
+
+// Builds an atlas from n PNG files. Each side of the atlas is a power of
+// two no larger than max_size. 'flags' is 0 or BKA_BLEED. 'pool' may be
+// NULL. Returns 1 on success.
+int bka_build(bka_atlas* atlas, const char* const* paths, int n, int padding, int flags, int max_size, bkj_pool* pool) {
+	memset(atlas, 0, sizeof(*atlas));
+	if (n <= 0) return 0;
+
+	atlas->rects = calloc(n, sizeof(bka_rect));
+	bka_item* items = malloc(n * sizeof(bka_item));
+	bka_skyline_node* nodes = malloc((n + 1) * sizeof(bka_skyline_node));
+	if (!atlas->rects || !items || !nodes) goto fail;
+	atlas->n_rects = n;
+
+	double area = 0.0;
+	int max_w = 0, max_h = 0;
+	for (int i = 0; i < n; i++) {
+		bkp_ihdr ihdr;
+		if (!bkp_probe_png(paths[i], &ihdr)) goto fail;
+		atlas->rects[i].w = ihdr.width;
+		atlas->rects[i].h = ihdr.height;
+		items[i].w = ihdr.width + padding * 2;
+		items[i].h = ihdr.height + padding * 2;
+		items[i].index = i;
+		area += (double)items[i].w * items[i].h;
+		if (items[i].w > max_w) max_w = items[i].w;
+		if (items[i].h > max_h) max_h = items[i].h;
+	}
+	qsort(items, n, sizeof(bka_item), bka_item_cmp);
+
+	// Start from the smallest square that could hold the total area, try
+	// half its height first, and grow one side at a time
+	int side = 1;
+	while (side < max_w || side < max_h || (double)side * side < area) side *= 2;
+	int width = side, height = side / 2 >= max_h && area <= (double)side * side / 2 ? side / 2 : side;
+	while (!bka_pack(items, n, width, height, nodes, atlas->rects)) {
+		if (height < width) height *= 2;
+		else width *= 2;
+		if (width > max_size || height > max_size) goto fail;
+	}
+	if (width > max_size || height > max_size) goto fail;
+
+	atlas->width = width;
+	atlas->height = height;
+	atlas->pixels = calloc((size_t)width * height, 4);
+	if (!atlas->pixels) goto fail;
+
+	for (int i = 0; i < n; i++) {
+		bka_rect* r = &atlas->rects[i];
+		r->x += padding;
+		r->y += padding;
+		r->u0 = (float)r->x / width;
+		r->v0 = (float)r->y / height;
+		r->u1 = (float)(r->x + r->w) / width;
+		r->v1 = (float)(r->y + r->h) / height;
+	}
+
+	bka_job j = {atlas, paths, padding, flags, 0};
+	bkj_parallel_for(pool, n, bka_decode_one, &j);
+	if (j.failed) goto fail;
+
+	free(items);
+	free(nodes);
+	return 1;
+
+fail:
+	free(items);
+	free(nodes);
+	bka_free(atlas);
+	return 0;
+}
+
+BK_SIMD_END
+
+#endif
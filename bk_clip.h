@@ -0,0 +1,218 @@
+/*
+bk_clip.h - Batched vertex transform and clipping for the Brickate project
+
+This header is the vertex front end for the CPU renderers. Instead of
+transforming and clipping each triangle's three corners on their own,
+it transforms every vertex a draw references exactly once, 8 at a time,
+and keeps the results in a post-transform cache keyed by vertex index.
+
+Includes functions for:
+  - Transforming the vertices referenced by an index list by a mat4,
+    computing clip-space outcodes 8 vertices at a time (bk_simd)
+  - Perspective divide and viewport transform of the same batch
+  - Classifying triangles from their cached outcodes as accepted,
+    rejected or straddling
+  - Sutherland-Hodgman clipping of straddling triangles only, against
+    the planes their corners are actually outside of
+
+Outcode bits: 1 x < -w, 2 x > w, 4 y < -w, 8 y > w, 16 z < -w, 32 z > w.
+Screen coordinates have y pointing down and depth in [0, 1].
+*/
+
+#ifndef BK_CLIP_H
+#define BK_CLIP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_math.h"
+#include "bk_simd.h"
+
+BK_SIMD_BEGIN
+
+#define BKC_REJECT 0
+#define BKC_ACCEPT 1
+#define BKC_CLIP 2
+
+// Clip-space position plus up to 12 interpolated attributes
+#define BKC_MAX_FLOATS 16
+// A triangle clipped by six planes has at most 9 vertices
+#define BKC_MAX_POLY 9
+
+typedef struct {
+	size_t capacity; // vertices
+	uint32_t generation;
+	uint32_t* stamp; // generation in which each vertex was last transformed
+
+	// Post-transform results, one entry per vertex index
+	float* clip;      // x, y, z, w
+	float* screen;    // x, y, z, 1/w; valid when outcode is 0
+	uint8_t* outcode;
+
+	uint32_t* pending; // scratch: indices to transform this batch
+
+	size_t hits;
+	size_t misses;
+} bkc_cache;
+
+void bkc_cache_free(bkc_cache* c) {
+	free(c->stamp);
+	free(c->clip);
+	free(c->screen);
+	free(c->outcode);
+	free(c->pending);
+	memset(c, 0, sizeof(*c));
+}
+
+int bkc_cache_reserve(bkc_cache* c, size_t n_vertices) {
+	if (n_vertices <= c->capacity) return 1;
+
+	bkc_cache grown = {0};
+	grown.capacity = n_vertices;
+	grown.stamp = calloc(n_vertices, sizeof(uint32_t));
+	grown.clip = malloc(n_vertices * 4 * sizeof(float));
+	grown.screen = malloc(n_vertices * 4 * sizeof(float));
+	grown.outcode = malloc(n_vertices);
+	grown.pending = malloc(n_vertices * sizeof(uint32_t));
+	if (!grown.stamp || !grown.clip || !grown.screen || !grown.outcode || !grown.pending) {
+		bkc_cache_free(&grown);
+		return 0;
+	}
+	grown.hits = c->hits;
+	grown.misses = c->misses;
+
+	bkc_cache_free(c);
+	*c = grown;
+	return 1;
+}
+
+// Invalidates every cached vertex, e.g. for a new mesh or matrix
+void bkc_cache_reset(bkc_cache* c) {
+	if (++c->generation == 0) {
+		memset(c->stamp, 0, c->capacity * sizeof(uint32_t));
+		c->generation = 1;
+	}
+}
+
+// Transforms the 8 vertices in idx[0..n) (n <= 8)
+void bkc_transform8(bkc_cache* c, mat4 m, const unsigned char* positions, size_t stride,
+	const uint32_t* idx, int n, float width, float height) {
+	bk_f32x8 x = bk_f32x8_splat(0.0f), y = x, z = x;
+	for (int l = 0; l < n; l++) {
+		const float* p = (const float*)(positions + (size_t)idx[l] * stride);
+		x[l] = p[0];
+		y[l] = p[1];
+		z[l] = p[2];
+	}
+
+	bk_f32x8 cx = x * m[0] + y * m[4] + z * m[8] + m[12];
+	bk_f32x8 cy = x * m[1] + y * m[5] + z * m[9] + m[13];
+	bk_f32x8 cz = x * m[2] + y * m[6] + z * m[10] + m[14];
+	bk_f32x8 cw = x * m[3] + y * m[7] + z * m[11] + m[15];
+
+	bk_i32x8 oc = ((cx < -cw) & 1) | ((cx > cw) & 2)
+		| ((cy < -cw) & 4) | ((cy > cw) & 8)
+		| ((cz < -cw) & 16) | ((cz > cw) & 32);
+
+	// Divide only where it is meaningful; other lanes are never read
+	bk_f32x8 iw = bk_f32x8_select(cw > 0.0f, 1.0f / cw, bk_f32x8_splat(0.0f));
+	bk_f32x8 sx = (cx * iw * 0.5f + 0.5f) * width;
+	bk_f32x8 sy = (0.5f - cy * iw * 0.5f) * height;
+	bk_f32x8 sz = cz * iw * 0.5f + 0.5f;
+
+	for (int l = 0; l < n; l++) {
+		uint32_t i = idx[l];
+		float* cp = c->clip + (size_t)i * 4;
+		float* sp = c->screen + (size_t)i * 4;
+		cp[0] = cx[l];
+		cp[1] = cy[l];
+		cp[2] = cz[l];
+		cp[3] = cw[l];
+		sp[0] = sx[l];
+		sp[1] = sy[l];
+		sp[2] = sz[l];
+		sp[3] = iw[l];
+		c->outcode[i] = (uint8_t)oc[l];
+	}
+}
+
+// Makes sure every vertex referenced by 'indices' is in the cache.
+// 'positions' points at the first vertex's xyz, 'stride' is the byte
+// distance between vertices. The cache must have room for every index.
+void bkc_transform_indices(bkc_cache* c, mat4 m, const void* positions, size_t stride,
+	const uint32_t* indices, size_t n_indices, float width, float height) {
+	size_t n_pending = 0;
+	for (size_t i = 0; i < n_indices; i++) {
+		uint32_t v = indices[i];
+		if (c->stamp[v] == c->generation) {
+			c->hits++;
+			continue;
+		}
+		c->stamp[v] = c->generation;
+		c->pending[n_pending++] = v;
+	}
+	c->misses += n_pending;
+
+	for (size_t i = 0; i < n_pending; i += 8) {
+		int n = n_pending - i < 8 ? (int)(n_pending - i) : 8;
+		bkc_transform8(c, m, positions, stride, c->pending + i, n, width, height);
+	}
+}
+
+int bkc_classify(const bkc_cache* c, uint32_t i0, uint32_t i1, uint32_t i2) {
+	uint8_t a = c->outcode[i0], b = c->outcode[i1], d = c->outcode[i2];
+	if (a & b & d) return BKC_REJECT;
+	if ((a | b | d) == 0) return BKC_ACCEPT;
+	return BKC_CLIP;
+}
+
+// Signed distance to clip plane p (bit index of the outcode), >= 0 inside
+float bkc_plane_dist(const float* v, int p) {
+	float s = (p & 1) ? -v[p >> 1] : v[p >> 1];
+	return v[3] + s;
+}
+
+// Clips the convex polygon poly[0..n) with vertices of n_floats floats
+// (clip x, y, z, w first) against the planes in 'planes'. Returns the new
+// vertex count; the result is in poly.
+int bkc_clip_polygon(float poly[BKC_MAX_POLY][BKC_MAX_FLOATS], int n, int n_floats, uint32_t planes) {
+	float tmp[BKC_MAX_POLY][BKC_MAX_FLOATS];
+
+	for (int p = 0; p < 6 && n > 0; p++) {
+		if (!(planes & (1u << p))) continue;
+
+		int m = 0;
+		for (int i = 0; i < n; i++) {
+			const float* a = poly[i];
+			const float* b = poly[(i + 1) % n];
+			float da = bkc_plane_dist(a, p);
+			float db = bkc_plane_dist(b, p);
+
+			if (da >= 0.0f) memcpy(tmp[m++], a, n_floats * sizeof(float));
+			if ((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				for (int k = 0; k < n_floats; k++) tmp[m][k] = a[k] + (b[k] - a[k]) * t;
+				m++;
+			}
+		}
+
+		n = m;
+		for (int i = 0; i < n; i++) memcpy(poly[i], tmp[i], n_floats * sizeof(float));
+	}
+	return n;
+}
+
+// Perspective divide and viewport transform of one clip-space position:
+// out = screen x, y, depth, 1/w
+void bkc_project(const float clip[4], float width, float height, float out[4]) {
+	float iw = 1.0f / clip[3];
+	out[0] = (clip[0] * iw * 0.5f + 0.5f) * width;
+	out[1] = (0.5f - clip[1] * iw * 0.5f) * height;
+	out[2] = clip[2] * iw * 0.5f + 0.5f;
+	out[3] = iw;
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,491 @@
+/*
+bk_font.h - Bitmap font text for the Brickate project
+
+This header lays out and draws text with bitmap fonts whose glyphs live
+in a PNG atlas loaded through bk_png.
+
+Features:
+  - Fonts from a BMFont text descriptor (.fnt, one page, with kerning)
+    or from a fixed grid of equally sized cells
+  - Glyph metrics in a flat table for ASCII and a sorted array for the
+    rest of Unicode (UTF-8 input)
+  - Layouts cached by font and string content, so HUD and debug text that
+    repeats every frame is laid out once
+  - Output as batched quads for a GPU, or drawn on the CPU into a
+    bk_blit surface 8 pixels at a time (bk_simd)
+
+Glyph coverage comes from the atlas alpha, or from its red channel when
+the atlas is fully opaque (white-on-black exports).
+*/
+
+#ifndef BK_FONT_H
+#define BK_FONT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_png.h"
+#include "bk_simd.h"
+#include "bk_blit.h"
+
+BK_SIMD_BEGIN
+
+#define BKF_ASCII 128
+#define BKF_CACHE_SIZE 256 // cached layouts, a power of two
+
+typedef uint8_t bkf_u8x8 __attribute__((vector_size(8)));
+
+typedef struct {
+	uint32_t codepoint;
+	int16_t x, y, w, h;      // rectangle in the atlas
+	int16_t xoffset, yoffset;
+	int16_t advance;
+} bkf_glyph;
+
+typedef struct {
+	uint32_t pair;           // first << 16 | second, for codepoints below 65536
+	int16_t amount;
+} bkf_kerning;
+
+typedef struct {
+	unsigned char* coverage; // atlas_width * atlas_height
+	int atlas_width;
+	int atlas_height;
+	int line_height;
+	bkf_glyph* glyphs;       // sorted by codepoint
+	int n_glyphs;
+	int16_t ascii[BKF_ASCII]; // glyph index, or -1
+	bkf_kerning* kernings;   // sorted by pair
+	int n_kernings;
+} bkf_font;
+
+typedef struct {
+	int16_t x, y, w, h;      // relative to the text origin (top left)
+	int16_t sx, sy;          // atlas position
+	float u0, v0, u1, v1;
+} bkf_quad;
+
+typedef struct {
+	bkf_quad* quads;
+	int n_quads;
+	int width;
+	int height;
+} bkf_layout;
+
+typedef struct {
+	uint64_t hash;
+	const bkf_font* font;
+	char* text;
+	bkf_layout layout;
+} bkf_cache_entry;
+
+// Direct-mapped; a new string evicts whatever shared its slot
+typedef struct {
+	bkf_cache_entry entries[BKF_CACHE_SIZE];
+	uint64_t hits;
+	uint64_t misses;
+} bkf_cache;
+
+typedef struct {
+	float x0, y0, x1, y1;
+	float u0, v0, u1, v1;
+	uint32_t color;          // packed RGBA8
+} bkf_batch_quad;
+
+// Quads for one frame; reset keeps the memory
+typedef struct {
+	bkf_batch_quad* quads;
+	int n_quads;
+	int capacity;
+} bkf_batch;
+
+void bkf_free(bkf_font* f) {
+	free(f->coverage);
+	free(f->glyphs);
+	free(f->kernings);
+	memset(f, 0, sizeof(*f));
+}
+
+int bkf_glyph_cmp(const void* a, const void* b) {
+	uint32_t ca = ((const bkf_glyph*)a)->codepoint, cb = ((const bkf_glyph*)b)->codepoint;
+	return (ca > cb) - (ca < cb);
+}
+
+int bkf_kerning_cmp(const void* a, const void* b) {
+	uint32_t pa = ((const bkf_kerning*)a)->pair, pb = ((const bkf_kerning*)b)->pair;
+	return (pa > pb) - (pa < pb);
+}
+
+const bkf_glyph* bkf_find_glyph(const bkf_font* f, uint32_t codepoint) {
+	if (codepoint < BKF_ASCII) return f->ascii[codepoint] >= 0 ? &f->glyphs[f->ascii[codepoint]] : NULL;
+	int lo = 0, hi = f->n_glyphs - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (f->glyphs[mid].codepoint == codepoint) return &f->glyphs[mid];
+		if (f->glyphs[mid].codepoint < codepoint) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return NULL;
+}
+
+int bkf_kerning_amount(const bkf_font* f, uint32_t first, uint32_t second) {
+	if (!f->n_kernings || first > 0xFFFF || second > 0xFFFF) return 0;
+	uint32_t pair = first << 16 | second;
+	int lo = 0, hi = f->n_kernings - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (f->kernings[mid].pair == pair) return f->kernings[mid].amount;
+		if (f->kernings[mid].pair < pair) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return 0;
+}
+
+// Sorts the glyphs and kernings and builds the ASCII table
+void bkf_index(bkf_font* f) {
+	qsort(f->glyphs, f->n_glyphs, sizeof(bkf_glyph), bkf_glyph_cmp);
+	if (f->kernings) qsort(f->kernings, f->n_kernings, sizeof(bkf_kerning), bkf_kerning_cmp);
+	for (int i = 0; i < BKF_ASCII; i++) f->ascii[i] = -1;
+	for (int i = 0; i < f->n_glyphs; i++) {
+		if (f->glyphs[i].codepoint < BKF_ASCII) f->ascii[f->glyphs[i].codepoint] = (int16_t)i;
+	}
+}
+
+// Loads the atlas and keeps only its coverage
+int bkf_load_atlas(bkf_font* f, const char* path) {
+	uint32_t w, h;
+	unsigned char* rgba = bkp_load_png(path, &w, &h, NULL);
+	if (!rgba) return 0;
+
+	size_t n = (size_t)w * h;
+	int opaque = 1;
+	for (size_t i = 0; i < n && opaque; i++) opaque = rgba[i * 4 + 3] == 255;
+
+	f->coverage = malloc(n ? n : 1);
+	if (!f->coverage) {
+		free(rgba);
+		return 0;
+	}
+	for (size_t i = 0; i < n; i++) f->coverage[i] = rgba[i * 4 + (opaque ? 0 : 3)];
+	f->atlas_width = (int)w;
+	f->atlas_height = (int)h;
+	free(rgba);
+	return 1;
+}
+
+// Loads a monospaced font laid out as a grid of cell_w x cell_h cells,
+// row by row, starting with codepoint 'first'. Every cell becomes a glyph.
+int bkf_load_grid(bkf_font* f, const char* png_path, int cell_w, int cell_h, uint32_t first) {
+	memset(f, 0, sizeof(*f));
+	if (cell_w <= 0 || cell_h <= 0 || !bkf_load_atlas(f, png_path)) return 0;
+
+	int cols = f->atlas_width / cell_w, rows = f->atlas_height / cell_h;
+	f->line_height = cell_h;
+	size_t n = (size_t)cols * rows;
+	f->glyphs = malloc((n ? n : 1) * sizeof(bkf_glyph));
+	if (!f->glyphs) {
+		bkf_free(f);
+		return 0;
+	}
+	for (int r = 0; r < rows; r++) {
+		for (int c = 0; c < cols; c++) {
+			bkf_glyph* g = &f->glyphs[f->n_glyphs++];
+			*g = (bkf_glyph){first + r * cols + c, (int16_t)(c * cell_w), (int16_t)(r * cell_h),
+				(int16_t)cell_w, (int16_t)cell_h, 0, 0, (int16_t)cell_w};
+		}
+	}
+	bkf_index(f);
+	return 1;
+}
+
+// Value of key=... in a BMFont line, or NULL
+const char* bkf_fnt_value(const char* line, const char* key) {
+	size_t n = strlen(key);
+	for (const char* p = line; (p = strstr(p, key)); p += n) {
+		if ((p == line || p[-1] == ' ') && p[n] == '=') return p + n + 1;
+	}
+	return NULL;
+}
+
+int bkf_fnt_int(const char* line, const char* key) {
+	const char* v = bkf_fnt_value(line, key);
+	return v ? atoi(v) : 0;
+}
+
+// Loads a BMFont text descriptor and its first page, which is looked up
+// next to the .fnt file. Returns 1 on success.
+int bkf_load_bmfont(bkf_font* f, const char* fnt_path) {
+	memset(f, 0, sizeof(*f));
+	FILE* file = fopen(fnt_path, "r");
+	if (!file) return 0;
+
+	char line[512], page[256] = "";
+	int glyph_cap = 0, kerning_cap = 0, ok = 1;
+	while (ok && fgets(line, sizeof(line), file)) {
+		if (strncmp(line, "common ", 7) == 0) {
+			f->line_height = bkf_fnt_int(line, "lineHeight");
+		} else if (strncmp(line, "page ", 5) == 0 && bkf_fnt_int(line, "id") == 0) {
+			const char* v = bkf_fnt_value(line, "file");
+			if (v && *v == '"') sscanf(v + 1, "%255[^\"]", page);
+			else if (v) sscanf(v, "%255s", page);
+		} else if (strncmp(line, "char ", 5) == 0) {
+			if (bkf_fnt_int(line, "page") != 0) continue;
+			if (f->n_glyphs == glyph_cap) {
+				glyph_cap = glyph_cap ? glyph_cap * 2 : 128;
+				bkf_glyph* grown = realloc(f->glyphs, glyph_cap * sizeof(bkf_glyph));
+				if (!grown) {
+					ok = 0;
+					break;
+				}
+				f->glyphs = grown;
+			}
+			f->glyphs[f->n_glyphs++] = (bkf_glyph){(uint32_t)bkf_fnt_int(line, "id"),
+				(int16_t)bkf_fnt_int(line, "x"), (int16_t)bkf_fnt_int(line, "y"),
+				(int16_t)bkf_fnt_int(line, "width"), (int16_t)bkf_fnt_int(line, "height"),
+				(int16_t)bkf_fnt_int(line, "xoffset"), (int16_t)bkf_fnt_int(line, "yoffset"),
+				(int16_t)bkf_fnt_int(line, "xadvance")};
+		} else if (strncmp(line, "kerning ", 8) == 0) {
+			if (f->n_kernings == kerning_cap) {
+				kerning_cap = kerning_cap ? kerning_cap * 2 : 64;
+				bkf_kerning* grown = realloc(f->kernings, kerning_cap * sizeof(bkf_kerning));
+				if (!grown) {
+					ok = 0;
+					break;
+				}
+				f->kernings = grown;
+			}
+			uint32_t first = (uint32_t)bkf_fnt_int(line, "first"), second = (uint32_t)bkf_fnt_int(line, "second");
+			if (first <= 0xFFFF && second <= 0xFFFF) {
+				f->kernings[f->n_kernings++] = (bkf_kerning){first << 16 | second, (int16_t)bkf_fnt_int(line, "amount")};
+			}
+		}
+	}
+	fclose(file);
+
+	// The page path is relative to the descriptor
+	char path[1024];
+	const char* slash = strrchr(fnt_path, '/');
+	int dir_len = slash ? (int)(slash - fnt_path + 1) : 0;
+	ok = ok && page[0] && snprintf(path, sizeof(path), "%.*s%s", dir_len, fnt_path, page) < (int)sizeof(path);
+	ok = ok && bkf_load_atlas(f, path);
+
+	// Glyphs must lie inside the atlas for the blitter
+	for (int i = 0; ok && i < f->n_glyphs; i++) {
+		const bkf_glyph* g = &f->glyphs[i];
+		ok = g->x >= 0 && g->y >= 0 && g->w >= 0 && g->h >= 0
+			&& g->x + g->w <= f->atlas_width && g->y + g->h <= f->atlas_height;
+	}
+	if (!ok) {
+		bkf_free(f);
+		return 0;
+	}
+	bkf_index(f);
+	return 1;
+}
+
+// Decodes one UTF-8 sequence, advancing *s; invalid bytes become U+FFFD
+uint32_t bkf_next_codepoint(const char** s) {
+	const unsigned char* p = (const unsigned char*)*s;
+	uint32_t c = p[0];
+	int n = c < 0x80 ? 0 : (c >> 5) == 6 ? 1 : (c >> 4) == 14 ? 2 : (c >> 3) == 30 ? 3 : -1;
+	if (n < 0) {
+		*s += 1;
+		return 0xFFFD;
+	}
+	if (n > 0) c &= 0x3F >> n;
+	for (int i = 1; i <= n; i++) {
+		if ((p[i] & 0xC0) != 0x80) {
+			*s += i;
+			return 0xFFFD;
+		}
+		c = c << 6 | (p[i] & 0x3F);
+	}
+	*s += n + 1;
+	return c;
+}
+
+void bkf_layout_free(bkf_layout* l) {
+	free(l->quads);
+	memset(l, 0, sizeof(*l));
+}
+
+// Lays out UTF-8 text with its top left at the origin; '\n' starts a new
+// line. Characters without a glyph are skipped. Returns 1 on success.
+int bkf_layout_text(const bkf_font* f, const char* text, bkf_layout* out) {
+	memset(out, 0, sizeof(*out));
+	size_t cap = strlen(text);
+	out->quads = malloc((cap ? cap : 1) * sizeof(bkf_quad));
+	if (!out->quads) return 0;
+
+	int pen_x = 0, pen_y = 0;
+	uint32_t prev = 0;
+	float iu = 1.0f / f->atlas_width, iv = 1.0f / f->atlas_height;
+	while (*text) {
+		uint32_t c = bkf_next_codepoint(&text);
+		if (c == '\n') {
+			pen_x = 0;
+			pen_y += f->line_height;
+			prev = 0;
+			continue;
+		}
+		const bkf_glyph* g = bkf_find_glyph(f, c);
+		if (!g) continue;
+
+		if (prev) pen_x += bkf_kerning_amount(f, prev, c);
+		prev = c;
+		if (g->w > 0 && g->h > 0) {
+			bkf_quad* q = &out->quads[out->n_quads++];
+			q->x = (int16_t)(pen_x + g->xoffset);
+			q->y = (int16_t)(pen_y + g->yoffset);
+			q->w = g->w;
+			q->h = g->h;
+			q->sx = g->x;
+			q->sy = g->y;
+			q->u0 = g->x * iu;
+			q->v0 = g->y * iv;
+			q->u1 = (g->x + g->w) * iu;
+			q->v1 = (g->y + g->h) * iv;
+		}
+		pen_x += g->advance;
+		if (pen_x > out->width) out->width = pen_x;
+	}
+	out->height = pen_y + f->line_height;
+	return 1;
+}
+
+void bkf_cache_clear(bkf_cache* c) {
+	for (int i = 0; i < BKF_CACHE_SIZE; i++) {
+		free(c->entries[i].text);
+		bkf_layout_free(&c->entries[i].layout);
+	}
+	memset(c, 0, sizeof(*c));
+}
+
+// FNV-1a of the text, mixed with the font address
+uint64_t bkf_hash(const bkf_font* f, const char* text) {
+	uint64_t h = 0xCBF29CE484222325ull ^ (uint64_t)(uintptr_t)f;
+	for (const unsigned char* p = (const unsigned char*)text; *p; p++) h = (h ^ *p) * 0x100000001B3ull;
+	return h;
+}
+
+// The layout of text in font f, from the cache when it has been laid out
+// before. The result stays valid until the next call with this cache.
+// Clear the cache before freeing a font. Returns NULL on failure.
+const bkf_layout* bkf_layout_cached(bkf_cache* c, const bkf_font* f, const char* text) {
+	uint64_t h = bkf_hash(f, text);
+	bkf_cache_entry* e = &c->entries[h & (BKF_CACHE_SIZE - 1)];
+	if (e->text && e->hash == h && e->font == f && strcmp(e->text, text) == 0) {
+		c->hits++;
+		return &e->layout;
+	}
+
+	c->misses++;
+	free(e->text);
+	bkf_layout_free(&e->layout);
+	e->text = NULL;
+
+	size_t n = strlen(text) + 1;
+	char* copy = malloc(n);
+	if (!copy || !bkf_layout_text(f, text, &e->layout)) {
+		free(copy);
+		return NULL;
+	}
+	memcpy(copy, text, n);
+	e->text = copy;
+	e->hash = h;
+	e->font = f;
+	return &e->layout;
+}
+
+void bkf_batch_free(bkf_batch* b) {
+	free(b->quads);
+	memset(b, 0, sizeof(*b));
+}
+
+void bkf_batch_reset(bkf_batch* b) {
+	b->n_quads = 0;
+}
+
+// Appends the quads of a layout at (x, y) in 'color' (packed RGBA8)
+int bkf_batch_layout(bkf_batch* b, const bkf_layout* l, float x, float y, uint32_t color) {
+	if (b->n_quads + l->n_quads > b->capacity) {
+		int cap = b->capacity ? b->capacity : 256;
+		while (cap < b->n_quads + l->n_quads) cap *= 2;
+		bkf_batch_quad* grown = realloc(b->quads, (size_t)cap * sizeof(bkf_batch_quad));
+		if (!grown) return 0;
+		b->quads = grown;
+		b->capacity = cap;
+	}
+	for (int i = 0; i < l->n_quads; i++) {
+		const bkf_quad* q = &l->quads[i];
+		b->quads[b->n_quads++] = (bkf_batch_quad){x + q->x, y + q->y, x + q->x + q->w, y + q->y + q->h,
+			q->u0, q->v0, q->u1, q->v1, color};
+	}
+	return 1;
+}
+
+int bkf_batch_text(bkf_batch* b, bkf_cache* c, const bkf_font* f, const char* text, float x, float y, uint32_t color) {
+	const bkf_layout* l = bkf_layout_cached(c, f, text);
+	return l && bkf_batch_layout(b, l, x, y, color);
+}
+
+// Blends 'color' through the coverage of one glyph row, 8 pixels at a time
+void bkf_blit_span(uint32_t* dst, const unsigned char* coverage, int n, uint32_t color) {
+	bk_u32x8 rgb = bk_u32x8_splat(color & 0x00FFFFFF);
+	bk_u32x8 alpha = bk_u32x8_splat(color >> 24);
+	for (int x = 0; x < n; x += 8) {
+		int m = n - x < 8 ? n - x : 8;
+		uint64_t cov8 = 0;
+		memcpy(&cov8, coverage + x, m);
+		if (!cov8) continue; // empty glyph borders are common
+
+		bk_u32x8 d;
+		memcpy(&d, dst + x, m * 4);
+		bk_u32x8 cov = __builtin_convertvector((bkf_u8x8)cov8, bk_u32x8);
+		bk_u32x8 src = rgb | bkb_div255_pairs(cov * alpha) << 24;
+		d = bkb_blend_alpha(src, d);
+		memcpy(dst + x, &d, m * 4);
+	}
+}
+
+// Draws a layout with its origin at (x, y), clipped to the surface and
+// to 'clip' (which may be NULL), in straight-alpha 'color'
+void bkf_draw_layout(bkb_surface* dst, const bkb_rect* clip, const bkf_font* f, const bkf_layout* l, int x, int y, uint32_t color) {
+	int cx0 = 0, cy0 = 0, cx1 = dst->width, cy1 = dst->height;
+	if (clip) {
+		if (clip->x > cx0) cx0 = clip->x;
+		if (clip->y > cy0) cy0 = clip->y;
+		if (clip->x + clip->w < cx1) cx1 = clip->x + clip->w;
+		if (clip->y + clip->h < cy1) cy1 = clip->y + clip->h;
+	}
+
+	for (int i = 0; i < l->n_quads; i++) {
+		const bkf_quad* q = &l->quads[i];
+		int x0 = x + q->x, y0 = y + q->y, x1 = x0 + q->w, y1 = y0 + q->h;
+		int sx = q->sx - x0, sy = q->sy - y0; // atlas minus screen position
+		if (x0 < cx0) x0 = cx0;
+		if (y0 < cy0) y0 = cy0;
+		if (x1 > cx1) x1 = cx1;
+		if (y1 > cy1) y1 = cy1;
+		if (x0 >= x1 || y0 >= y1) continue;
+
+		for (int py = y0; py < y1; py++) {
+			const unsigned char* cov = f->coverage + (size_t)(py + sy) * f->atlas_width + (x0 + sx);
+			bkf_blit_span(dst->pixels + (size_t)py * dst->stride + x0, cov, x1 - x0, color);
+		}
+	}
+}
+
+// Lays out (through the cache) and draws text with its top left at (x, y)
+int bkf_draw_text(bkb_surface* dst, const bkb_rect* clip, bkf_cache* c, const bkf_font* f, const char* text, int x, int y, uint32_t color) {
+	const bkf_layout* l = bkf_layout_cached(c, f, text);
+	if (!l) return 0;
+	bkf_draw_layout(dst, clip, f, l, x, y, color);
+	return 1;
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,1099 @@
+/*
+bk_geom.h - Mesh optimization for the Brickate project
+
+This header turns imported triangle soups into indexed meshes that are
+cheap to draw, on the GPU and in the CPU rasterizer (bk_raster) alike.
+
+Includes functions for:
+  - Deduplicating identical vertices into an index buffer, and welding
+    positions that lie within a distance of each other (hashed grid)
+  - Reordering triangles for the post-transform vertex cache (Tipsify)
+  - Splitting the result into clusters and sorting them so that outward
+    facing clusters are drawn first, reducing overdraw at a small cost
+    in cache efficiency
+  - Reordering vertices in order of first use, so vertex fetches walk
+    memory forwards
+  - Measuring the average cache miss ratio of an index buffer
+  - Simplification by edge collapse in order of quadric error, with a
+    lazily updated priority queue, keeping open borders and attribute
+    seams in place, down to a triangle count or an error bound
+  - Building LOD chains, or simplifying several meshes, in parallel on a
+    bk_job pool
+
+A typical pipeline is bkg_generate_remap, bkg_remap_vertices and
+bkg_remap_indices, then bkg_optimize_cache, bkg_optimize_overdraw and
+finally bkg_optimize_fetch. Simplify before optimizing: bkg_simplify
+keeps the vertex buffer and only returns new indices.
+
+Positions are three floats at the start of each vertex, or anywhere
+with an explicit byte stride, as in bk_clip. Indices are 32-bit.
+*/
+
+#ifndef BK_GEOM_H
+#define BK_GEOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bk_math.h"
+#include "bk_job.h"
+
+#define BKG_CACHE_SIZE 16 // post-transform cache entries to optimize for
+#define BKG_NONE 0xFFFFFFFFu
+
+#define BKG_KIND_MANIFOLD 0
+#define BKG_KIND_BORDER 1 // on an open edge of the surface
+#define BKG_KIND_SEAM 2   // two vertices at one position, e.g. a UV seam
+#define BKG_KIND_LOCKED 3
+
+#define BKG_EDGE_WEIGHT 10.0f // of border and seam edge quadrics
+
+const float* bkg_position(const void* positions, size_t stride, uint32_t i) {
+	return (const float*)((const unsigned char*)positions + (size_t)i * stride);
+}
+
+uint32_t bkg_hash_bytes(const unsigned char* p, size_t n) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+size_t bkg_table_size(size_t n) {
+	size_t size = 16;
+	while (size < n + n / 2) size *= 2;
+	return size;
+}
+
+// Builds a remap table that maps every vertex to the first vertex with
+// identical bytes, renumbered densely in order of first appearance.
+// Returns the number of unique vertices, or 0 on allocation failure.
+size_t bkg_generate_remap(uint32_t* remap, const void* vertices, size_t n_vertices, size_t vertex_size) {
+	size_t size = bkg_table_size(n_vertices), mask = size - 1;
+	uint32_t* table = malloc(size * sizeof(uint32_t));
+	if (!table) return 0;
+	memset(table, 0xFF, size * sizeof(uint32_t));
+
+	const unsigned char* v = vertices;
+	size_t unique = 0;
+	for (size_t i = 0; i < n_vertices; i++) {
+		const unsigned char* p = v + i * vertex_size;
+		size_t slot = bkg_hash_bytes(p, vertex_size) & mask;
+		while (table[slot] != BKG_NONE && memcmp(v + (size_t)table[slot] * vertex_size, p, vertex_size) != 0) {
+			slot = (slot + 1) & mask;
+		}
+		if (table[slot] == BKG_NONE) {
+			table[slot] = (uint32_t)i;
+			remap[i] = (uint32_t)unique++;
+		} else {
+			remap[i] = remap[table[slot]];
+		}
+	}
+	free(table);
+	return unique;
+}
+
+uint32_t bkg_cell_hash(int32_t x, int32_t y, int32_t z) {
+	return ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+}
+
+int32_t bkg_cell(float p, float inv) {
+	float c = floorf(p * inv);
+	return c < -1e9f ? -1000000000 : (c > 1e9f ? 1000000000 : (int32_t)c);
+}
+
+// Builds a remap table that merges vertices whose positions are within
+// 'epsilon' of an earlier kept vertex (exact matches when epsilon is 0),
+// ignoring every other attribute. Returns the number of unique
+// positions, or 0 on allocation failure.
+size_t bkg_weld(uint32_t* remap, const void* positions, size_t stride, size_t n_vertices, float epsilon) {
+	if (epsilon <= 0) {
+		// Normalize -0 so it welds with +0, then match exactly
+		float* p = malloc((n_vertices ? n_vertices : 1) * 3 * sizeof(float));
+		if (!p) return 0;
+		for (size_t i = 0; i < n_vertices; i++) {
+			for (int k = 0; k < 3; k++) p[i * 3 + k] = bkg_position(positions, stride, (uint32_t)i)[k] + 0.0f;
+		}
+		size_t unique = bkg_generate_remap(remap, p, n_vertices, 3 * sizeof(float));
+		free(p);
+		return unique;
+	}
+
+	// Kept vertices are chained per grid cell of size epsilon, so a match
+	// is always in one of the 27 cells around a vertex
+	size_t size = bkg_table_size(n_vertices), mask = size - 1;
+	uint32_t* head = malloc(size * sizeof(uint32_t));
+	uint32_t* next = malloc((n_vertices ? n_vertices : 1) * sizeof(uint32_t));
+	if (!head || !next) {
+		free(head);
+		free(next);
+		return 0;
+	}
+	memset(head, 0xFF, size * sizeof(uint32_t));
+
+	float inv = 1.0f / epsilon, eps2 = epsilon * epsilon;
+	size_t unique = 0;
+	for (size_t i = 0; i < n_vertices; i++) {
+		const float* p = bkg_position(positions, stride, (uint32_t)i);
+		int32_t cx = bkg_cell(p[0], inv), cy = bkg_cell(p[1], inv), cz = bkg_cell(p[2], inv);
+		uint32_t match = BKG_NONE;
+
+		for (int d = 0; d < 27 && match == BKG_NONE; d++) {
+			uint32_t bucket = bkg_cell_hash(cx + d % 3 - 1, cy + d / 3 % 3 - 1, cz + d / 9 - 1) & mask;
+			for (uint32_t j = head[bucket]; j != BKG_NONE; j = next[j]) {
+				const float* q = bkg_position(positions, stride, j);
+				float dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+				if (dx * dx + dy * dy + dz * dz <= eps2) {
+					match = j;
+					break;
+				}
+			}
+		}
+
+		if (match == BKG_NONE) {
+			uint32_t bucket = bkg_cell_hash(cx, cy, cz) & mask;
+			next[i] = head[bucket];
+			head[bucket] = (uint32_t)i;
+			remap[i] = (uint32_t)unique++;
+		} else {
+			remap[i] = remap[match];
+		}
+	}
+	free(head);
+	free(next);
+	return unique;
+}
+
+// Copies each vertex to its slot in the remapped buffer
+void bkg_remap_vertices(void* dst, const void* src, size_t n_vertices, size_t vertex_size, const uint32_t* remap) {
+	for (size_t i = 0; i < n_vertices; i++) {
+		if (remap[i] == BKG_NONE) continue;
+		memcpy((unsigned char*)dst + (size_t)remap[i] * vertex_size, (const unsigned char*)src + i * vertex_size, vertex_size);
+	}
+}
+
+// Writes remap[indices[i]], or remap[i] for an unindexed soup when
+// indices is NULL. dst may be the same buffer as indices.
+void bkg_remap_indices(uint32_t* dst, const uint32_t* indices, size_t n_indices, const uint32_t* remap) {
+	for (size_t i = 0; i < n_indices; i++) dst[i] = remap[indices ? indices[i] : i];
+}
+
+// Average number of vertex transforms per triangle with a FIFO cache of
+// cache_size entries: 3 without reuse, about 0.5 at best for grids
+float bkg_cache_acmr(const uint32_t* indices, size_t n_indices, size_t n_vertices, int cache_size) {
+	size_t n_triangles = n_indices / 3;
+	uint32_t* stamp = calloc(n_vertices ? n_vertices : 1, sizeof(uint32_t));
+	if (!stamp || !n_triangles) {
+		free(stamp);
+		return 0;
+	}
+
+	// A vertex is in the cache while fewer than cache_size misses happened
+	// since it was loaded
+	uint32_t misses = 0;
+	for (size_t i = 0; i < n_triangles * 3; i++) {
+		uint32_t v = indices[i];
+		if (stamp[v] && misses - stamp[v] < (uint32_t)cache_size) continue;
+		stamp[v] = ++misses;
+	}
+	free(stamp);
+	return (float)misses / n_triangles;
+}
+
+typedef struct {
+	uint32_t* offsets; // n_vertices + 1, into triangles
+	uint32_t* triangles;
+	uint32_t* live;    // triangles not yet emitted, per vertex
+} bkg_adjacency;
+
+void bkg_adjacency_free(bkg_adjacency* a) {
+	free(a->offsets);
+	free(a->triangles);
+	free(a->live);
+	memset(a, 0, sizeof(*a));
+}
+
+int bkg_adjacency_build(bkg_adjacency* a, const uint32_t* indices, size_t n_indices, size_t n_vertices) {
+	a->offsets = calloc(n_vertices + 1, sizeof(uint32_t));
+	a->triangles = malloc((n_indices ? n_indices : 1) * sizeof(uint32_t));
+	a->live = calloc(n_vertices ? n_vertices : 1, sizeof(uint32_t));
+	if (!a->offsets || !a->triangles || !a->live) {
+		bkg_adjacency_free(a);
+		return 0;
+	}
+
+	for (size_t i = 0; i < n_indices; i++) a->live[indices[i]]++;
+	for (size_t v = 0; v < n_vertices; v++) a->offsets[v + 1] = a->offsets[v] + a->live[v];
+	// Fill the lists while counting the valences up again
+	memset(a->live, 0, n_vertices * sizeof(uint32_t));
+	for (size_t i = 0; i < n_indices; i++) {
+		uint32_t v = indices[i];
+		a->triangles[a->offsets[v] + a->live[v]++] = (uint32_t)(i / 3);
+	}
+	return 1;
+}
+
+// Reorders triangles for a post-transform cache of cache_size entries
+// (Tipsify: fans around vertices that stay in the cache, falling back to
+// recently used vertices at dead ends). dst must not alias indices.
+// 'clusters', if not NULL, receives the index of the first triangle of
+// every run that started from a dead end, and *n_clusters their count;
+// it needs room for n_indices / 3 entries. Returns 0 on allocation
+// failure.
+int bkg_tipsify(uint32_t* dst, const uint32_t* indices, size_t n_indices, size_t n_vertices, int cache_size,
+	uint32_t* clusters, size_t* n_clusters) {
+	size_t n_triangles = n_indices / 3;
+	bkg_adjacency adj = {0};
+	uint32_t* cache_time = calloc(n_vertices ? n_vertices : 1, sizeof(uint32_t));
+	uint32_t* dead_end = malloc((n_triangles * 3 + 1) * sizeof(uint32_t));
+	uint32_t* candidates = malloc((n_triangles * 3 + 1) * sizeof(uint32_t));
+	unsigned char* emitted = calloc(n_triangles ? n_triangles : 1, 1);
+	if (!cache_time || !dead_end || !candidates || !emitted || !bkg_adjacency_build(&adj, indices, n_triangles * 3, n_vertices)) {
+		free(cache_time);
+		free(dead_end);
+		free(candidates);
+		free(emitted);
+		return 0;
+	}
+
+	uint32_t time = (uint32_t)cache_size + 1;
+	size_t out = 0, n_dead = 0, cursor = 0, clusters_out = 0;
+	uint32_t fan = BKG_NONE;
+	while (cursor < n_vertices && !adj.live[cursor]) cursor++;
+	if (cursor < n_vertices) fan = (uint32_t)cursor;
+	if (fan != BKG_NONE && clusters) clusters[clusters_out++] = 0;
+
+	while (fan != BKG_NONE) {
+		size_t n_candidates = 0;
+		for (uint32_t k = adj.offsets[fan]; k < adj.offsets[fan + 1]; k++) {
+			uint32_t t = adj.triangles[k];
+			if (emitted[t]) continue;
+			emitted[t] = 1;
+			for (int c = 0; c < 3; c++) {
+				uint32_t v = indices[t * 3 + c];
+				dst[out++] = v;
+				dead_end[n_dead++] = v;
+				candidates[n_candidates++] = v;
+				adj.live[v]--;
+				if (time - cache_time[v] > (uint32_t)cache_size) cache_time[v] = time++;
+			}
+		}
+
+		// Prefer the candidate that entered the cache earliest and still
+		// stays in it while its remaining triangles are drawn
+		uint32_t best = BKG_NONE;
+		int best_priority = -1;
+		for (size_t c = 0; c < n_candidates; c++) {
+			uint32_t v = candidates[c];
+			if (!adj.live[v]) continue;
+			int priority = 0;
+			uint32_t age = time - cache_time[v];
+			if (age + 2 * adj.live[v] <= (uint32_t)cache_size) priority = (int)age;
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+
+		if (best == BKG_NONE) {
+			while (n_dead && best == BKG_NONE) {
+				uint32_t v = dead_end[--n_dead];
+				if (adj.live[v]) best = v;
+			}
+			while (best == BKG_NONE && cursor < n_vertices) {
+				if (adj.live[cursor]) best = (uint32_t)cursor;
+				else cursor++;
+			}
+			if (best != BKG_NONE && clusters) clusters[clusters_out++] = (uint32_t)(out / 3);
+		}
+		fan = best;
+	}
+
+	if (n_clusters) *n_clusters = clusters_out;
+	bkg_adjacency_free(&adj);
+	free(cache_time);
+	free(dead_end);
+	free(candidates);
+	free(emitted);
+	return 1;
+}
+
+// Reorders triangles for a BKG_CACHE_SIZE entry post-transform cache.
+// dst may be the same buffer as indices. Returns 0 on allocation failure.
+int bkg_optimize_cache(uint32_t* dst, const uint32_t* indices, size_t n_indices, size_t n_vertices) {
+	n_indices -= n_indices % 3;
+	uint32_t* out = malloc((n_indices ? n_indices : 1) * sizeof(uint32_t));
+	if (!out || !bkg_tipsify(out, indices, n_indices, n_vertices, BKG_CACHE_SIZE, NULL, NULL)) {
+		free(out);
+		return 0;
+	}
+	memcpy(dst, out, n_indices * sizeof(uint32_t));
+	free(out);
+	return 1;
+}
+
+// Misses of one triangle in a FIFO cache of BKG_CACHE_SIZE entries.
+// Advancing *clock by more than the cache size empties the cache.
+int bkg_cache_misses(uint32_t* stamp, uint32_t* clock, const uint32_t* triangle) {
+	int misses = 0;
+	for (int c = 0; c < 3; c++) {
+		uint32_t v = triangle[c];
+		if (stamp[v] && *clock - stamp[v] < BKG_CACHE_SIZE) continue;
+		stamp[v] = ++*clock;
+		misses++;
+	}
+	return misses;
+}
+
+typedef struct {
+	uint32_t first; // triangle
+	uint32_t count;
+	float sort_key;
+} bkg_cluster;
+
+int bkg_cluster_cmp(const void* a, const void* b) {
+	const bkg_cluster* ca = a;
+	const bkg_cluster* cb = b;
+	if (ca->sort_key != cb->sort_key) return ca->sort_key < cb->sort_key ? 1 : -1;
+	return (ca->first > cb->first) - (ca->first < cb->first);
+}
+
+// Splits cache-ordered triangles into clusters and draws the clusters
+// that face away from the mesh center first, so they tend to occlude the
+// rest. A cluster ends at every triangle whose three vertices all miss a
+// BKG_CACHE_SIZE FIFO cache, and also as soon as its own miss ratio is
+// within 'threshold' (e.g. 1.05) of what the whole run achieves, so
+// higher thresholds give more, smaller clusters and less overdraw for
+// more vertex transforms. Triangles are expected to wind counterclockwise
+// seen from outside. dst may be the same buffer as indices. Returns 0 on
+// allocation failure.
+int bkg_optimize_overdraw(uint32_t* dst, const uint32_t* indices, size_t n_indices,
+	const void* positions, size_t stride, size_t n_vertices, float threshold) {
+	size_t n_triangles = n_indices / 3;
+	if (!n_triangles) return 1;
+
+	uint32_t* stamp = calloc(n_vertices ? n_vertices : 1, sizeof(uint32_t));
+	uint32_t* hard = malloc((n_triangles + 1) * sizeof(uint32_t));
+	bkg_cluster* clusters = malloc(n_triangles * sizeof(bkg_cluster));
+	uint32_t* out = malloc(n_triangles * 3 * sizeof(uint32_t));
+	if (!stamp || !hard || !clusters || !out) {
+		free(stamp);
+		free(hard);
+		free(clusters);
+		free(out);
+		return 0;
+	}
+
+	// Hard boundaries at triangles that miss the cache with all three
+	// vertices, where the cache was effectively flushed
+	uint32_t clock = 0;
+	size_t n_hard = 0;
+	for (size_t t = 0; t < n_triangles; t++) {
+		if (t == 0 || bkg_cache_misses(stamp, &clock, indices + t * 3) == 3) hard[n_hard++] = (uint32_t)t;
+	}
+	hard[n_hard] = (uint32_t)n_triangles;
+
+	// Soft boundaries inside each hard cluster, simulating every cluster
+	// from an empty cache as it may be drawn after any other
+	size_t n_clusters = 0;
+	for (size_t h = 0; h < n_hard; h++) {
+		uint32_t begin = hard[h], end = hard[h + 1], run_misses = 0;
+		clock += BKG_CACHE_SIZE + 1;
+		for (uint32_t t = begin; t < end; t++) run_misses += bkg_cache_misses(stamp, &clock, indices + (size_t)t * 3);
+		float target = (float)run_misses / (end - begin) * threshold;
+
+		uint32_t start = begin, cluster_misses = 0;
+		clock += BKG_CACHE_SIZE + 1;
+		for (uint32_t t = begin; t < end; t++) {
+			cluster_misses += bkg_cache_misses(stamp, &clock, indices + (size_t)t * 3);
+			if (t + 1 == end || (float)cluster_misses / (t + 1 - start) <= target) {
+				clusters[n_clusters++] = (bkg_cluster){start, t + 1 - start, 0};
+				start = t + 1;
+				cluster_misses = 0;
+				clock += BKG_CACHE_SIZE + 1;
+			}
+		}
+	}
+
+	// Area-weighted centroid of the mesh
+	vec3 mesh_center = {0, 0, 0};
+	float mesh_area = 0;
+	for (size_t t = 0; t < n_triangles; t++) {
+		const float* p0 = bkg_position(positions, stride, indices[t * 3 + 0]);
+		const float* p1 = bkg_position(positions, stride, indices[t * 3 + 1]);
+		const float* p2 = bkg_position(positions, stride, indices[t * 3 + 2]);
+		vec3 e1, e2, n;
+		bkm_vec3_sub((float*)p1, (float*)p0, e1);
+		bkm_vec3_sub((float*)p2, (float*)p0, e2);
+		bkm_vec3_cross(e1, e2, n);
+		float area = bkm_vec3_len(n);
+		for (int k = 0; k < 3; k++) mesh_center[k] += (p0[k] + p1[k] + p2[k]) * area;
+		mesh_area += area;
+	}
+	if (mesh_area > 0) bkm_vec3_scale(mesh_center, 1.0f / (3 * mesh_area), mesh_center);
+
+	// Clusters whose average normal points away from the center go first
+	for (size_t i = 0; i < n_clusters; i++) {
+		vec3 center = {0, 0, 0}, normal = {0, 0, 0};
+		float area_sum = 0;
+		for (uint32_t t = clusters[i].first; t < clusters[i].first + clusters[i].count; t++) {
+			const float* p0 = bkg_position(positions, stride, indices[t * 3 + 0]);
+			const float* p1 = bkg_position(positions, stride, indices[t * 3 + 1]);
+			const float* p2 = bkg_position(positions, stride, indices[t * 3 + 2]);
+			vec3 e1, e2, n;
+			bkm_vec3_sub((float*)p1, (float*)p0, e1);
+			bkm_vec3_sub((float*)p2, (float*)p0, e2);
+			bkm_vec3_cross(e1, e2, n);
+			float area = bkm_vec3_len(n);
+			for (int k = 0; k < 3; k++) {
+				center[k] += (p0[k] + p1[k] + p2[k]) * area;
+				normal[k] += n[k];
+			}
+			area_sum += area;
+		}
+		if (area_sum > 0) bkm_vec3_scale(center, 1.0f / (3 * area_sum), center);
+		float len = bkm_vec3_len(normal);
+		if (len > 0) bkm_vec3_scale(normal, 1.0f / len, normal);
+
+		vec3 offset;
+		bkm_vec3_sub(center, mesh_center, offset);
+		clusters[i].sort_key = bkm_vec3_dot(offset, normal);
+	}
+	qsort(clusters, n_clusters, sizeof(bkg_cluster), bkg_cluster_cmp);
+
+	size_t o = 0;
+	for (size_t i = 0; i < n_clusters; i++) {
+		size_t bytes = (size_t)clusters[i].count * 3 * sizeof(uint32_t);
+		memcpy(out + o, indices + (size_t)clusters[i].first * 3, bytes);
+		o += (size_t)clusters[i].count * 3;
+	}
+	memcpy(dst, out, n_triangles * 3 * sizeof(uint32_t));
+
+	free(stamp);
+	free(hard);
+	free(clusters);
+	free(out);
+	return 1;
+}
+
+// Builds a remap table that numbers vertices in the order the index
+// buffer first uses them; unused vertices map to BKG_NONE. Returns the
+// number of vertices used.
+size_t bkg_fetch_remap(uint32_t* remap, const uint32_t* indices, size_t n_indices, size_t n_vertices) {
+	memset(remap, 0xFF, n_vertices * sizeof(uint32_t));
+	size_t used = 0;
+	for (size_t i = 0; i < n_indices; i++) {
+		if (remap[indices[i]] == BKG_NONE) remap[indices[i]] = (uint32_t)used++;
+	}
+	return used;
+}
+
+// Reorders vertices in order of first use, rewriting indices in place and
+// dropping unused vertices. dst must not alias vertices. Returns the new
+// vertex count, or 0 on allocation failure.
+size_t bkg_optimize_fetch(void* dst, uint32_t* indices, size_t n_indices, const void* vertices, size_t n_vertices, size_t vertex_size) {
+	uint32_t* remap = malloc((n_vertices ? n_vertices : 1) * sizeof(uint32_t));
+	if (!remap) return 0;
+	size_t used = bkg_fetch_remap(remap, indices, n_indices, n_vertices);
+	bkg_remap_vertices(dst, vertices, n_vertices, vertex_size, remap);
+	bkg_remap_indices(indices, indices, n_indices, remap);
+	free(remap);
+	return used;
+}
+
+typedef struct {
+	float a2, b2, c2, ab, ac, bc, ad, bd, cd, d2;
+	float w;
+} bkg_quadric;
+
+typedef struct {
+	float cost;
+	uint32_t from, to;      // vertices; 'from' moves onto 'to'
+	uint32_t from_version, to_version;
+} bkg_collapse;
+
+void bkg_quadric_add_plane(bkg_quadric* q, const float n[3], float d, float w) {
+	q->a2 += w * n[0] * n[0]; q->b2 += w * n[1] * n[1]; q->c2 += w * n[2] * n[2];
+	q->ab += w * n[0] * n[1]; q->ac += w * n[0] * n[2]; q->bc += w * n[1] * n[2];
+	q->ad += w * n[0] * d; q->bd += w * n[1] * d; q->cd += w * n[2] * d;
+	q->d2 += w * d * d;
+	q->w += w;
+}
+
+void bkg_quadric_add(bkg_quadric* q, const bkg_quadric* r) {
+	float* a = &q->a2;
+	const float* b = &r->a2;
+	for (int i = 0; i < 11; i++) a[i] += b[i];
+}
+
+// Weighted mean squared distance from p to the planes in q
+float bkg_quadric_error(const bkg_quadric* q, const float p[3]) {
+	float x = p[0], y = p[1], z = p[2];
+	float e = q->a2 * x * x + q->b2 * y * y + q->c2 * z * z
+		+ 2 * (q->ab * x * y + q->ac * x * z + q->bc * y * z)
+		+ 2 * (q->ad * x + q->bd * y + q->cd * z) + q->d2;
+	return e > 0 && q->w > 0 ? e / q->w : 0;
+}
+
+void bkg_heap_push(bkg_collapse* heap, size_t* n, bkg_collapse c) {
+	size_t i = (*n)++;
+	while (i && heap[(i - 1) / 2].cost > c.cost) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = c;
+}
+
+bkg_collapse bkg_heap_pop(bkg_collapse* heap, size_t* n) {
+	bkg_collapse top = heap[0], last = heap[--*n];
+	size_t i = 0;
+	for (;;) {
+		size_t c = i * 2 + 1;
+		if (c >= *n) break;
+		if (c + 1 < *n && heap[c + 1].cost < heap[c].cost) c++;
+		if (heap[c].cost >= last.cost) break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	if (*n) heap[i] = last;
+	return top;
+}
+
+// Set of directed edges, keyed by their two endpoints
+typedef struct {
+	uint64_t* keys;
+	size_t mask;
+} bkg_edge_set;
+
+int bkg_edge_set_init(bkg_edge_set* s, size_t n_edges) {
+	size_t size = bkg_table_size(n_edges);
+	s->keys = malloc(size * sizeof(uint64_t));
+	s->mask = size - 1;
+	if (s->keys) memset(s->keys, 0xFF, size * sizeof(uint64_t));
+	return s->keys != NULL;
+}
+
+int bkg_edge_set_has(const bkg_edge_set* s, uint32_t a, uint32_t b) {
+	uint64_t key = (uint64_t)a << 32 | b;
+	for (size_t i = bkg_cell_hash((int32_t)a, (int32_t)b, 0) & s->mask;; i = (i + 1) & s->mask) {
+		if (s->keys[i] == key) return 1;
+		if (s->keys[i] == ~(uint64_t)0) return 0;
+	}
+}
+
+void bkg_edge_set_add(bkg_edge_set* s, uint32_t a, uint32_t b) {
+	uint64_t key = (uint64_t)a << 32 | b;
+	size_t i = bkg_cell_hash((int32_t)a, (int32_t)b, 0) & s->mask;
+	while (s->keys[i] != ~(uint64_t)0 && s->keys[i] != key) i = (i + 1) & s->mask;
+	s->keys[i] = key;
+}
+
+typedef struct {
+	size_t n_vertices;
+	size_t n_triangles;
+	uint32_t* tris;        // current corners, resolved through 'into'
+	unsigned char* dead;   // per triangle
+	uint32_t* arena;       // lists of triangles around each vertex
+	size_t arena_size;
+	size_t arena_capacity;
+	uint32_t* list_start;  // per vertex, into arena
+	uint32_t* list_count;
+	uint32_t* into;        // vertex a vertex was collapsed into, or itself
+	uint32_t* group;       // position of each vertex
+	uint32_t* wedge;       // next vertex at the same position, circular
+	unsigned char* kind;   // per position
+	uint32_t* version;     // per position, bumped when its quadric grows
+	bkg_quadric* quadrics; // per position
+	float* pos;            // normalized positions
+	bkg_collapse* heap;
+	size_t heap_size;
+	size_t heap_capacity;
+} bkg_simplifier;
+
+uint32_t bkg_resolve(bkg_simplifier* s, uint32_t v) {
+	uint32_t r = v;
+	while (s->into[r] != r) r = s->into[r];
+	while (s->into[v] != r) {
+		uint32_t next = s->into[v];
+		s->into[v] = r;
+		v = next;
+	}
+	return r;
+}
+
+// Calls fn for every live triangle around a vertex. Stops early and
+// returns 0 when fn does.
+int bkg_each_triangle(bkg_simplifier* s, uint32_t v, int (*fn)(bkg_simplifier* s, uint32_t t, void* user), void* user) {
+	const uint32_t* list = s->arena + s->list_start[v];
+	for (uint32_t k = 0; k < s->list_count[v]; k++) {
+		uint32_t t = list[k];
+		if (s->dead[t]) continue;
+		for (int c = 0; c < 3; c++) s->tris[t * 3 + c] = bkg_resolve(s, s->tris[t * 3 + c]);
+		if (!fn(s, t, user)) return 0;
+	}
+	return 1;
+}
+
+typedef struct {
+	uint32_t a, b;      // vertices, or positions when by_position is set
+	int by_position;
+	int count;
+} bkg_edge_query;
+
+int bkg_count_edge(bkg_simplifier* s, uint32_t t, void* user) {
+	bkg_edge_query* q = user;
+	int has_a = 0, has_b = 0;
+	for (int k = 0; k < 3; k++) {
+		uint32_t v = s->tris[t * 3 + k], x = q->by_position ? s->group[v] : v;
+		has_a |= x == q->a;
+		has_b |= x == q->b;
+	}
+	q->count += has_a && has_b;
+	return 1;
+}
+
+// Live triangles using the edge a-b, between the two vertices or between
+// any vertices at their positions
+int bkg_edge_count(bkg_simplifier* s, uint32_t a, uint32_t b, int by_position) {
+	bkg_edge_query q = {by_position ? s->group[a] : a, by_position ? s->group[b] : b, by_position, 0};
+	for (uint32_t w = a;;) {
+		bkg_each_triangle(s, w, bkg_count_edge, &q);
+		if (!by_position || (w = s->wedge[w]) == a) break;
+	}
+	return q.count;
+}
+
+typedef struct {
+	uint32_t group;
+	uint32_t skip;
+	uint32_t found;
+} bkg_partner_query;
+
+int bkg_find_partner(bkg_simplifier* s, uint32_t t, void* user) {
+	bkg_partner_query* q = user;
+	for (int k = 0; k < 3; k++) {
+		uint32_t v = s->tris[t * 3 + k];
+		if (s->group[v] == q->group && v != q->skip) q->found = v;
+	}
+	return q->found == BKG_NONE;
+}
+
+// A vertex at b's position, other than b, that shares a live edge with a,
+// or BKG_NONE
+uint32_t bkg_edge_partner(bkg_simplifier* s, uint32_t a, uint32_t b) {
+	bkg_partner_query q = {s->group[b], b, BKG_NONE};
+	bkg_each_triangle(s, a, bkg_find_partner, &q);
+	return q.found;
+}
+
+typedef struct {
+	uint32_t from_group, to_group;
+	const float* to;
+	int ok;
+} bkg_flip_query;
+
+int bkg_check_flip(bkg_simplifier* s, uint32_t t, void* user) {
+	bkg_flip_query* q = user;
+	const float* p[3];
+	const float* moved[3];
+	int touches_to = 0;
+	for (int c = 0; c < 3; c++) {
+		uint32_t v = s->tris[t * 3 + c];
+		p[c] = s->pos + (size_t)v * 3;
+		moved[c] = s->group[v] == q->from_group ? q->to : p[c];
+		touches_to |= s->group[v] == q->to_group;
+	}
+	if (touches_to) return 1; // removed by the collapse
+
+	vec3 e1, e2, n0, n1;
+	bkm_vec3_sub((float*)p[1], (float*)p[0], e1);
+	bkm_vec3_sub((float*)p[2], (float*)p[0], e2);
+	bkm_vec3_cross(e1, e2, n0);
+	bkm_vec3_sub((float*)moved[1], (float*)moved[0], e1);
+	bkm_vec3_sub((float*)moved[2], (float*)moved[0], e2);
+	bkm_vec3_cross(e1, e2, n1);
+	// Reject flipped triangles and ones that turn almost edge-on
+	q->ok = bkm_vec3_dot(n0, n1) > 0.25f * bkm_vec3_len(n0) * bkm_vec3_len(n1);
+	return q->ok;
+}
+
+typedef struct {
+	uint32_t group; // only edges touching this position, or BKG_NONE
+} bkg_push_query;
+
+void bkg_push_collapse(bkg_simplifier* s, uint32_t from, uint32_t to) {
+	if (s->kind[s->group[from]] == BKG_KIND_LOCKED) return;
+	if (s->heap_size == s->heap_capacity) {
+		size_t capacity = s->heap_capacity * 2;
+		bkg_collapse* grown = realloc(s->heap, capacity * sizeof(bkg_collapse));
+		if (!grown) return; // the edge is simply not considered
+		s->heap = grown;
+		s->heap_capacity = capacity;
+	}
+	uint32_t gf = s->group[from], gt = s->group[to];
+	bkg_collapse c = {bkg_quadric_error(&s->quadrics[gf], s->pos + (size_t)to * 3), from, to, s->version[gf], s->version[gt]};
+	bkg_heap_push(s->heap, &s->heap_size, c);
+}
+
+int bkg_push_triangle(bkg_simplifier* s, uint32_t t, void* user) {
+	bkg_push_query* q = user;
+	const uint32_t* c = s->tris + t * 3;
+	// Each triangle offers its edges in winding order only: the neighbor
+	// across an inner edge offers the other direction, and borders are
+	// simplified by collapsing forward along them
+	for (int k = 0; k < 3; k++) {
+		uint32_t a = c[k], b = c[(k + 1) % 3];
+		if (q->group != BKG_NONE && s->group[a] != q->group && s->group[b] != q->group) continue;
+		bkg_push_collapse(s, a, b);
+	}
+	return 1;
+}
+
+void bkg_simplifier_free(bkg_simplifier* s) {
+	free(s->tris);
+	free(s->dead);
+	free(s->arena);
+	free(s->list_start);
+	free(s->list_count);
+	free(s->into);
+	free(s->group);
+	free(s->wedge);
+	free(s->kind);
+	free(s->version);
+	free(s->quadrics);
+	free(s->pos);
+	free(s->heap);
+	memset(s, 0, sizeof(*s));
+}
+
+// Welds positions, drops degenerate triangles, classifies every position
+// and accumulates the quadrics. Returns 0 on allocation failure.
+int bkg_simplifier_init(bkg_simplifier* s, const uint32_t* indices, size_t n_indices, const void* positions, size_t stride, size_t n_vertices) {
+	memset(s, 0, sizeof(*s));
+	size_t nv = n_vertices ? n_vertices : 1, nt = n_indices / 3;
+	s->n_vertices = n_vertices;
+	s->tris = malloc((nt ? nt : 1) * 3 * sizeof(uint32_t));
+	s->dead = calloc(nt ? nt : 1, 1);
+	s->into = malloc(nv * sizeof(uint32_t));
+	s->group = malloc(nv * sizeof(uint32_t));
+	s->wedge = malloc(nv * sizeof(uint32_t));
+	s->kind = calloc(nv, 1);
+	s->version = calloc(nv, sizeof(uint32_t));
+	s->quadrics = calloc(nv, sizeof(bkg_quadric));
+	s->pos = malloc(nv * 3 * sizeof(float));
+	s->heap_capacity = nt * 3 + 16;
+	s->heap = malloc(s->heap_capacity * sizeof(bkg_collapse));
+
+	uint32_t* first = malloc(nv * sizeof(uint32_t));
+	int* open_out = calloc(nv, sizeof(int));
+	int* open_in = calloc(nv, sizeof(int));
+	int* open_pos = calloc(nv, sizeof(int));
+	int* n_wedges = calloc(nv, sizeof(int));
+	unsigned char* used = calloc(nv, 1);
+	bkg_edge_set edges = {0}, pos_edges = {0};
+	int ok = s->tris && s->dead && s->into && s->group && s->wedge && s->kind
+		&& s->version && s->quadrics && s->pos && s->heap && first && used && open_out && open_in && open_pos && n_wedges
+		&& bkg_edge_set_init(&edges, nt * 3) && bkg_edge_set_init(&pos_edges, nt * 3)
+		&& bkg_weld(s->group, positions, stride, n_vertices, 0);
+
+	if (ok) {
+		// Positions normalized to the largest extent, so errors are relative
+		float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+		for (size_t v = 0; v < n_vertices; v++) {
+			const float* p = bkg_position(positions, stride, (uint32_t)v);
+			for (int k = 0; k < 3; k++) {
+				lo[k] = fminf(lo[k], p[k]);
+				hi[k] = fmaxf(hi[k], p[k]);
+			}
+		}
+		float extent = fmaxf(hi[0] - lo[0], fmaxf(hi[1] - lo[1], hi[2] - lo[2]));
+		float scale = extent > 0 ? 1.0f / extent : 1.0f;
+		for (size_t v = 0; v < n_vertices; v++) {
+			const float* p = bkg_position(positions, stride, (uint32_t)v);
+			for (int k = 0; k < 3; k++) s->pos[v * 3 + k] = (p[k] - lo[k]) * scale;
+		}
+
+		for (size_t t = 0; t < nt; t++) {
+			const uint32_t* c = indices + t * 3;
+			uint32_t g0 = s->group[c[0]], g1 = s->group[c[1]], g2 = s->group[c[2]];
+			memcpy(s->tris + t * 3, c, 3 * sizeof(uint32_t));
+			if (g0 == g1 || g1 == g2 || g0 == g2) {
+				s->dead[t] = 1;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) used[c[k]] = 1;
+			for (int k = 0; k < 3; k++) {
+				bkg_edge_set_add(&edges, c[k], c[(k + 1) % 3]);
+				bkg_edge_set_add(&pos_edges, s->group[c[k]], s->group[c[(k + 1) % 3]]);
+			}
+		}
+		bkg_adjacency adj = {0};
+		ok = bkg_adjacency_build(&adj, s->tris, nt * 3, n_vertices);
+		s->arena = adj.triangles;
+		s->arena_size = s->arena_capacity = nt * 3;
+		s->list_start = adj.offsets;
+		s->list_count = adj.live;
+	}
+
+	if (ok) {
+		// Wedge rings of the referenced vertices at each position
+		memset(first, 0xFF, nv * sizeof(uint32_t));
+		for (size_t v = 0; v < n_vertices; v++) {
+			s->into[v] = (uint32_t)v;
+			s->wedge[v] = (uint32_t)v;
+			if (!used[v]) continue;
+			uint32_t g = s->group[v];
+			if (first[g] != BKG_NONE) {
+				s->wedge[v] = s->wedge[first[g]];
+				s->wedge[first[g]] = (uint32_t)v;
+			} else {
+				first[g] = (uint32_t)v;
+			}
+			n_wedges[g]++;
+		}
+
+		// Open edges at vertex and position level, and the quadrics
+		for (size_t t = 0; t < nt; t++) {
+			if (s->dead[t]) continue;
+			const uint32_t* c = s->tris + t * 3;
+			const float* p0 = s->pos + (size_t)c[0] * 3;
+			vec3 e1, e2, n;
+			bkm_vec3_sub(s->pos + (size_t)c[1] * 3, (float*)p0, e1);
+			bkm_vec3_sub(s->pos + (size_t)c[2] * 3, (float*)p0, e2);
+			bkm_vec3_cross(e1, e2, n);
+			float area = bkm_vec3_len(n);
+			if (area > 0) bkm_vec3_scale(n, 1.0f / area, n);
+			for (int k = 0; k < 3; k++) {
+				bkg_quadric_add_plane(&s->quadrics[s->group[c[k]]], n, -bkm_vec3_dot(n, (float*)p0), area * 0.5f);
+			}
+
+			for (int k = 0; k < 3; k++) {
+				uint32_t a = c[k], b = c[(k + 1) % 3];
+				int open = !bkg_edge_set_has(&edges, b, a);
+				int border = !bkg_edge_set_has(&pos_edges, s->group[b], s->group[a]);
+				open_out[a] += open;
+				open_in[b] += open;
+				open_pos[s->group[a]] += border;
+				open_pos[s->group[b]] += border;
+				if (!open) continue;
+
+				// Keep open edges in place with a plane through the edge,
+				// perpendicular to the triangle
+				vec3 edge, side;
+				bkm_vec3_sub(s->pos + (size_t)b * 3, s->pos + (size_t)a * 3, edge);
+				bkm_vec3_cross(edge, n, side);
+				float len = bkm_vec3_len(side);
+				if (len <= 0) continue;
+				bkm_vec3_scale(side, 1.0f / len, side);
+				float d = -bkm_vec3_dot(side, s->pos + (size_t)a * 3), w = bkm_vec3_dot(edge, edge) * BKG_EDGE_WEIGHT;
+				bkg_quadric_add_plane(&s->quadrics[s->group[a]], side, d, w);
+				bkg_quadric_add_plane(&s->quadrics[s->group[b]], side, d, w);
+			}
+		}
+
+		for (size_t g = 0; g < n_vertices; g++) {
+			if (first[g] == BKG_NONE) continue;
+			uint32_t v = first[g], w = s->wedge[v];
+			int kind = BKG_KIND_LOCKED;
+			if (n_wedges[g] == 1 && open_pos[g] == 0) kind = BKG_KIND_MANIFOLD;
+			else if (n_wedges[g] == 1 && open_pos[g] == 2 && open_out[v] == 1 && open_in[v] == 1) kind = BKG_KIND_BORDER;
+			else if (n_wedges[g] == 2 && open_pos[g] == 0 && open_out[v] == 1 && open_in[v] == 1
+				&& open_out[w] == 1 && open_in[w] == 1) kind = BKG_KIND_SEAM;
+			s->kind[g] = (unsigned char)kind;
+		}
+	}
+
+	free(first);
+	free(open_out);
+	free(open_in);
+	free(open_pos);
+	free(n_wedges);
+	free(used);
+	free(edges.keys);
+	free(pos_edges.keys);
+	if (!ok) bkg_simplifier_free(s);
+	s->n_triangles = nt;
+	return ok;
+}
+
+// Whether from may move onto to, and for seams the second pair of
+// vertices that moves with it
+int bkg_can_collapse(bkg_simplifier* s, uint32_t from, uint32_t to, uint32_t* from2, uint32_t* to2) {
+	uint32_t gf = s->group[from], gt = s->group[to];
+	*from2 = *to2 = BKG_NONE;
+	switch (s->kind[gf]) {
+		case BKG_KIND_MANIFOLD:
+			break;
+		case BKG_KIND_BORDER:
+			if (s->kind[gt] != BKG_KIND_BORDER || bkg_edge_count(s, from, to, 1) != 1) return 0;
+			break;
+		case BKG_KIND_SEAM:
+			if (s->kind[gt] != BKG_KIND_SEAM || bkg_edge_count(s, from, to, 0) != 1 || bkg_edge_count(s, from, to, 1) != 2) return 0;
+			*from2 = s->wedge[from];
+			*to2 = bkg_edge_partner(s, *from2, to);
+			if (*to2 == BKG_NONE) return 0;
+			break;
+		default:
+			return 0;
+	}
+
+	bkg_flip_query q = {gf, gt, s->pos + (size_t)to * 3, 1};
+	if (!bkg_each_triangle(s, from, bkg_check_flip, &q)) return 0;
+	return *from2 == BKG_NONE || bkg_each_triangle(s, *from2, bkg_check_flip, &q);
+}
+
+// Rebuilds the triangle list of 'to' from its own and that of a vertex
+// just collapsed into it, dropping triangles that became degenerate.
+// Returns 0 on allocation failure.
+int bkg_merge_lists(bkg_simplifier* s, uint32_t from, uint32_t to, size_t* n_live) {
+	size_t needed = s->arena_size + s->list_count[from] + s->list_count[to];
+	if (needed > s->arena_capacity) {
+		size_t capacity = s->arena_capacity * 2 > needed ? s->arena_capacity * 2 : needed;
+		uint32_t* grown = realloc(s->arena, capacity * sizeof(uint32_t));
+		if (!grown) return 0;
+		s->arena = grown;
+		s->arena_capacity = capacity;
+	}
+
+	uint32_t start = (uint32_t)s->arena_size;
+	uint32_t lists[2] = {to, from};
+	for (int l = 0; l < 2; l++) {
+		for (uint32_t k = 0; k < s->list_count[lists[l]]; k++) {
+			uint32_t t = s->arena[s->list_start[lists[l]] + k];
+			if (s->dead[t]) continue;
+			uint32_t g[3];
+			for (int c = 0; c < 3; c++) {
+				s->tris[t * 3 + c] = bkg_resolve(s, s->tris[t * 3 + c]);
+				g[c] = s->group[s->tris[t * 3 + c]];
+			}
+			if (g[0] == g[1] || g[1] == g[2] || g[0] == g[2]) {
+				s->dead[t] = 1;
+				(*n_live)--;
+				continue;
+			}
+			s->arena[s->arena_size++] = t;
+		}
+	}
+	s->list_start[to] = start;
+	s->list_count[to] = (uint32_t)(s->arena_size - start);
+	s->list_count[from] = 0;
+	return 1;
+}
+
+// Simplifies a mesh by collapsing edges in order of quadric error until
+// at most target_indices / 3 triangles remain, or the next collapse would
+// move the surface by more than target_error, relative to the mesh's
+// largest extent (e.g. 0.01 for 1%). Vertices only ever move onto other
+// vertices, so the vertex buffer is reused as is. Positions on open
+// borders and on attribute seams (vertices split at one position) only
+// collapse along the border or seam. Writes the indices to dst, which
+// needs room for n_indices, and the error reached to *out_error if not
+// NULL. Returns the number of indices written, or 0 on allocation failure.
+size_t bkg_simplify(uint32_t* dst, const uint32_t* indices, size_t n_indices, const void* positions, size_t stride, size_t n_vertices,
+	size_t target_indices, float target_error, float* out_error) {
+	bkg_simplifier s;
+	if (!bkg_simplifier_init(&s, indices, n_indices, positions, stride, n_vertices)) return 0;
+
+	size_t n_live = 0;
+	for (size_t t = 0; t < s.n_triangles; t++) n_live += !s.dead[t];
+	bkg_push_query all = {BKG_NONE};
+	for (size_t t = 0; t < s.n_triangles; t++) {
+		if (!s.dead[t]) bkg_push_triangle(&s, (uint32_t)t, &all);
+	}
+
+	float limit = target_error * target_error, reached = 0;
+	while (n_live * 3 > target_indices && s.heap_size) {
+		bkg_collapse c = bkg_heap_pop(s.heap, &s.heap_size);
+		uint32_t from = c.from, to = c.to;
+		if (s.into[from] != from || s.into[to] != to) continue;
+		uint32_t gf = s.group[from], gt = s.group[to];
+
+		// Entries are never updated in place: a collapse bumps the version
+		// of the position it merges into and pushes fresh entries for all
+		// edges around it, so stale ones are just dropped here
+		if (c.from_version != s.version[gf] || c.to_version != s.version[gt]) continue;
+		if (c.cost > limit) break;
+
+		uint32_t from2, to2;
+		if (!bkg_can_collapse(&s, from, to, &from2, &to2)) continue;
+
+		s.into[from] = to;
+		if (from2 != BKG_NONE) s.into[from2] = to2;
+		if (!bkg_merge_lists(&s, from, to, &n_live) || (from2 != BKG_NONE && !bkg_merge_lists(&s, from2, to2, &n_live))) break;
+		bkg_quadric_add(&s.quadrics[gt], &s.quadrics[gf]);
+		s.version[gt]++;
+		if (c.cost > reached) reached = c.cost;
+
+		// New candidate collapses for the edges around the merged position
+		bkg_push_query around = {gt};
+		for (uint32_t w = to;;) {
+			bkg_each_triangle(&s, w, bkg_push_triangle, &around);
+			if ((w = s.wedge[w]) == to) break;
+		}
+	}
+
+	size_t n = 0;
+	for (size_t t = 0; t < s.n_triangles; t++) {
+		if (s.dead[t]) continue;
+		for (int k = 0; k < 3; k++) dst[n++] = bkg_resolve(&s, s.tris[t * 3 + k]);
+	}
+	if (out_error) *out_error = sqrtf(reached);
+	bkg_simplifier_free(&s);
+	return n;
+}
+
+typedef struct {
+	// Input, which tasks may share
+	const uint32_t* indices;
+	size_t n_indices;
+	const void* positions;
+	size_t stride;
+	size_t n_vertices;
+	size_t target_indices;
+	float target_error;
+
+	// Output; indices is allocated with malloc
+	uint32_t* out_indices;
+	size_t out_n_indices;
+	float out_error;
+	int ok;
+} bkg_simplify_task;
+
+void bkg_simplify_run(void* ctx, int i, int worker) {
+	(void)worker;
+	bkg_simplify_task* t = (bkg_simplify_task*)ctx + i;
+	t->out_indices = malloc((t->n_indices ? t->n_indices : 1) * sizeof(uint32_t));
+	t->out_n_indices = 0;
+	t->ok = t->out_indices != NULL;
+	if (t->ok && t->n_indices >= 3) {
+		t->out_n_indices = bkg_simplify(t->out_indices, t->indices, t->n_indices, t->positions, t->stride, t->n_vertices,
+			t->target_indices, t->target_error, &t->out_error);
+		t->ok = t->out_n_indices > 0;
+	}
+}
+
+// Runs independent simplifications, e.g. the levels of a LOD chain or
+// different meshes, in parallel on a pool (NULL runs them in order).
+// Returns 1 if all of them succeeded.
+int bkg_simplify_all(bkj_pool* pool, bkg_simplify_task* tasks, int n_tasks) {
+	bkj_parallel_for(pool, n_tasks, bkg_simplify_run, tasks);
+	int ok = 1;
+	for (int i = 0; i < n_tasks; i++) ok &= tasks[i].ok;
+	return ok;
+}
+
+// Builds n_levels LODs of a mesh, level i keeping about ratios[i] of the
+// triangles with at most max_error relative error (see bkg_simplify).
+// Every level is simplified from the full mesh, all in parallel. Free
+// each lods[i].out_indices. Returns 1 on success.
+int bkg_build_lods(bkj_pool* pool, const uint32_t* indices, size_t n_indices, const void* positions, size_t stride,
+	size_t n_vertices, const float* ratios, int n_levels, float max_error, bkg_simplify_task* lods) {
+	for (int i = 0; i < n_levels; i++) {
+		size_t target = (size_t)(n_indices / 3 * ratios[i]) * 3;
+		lods[i] = (bkg_simplify_task){indices, n_indices, positions, stride, n_vertices, target, max_error, NULL, 0, 0, 0};
+	}
+	return bkg_simplify_all(pool, lods, n_levels);
+}
+
+#endif
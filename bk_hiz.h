@@ -0,0 +1,326 @@
+/*
+bk_hiz.h - CPU hierarchical-Z occlusion culling for the Brickate project
+
+This header rasterizes a handful of occluder meshes (walls, terrain,
+large bricks) into a small depth buffer, reduces it into min/max depth
+pyramids, and then tests batches of world-space AABBs against it so that
+objects hidden behind the occluders are never submitted for drawing.
+
+Includes functions for:
+  - Creating a depth buffer of any (low) resolution, e.g. 256x128
+  - Rasterizing indexed occluder triangles 8 pixels at a time (bk_simd)
+  - Building the min and max depth pyramids
+  - Testing AABBs: all 8 corners of a box are transformed at once by the
+    view-projection (bk_math) and compared against the pyramid level
+    where the box covers at most 4x4 texels
+
+Depth is NDC z mapped to [0, 1], with 1 the far plane. Boxes crossing
+the near plane or touching any texel that has no occluder are reported
+visible. Occluders, however, are rasterized like ordinary triangles:
+coverage and depth are sampled at texel centers, so an occluder can
+claim up to half a texel more than it covers, and one thinner than a
+texel can hide a box that is actually visible through its gaps. Occluder
+meshes should be kept a little inside the geometry they stand for, and
+thin parts (railings, bars) left out.
+*/
+
+#ifndef BK_HIZ_H
+#define BK_HIZ_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bk_math.h"
+#include "bk_simd.h"
+#include "bk_job.h"
+
+BK_SIMD_BEGIN
+
+#define BKH_MAX_LEVELS 16
+
+// Results of bkh_test_aabbs
+#define BKH_OCCLUDED 0
+#define BKH_VISIBLE 1    // possibly visible
+#define BKH_UNOCCLUDED 2 // entirely in front of every occluder it overlaps
+
+typedef struct {
+	int width;
+	int height;
+	int stride; // level 0 row pitch, a multiple of 8
+	int n_levels;
+	int level_w[BKH_MAX_LEVELS];
+	int level_h[BKH_MAX_LEVELS];
+	float* min_z[BKH_MAX_LEVELS]; // level 0 of min_z and max_z is the same buffer
+	float* max_z[BKH_MAX_LEVELS];
+	mat4 viewproj;
+} bkh_buffer;
+
+void bkh_destroy(bkh_buffer* hz) {
+	if (!hz) return;
+	free(hz->max_z[0]);
+	for (int i = 1; i < hz->n_levels; i++) {
+		free(hz->min_z[i]);
+		free(hz->max_z[i]);
+	}
+	free(hz);
+}
+
+bkh_buffer* bkh_create(int width, int height) {
+	if (width <= 0 || height <= 0) return NULL;
+
+	bkh_buffer* hz = calloc(1, sizeof(bkh_buffer));
+	if (!hz) return NULL;
+
+	hz->width = width;
+	hz->height = height;
+	hz->stride = (width + 7) & ~7;
+
+	int w = width, h = height;
+	for (int i = 0; i < BKH_MAX_LEVELS; i++) {
+		hz->level_w[i] = w;
+		hz->level_h[i] = h;
+		hz->n_levels++;
+
+		size_t n = i == 0 ? (size_t)hz->stride * h : (size_t)w * h;
+		hz->max_z[i] = malloc(n * sizeof(float));
+		hz->min_z[i] = i == 0 ? hz->max_z[0] : malloc(n * sizeof(float));
+		if (!hz->max_z[i] || !hz->min_z[i]) {
+			bkh_destroy(hz);
+			return NULL;
+		}
+
+		if (w == 1 && h == 1) break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+
+	bkm_mat4_identity(hz->viewproj);
+	return hz;
+}
+
+// Starts a new frame: clears depth to the far plane
+void bkh_begin(bkh_buffer* hz, mat4 viewproj) {
+	memcpy(hz->viewproj, viewproj, sizeof(mat4));
+	size_t n = (size_t)hz->stride * hz->height;
+	for (size_t i = 0; i < n; i++) hz->max_z[0][i] = 1.0f;
+}
+
+// v[i] = clip x, y, z, w; both windings are drawn
+void bkh_raster_triangle(bkh_buffer* hz, const float v[3][4]) {
+	float sx[3], sy[3], sz[3];
+	for (int i = 0; i < 3; i++) {
+		float iw = 1.0f / v[i][3];
+		sx[i] = (v[i][0] * iw * 0.5f + 0.5f) * hz->width;
+		sy[i] = (0.5f - v[i][1] * iw * 0.5f) * hz->height;
+		sz[i] = v[i][2] * iw * 0.5f + 0.5f;
+	}
+
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+	if (area == 0.0f) return;
+	float sign = area < 0.0f ? 1.0f : -1.0f;
+
+	// Edge k is opposite vertex k and is positive inside the triangle
+	float e[3][3];
+	for (int k = 0; k < 3; k++) {
+		int a = (k + 1) % 3, b = (k + 2) % 3;
+		e[k][0] = (sy[b] - sy[a]) * sign;
+		e[k][1] = (sx[a] - sx[b]) * sign;
+		e[k][2] = -(e[k][0] * sx[a] + e[k][1] * sy[a]);
+	}
+	float inv_area = 1.0f / fabsf(area);
+	float zp[3];
+	for (int k = 0; k < 3; k++) zp[k] = (sz[0] * e[0][k] + sz[1] * e[1][k] + sz[2] * e[2][k]) * inv_area;
+
+	float fx0 = fminf(sx[0], fminf(sx[1], sx[2]));
+	float fx1 = fmaxf(sx[0], fmaxf(sx[1], sx[2]));
+	float fy0 = fminf(sy[0], fminf(sy[1], sy[2]));
+	float fy1 = fmaxf(sy[0], fmaxf(sy[1], sy[2]));
+	if (fx1 < 0.0f || fy1 < 0.0f || fx0 > hz->width || fy0 > hz->height) return;
+
+	int x0 = fx0 < 0.0f ? 0 : (int)fx0;
+	int y0 = fy0 < 0.0f ? 0 : (int)fy0;
+	int x1 = fx1 >= hz->width ? hz->width - 1 : (int)fx1;
+	int y1 = fy1 >= hz->height ? hz->height - 1 : (int)fy1;
+	x0 &= ~7;
+
+	const bk_f32x8 lane = bk_f32x8_iota();
+	const bk_f32x8 zero = bk_f32x8_splat(0.0f);
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		float* row = hz->max_z[0] + (size_t)y * hz->stride;
+		for (int x = x0; x <= x1; x += 8) {
+			bk_f32x8 px = bk_f32x8_splat(x + 0.5f) + lane;
+			bk_f32x8 w0 = px * e[0][0] + (e[0][1] * py + e[0][2]);
+			bk_f32x8 w1 = px * e[1][0] + (e[1][1] * py + e[1][2]);
+			bk_f32x8 w2 = px * e[2][0] + (e[2][1] * py + e[2][2]);
+			bk_i32x8 inside = (w0 >= zero) & (w1 >= zero) & (w2 >= zero) & ((bk_i32x8_iota() + x) <= x1);
+			if (!bk_i32x8_any(inside)) continue;
+
+			bk_f32x8 z = px * zp[0] + (zp[1] * py + zp[2]);
+			bk_f32x8 d = bk_f32x8_load(row + x);
+			bk_f32x8_store(row + x, bk_f32x8_select(inside, bk_f32x8_min(z, d), d));
+		}
+	}
+}
+
+// Clips against the near plane (z >= -w) before rasterizing
+void bkh_clip_triangle(bkh_buffer* hz, const float v[3][4]) {
+	float d[3];
+	int inside = 0;
+	for (int i = 0; i < 3; i++) {
+		d[i] = v[i][2] + v[i][3];
+		inside += d[i] >= 0.0f;
+	}
+	if (inside == 0) return;
+	if (inside == 3) {
+		bkh_raster_triangle(hz, v);
+		return;
+	}
+
+	float poly[4][4];
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		int j = (i + 1) % 3;
+		if (d[i] >= 0.0f) memcpy(poly[n++], v[i], sizeof(poly[0]));
+		if ((d[i] >= 0.0f) != (d[j] >= 0.0f)) {
+			float t = d[i] / (d[i] - d[j]);
+			for (int k = 0; k < 4; k++) poly[n][k] = v[i][k] + (v[j][k] - v[i][k]) * t;
+			n++;
+		}
+	}
+	for (int i = 1; i + 1 < n; i++) {
+		float tri[3][4];
+		memcpy(tri[0], poly[0], sizeof(tri[0]));
+		memcpy(tri[1], poly[i], sizeof(tri[0]));
+		memcpy(tri[2], poly[i + 1], sizeof(tri[0]));
+		bkh_raster_triangle(hz, tri);
+	}
+}
+
+// Draws an indexed occluder mesh. 'positions' holds xyz triples; 'model'
+// may be NULL for identity.
+void bkh_draw_occluder(bkh_buffer* hz, const float* positions, const uint32_t* indices, size_t n_indices, mat4 model) {
+	mat4 m;
+	if (model) bkm_mat4_mul(hz->viewproj, model, m);
+	else memcpy(m, hz->viewproj, sizeof(mat4));
+
+	for (size_t i = 0; i + 2 < n_indices; i += 3) {
+		float v[3][4];
+		for (int k = 0; k < 3; k++) {
+			const float* p = positions + (size_t)indices[i + k] * 3;
+			for (int r = 0; r < 4; r++) v[k][r] = m[r] * p[0] + m[r + 4] * p[1] + m[r + 8] * p[2] + m[r + 12];
+		}
+		bkh_clip_triangle(hz, v);
+	}
+}
+
+// Reduces level 0 into the min and max pyramids. Call after the last
+// occluder of the frame.
+void bkh_build(bkh_buffer* hz) {
+	for (int i = 1; i < hz->n_levels; i++) {
+		int sw = hz->level_w[i - 1], sh = hz->level_h[i - 1];
+		int spitch = i == 1 ? hz->stride : sw;
+		int w = hz->level_w[i], h = hz->level_h[i];
+		const float* smin = hz->min_z[i - 1];
+		const float* smax = hz->max_z[i - 1];
+
+		for (int y = 0; y < h; y++) {
+			const float* r0min = smin + (size_t)(y * 2) * spitch;
+			const float* r0max = smax + (size_t)(y * 2) * spitch;
+			int dy = y * 2 + 1 < sh ? spitch : 0;
+			float* dmin = hz->min_z[i] + (size_t)y * w;
+			float* dmax = hz->max_z[i] + (size_t)y * w;
+			for (int x = 0; x < w; x++) {
+				int x0 = x * 2;
+				int x1 = x0 + 1 < sw ? x0 + 1 : x0;
+				dmin[x] = fminf(fminf(r0min[x0], r0min[x1]), fminf(r0min[x0 + dy], r0min[x1 + dy]));
+				dmax[x] = fmaxf(fmaxf(r0max[x0], r0max[x1]), fmaxf(r0max[x0 + dy], r0max[x1 + dy]));
+			}
+		}
+	}
+}
+
+int bkh_test_aabb(const bkh_buffer* hz, const float box[6]) {
+	const float* vp = hz->viewproj;
+
+	// Corner k takes min or max on each axis from bits 0, 1, 2 of k
+	bk_i32x8 k = bk_i32x8_iota();
+	bk_f32x8 x = bk_f32x8_select((k & 1) != 0, bk_f32x8_splat(box[3]), bk_f32x8_splat(box[0]));
+	bk_f32x8 y = bk_f32x8_select((k & 2) != 0, bk_f32x8_splat(box[4]), bk_f32x8_splat(box[1]));
+	bk_f32x8 z = bk_f32x8_select((k & 4) != 0, bk_f32x8_splat(box[5]), bk_f32x8_splat(box[2]));
+
+	bk_f32x8 cx = x * vp[0] + y * vp[4] + z * vp[8] + vp[12];
+	bk_f32x8 cy = x * vp[1] + y * vp[5] + z * vp[9] + vp[13];
+	bk_f32x8 cz = x * vp[2] + y * vp[6] + z * vp[10] + vp[14];
+	bk_f32x8 cw = x * vp[3] + y * vp[7] + z * vp[11] + vp[15];
+
+	// Any corner in front of the near plane: cannot bound on screen
+	if (bk_i32x8_any(cz < -cw)) return BKH_VISIBLE;
+
+	bk_f32x8 iw = 1.0f / cw;
+	bk_f32x8 sx = (cx * iw * 0.5f + 0.5f) * (float)hz->width;
+	bk_f32x8 sy = (0.5f - cy * iw * 0.5f) * (float)hz->height;
+	bk_f32x8 sz = cz * iw * 0.5f + 0.5f;
+
+	float fx0 = bk_f32x8_hmin(sx), fx1 = bk_f32x8_hmax(sx);
+	float fy0 = bk_f32x8_hmin(sy), fy1 = bk_f32x8_hmax(sy);
+	float z_near = bk_f32x8_hmin(sz), z_far = bk_f32x8_hmax(sz);
+
+	// Outside the view frustum
+	if (fx1 < 0.0f || fy1 < 0.0f || fx0 >= hz->width || fy0 >= hz->height || z_near > 1.0f) return BKH_OCCLUDED;
+
+	int x0 = fx0 < 0.0f ? 0 : (int)fx0;
+	int y0 = fy0 < 0.0f ? 0 : (int)fy0;
+	int x1 = fx1 >= hz->width ? hz->width - 1 : (int)fx1;
+	int y1 = fy1 >= hz->height ? hz->height - 1 : (int)fy1;
+
+	int level = 0;
+	while (level + 1 < hz->n_levels && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4)) level++;
+
+	int lw = hz->level_w[level];
+	int pitch = level == 0 ? hz->stride : lw;
+	float occ_far = 0.0f, occ_near = 1.0f;
+	for (int ty = y0 >> level; ty <= y1 >> level; ty++) {
+		const float* rmax = hz->max_z[level] + (size_t)ty * pitch;
+		const float* rmin = hz->min_z[level] + (size_t)ty * pitch;
+		for (int tx = x0 >> level; tx <= x1 >> level; tx++) {
+			occ_far = fmaxf(occ_far, rmax[tx]);
+			occ_near = fminf(occ_near, rmin[tx]);
+		}
+	}
+
+	if (z_near > occ_far) return BKH_OCCLUDED;
+	if (z_far < occ_near) return BKH_UNOCCLUDED;
+	return BKH_VISIBLE;
+}
+
+typedef struct {
+	const bkh_buffer* hz;
+	const float* boxes;
+	size_t n;
+	unsigned char* result;
+} bkh_batch;
+
+#define BKH_BATCH 256
+
+void bkh_test_chunk(void* arg, int chunk, int worker) {
+	bkh_batch* b = arg;
+	size_t end = (size_t)(chunk + 1) * BKH_BATCH;
+	if (end > b->n) end = b->n;
+	(void)worker;
+	for (size_t i = (size_t)chunk * BKH_BATCH; i < end; i++) b->result[i] = bkh_test_aabb(b->hz, b->boxes + i * 6);
+}
+
+// Tests n world-space boxes (min xyz, max xyz) and writes one BKH_* code
+// per box. 'pool' may be NULL.
+void bkh_test_aabbs(const bkh_buffer* hz, const float* boxes, size_t n, unsigned char* result, bkj_pool* pool) {
+	bkh_batch b = { hz, boxes, n, result };
+	bkj_parallel_for(pool, (int)((n + BKH_BATCH - 1) / BKH_BATCH), bkh_test_chunk, &b);
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,282 @@
+/*
+bk_image.h - Operations on decoded RGBA8 images for the Brickate project
+
+This header works on views of RGBA8 pixels (as returned by bkp_load_png)
+described by a pointer, a size and a row stride in bytes, so sub-images
+are handled without copying.
+
+Includes functions for:
+  - Cropping to a view (no copy) and cloning a view into tight rows
+  - Flipping vertically or horizontally in place
+  - Transposing and rotating by quarter turns into another buffer,
+    through 8x8 tiles transposed in registers (bk_simd) inside 64x64
+    blocks, so reads and writes both stay within cache
+  - Extracting one channel to 8-bit, swizzling channels (with constant
+    0 or 255), and merging 8-bit planes back into RGBA
+*/
+
+#ifndef BK_IMAGE_H
+#define BK_IMAGE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_simd.h"
+
+BK_SIMD_BEGIN
+
+#define BKI_BLOCK 64 // pixels per side of a cache block, a multiple of 8
+
+// Swizzle sources besides channels 0..3
+#define BKI_ZERO 4
+#define BKI_ONE 5
+
+typedef uint8_t bki_u8x8 __attribute__((vector_size(8)));
+
+typedef struct {
+	unsigned char* pixels;
+	uint32_t width;
+	uint32_t height;
+	size_t stride; // bytes
+} bki_view;
+
+bki_view bki_view_of(unsigned char* pixels, uint32_t width, uint32_t height, size_t stride) {
+	bki_view v = {pixels, width, height, stride};
+	return v;
+}
+
+unsigned char* bki_pixel(bki_view v, uint32_t x, uint32_t y) {
+	return v.pixels + (size_t)y * v.stride + (size_t)x * 4;
+}
+
+// The part of v inside the rectangle, sharing its pixels. The rectangle
+// is clipped to v, so the result may be smaller or empty.
+bki_view bki_crop(bki_view v, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+	if (x > v.width) x = v.width;
+	if (y > v.height) y = v.height;
+	if (width > v.width - x) width = v.width - x;
+	if (height > v.height - y) height = v.height - y;
+	return bki_view_of(bki_pixel(v, x, y), width, height, v.stride);
+}
+
+// Copies a view into a new buffer with width * 4 bytes per row; the
+// caller frees it. Returns NULL on failure.
+unsigned char* bki_clone(bki_view v) {
+	size_t row = (size_t)v.width * 4;
+	size_t size = row * v.height;
+	unsigned char* out = malloc(size ? size : 1);
+	if (!out) return NULL;
+	for (uint32_t y = 0; y < v.height; y++) memcpy(out + y * row, v.pixels + y * v.stride, row);
+	return out;
+}
+
+void bki_flip_vertical(bki_view v) {
+	unsigned char tmp[256];
+	size_t row = (size_t)v.width * 4;
+	for (uint32_t y = 0; y < v.height / 2; y++) {
+		unsigned char* a = v.pixels + (size_t)y * v.stride;
+		unsigned char* b = v.pixels + (size_t)(v.height - 1 - y) * v.stride;
+		for (size_t i = 0; i < row; i += sizeof(tmp)) {
+			size_t n = row - i < sizeof(tmp) ? row - i : sizeof(tmp);
+			memcpy(tmp, a + i, n);
+			memcpy(a + i, b + i, n);
+			memcpy(b + i, tmp, n);
+		}
+	}
+}
+
+BK_SIMD_INLINE bk_u32x8 bki_reverse(bk_u32x8 v) {
+	return __builtin_shuffle(v, (bk_u32x8){7, 6, 5, 4, 3, 2, 1, 0});
+}
+
+void bki_flip_horizontal(bki_view v) {
+	for (uint32_t y = 0; y < v.height; y++) {
+		uint32_t* row = (uint32_t*)(v.pixels + (size_t)y * v.stride);
+		// Swap reversed groups of 8 from both ends, then the middle
+		int64_t i = 0, j = (int64_t)v.width - 8;
+		for (; i + 8 <= j; i += 8, j -= 8) {
+			bk_u32x8 a = bk_u32x8_load(row + i);
+			bk_u32x8 b = bk_u32x8_load(row + j);
+			bk_u32x8_store(row + i, bki_reverse(b));
+			bk_u32x8_store(row + j, bki_reverse(a));
+		}
+		for (int64_t l = i, r = j + 7; l < r; l++, r--) {
+			uint32_t t = row[l];
+			row[l] = row[r];
+			row[r] = t;
+		}
+	}
+}
+
+// Transposes an 8x8 tile of pixels: c[k] is column k of rows r[0..7]
+static inline void bki_transpose8(const bk_u32x8 r[8], bk_u32x8 c[8]) {
+	bk_u32x8 a[8], b[8];
+	for (int i = 0; i < 8; i += 2) {
+		a[i] = __builtin_shuffle(r[i], r[i + 1], (bk_u32x8){0, 8, 1, 9, 4, 12, 5, 13});
+		a[i + 1] = __builtin_shuffle(r[i], r[i + 1], (bk_u32x8){2, 10, 3, 11, 6, 14, 7, 15});
+	}
+	for (int i = 0; i < 8; i += 4) {
+		b[i] = __builtin_shuffle(a[i], a[i + 2], (bk_u32x8){0, 1, 8, 9, 4, 5, 12, 13});
+		b[i + 1] = __builtin_shuffle(a[i], a[i + 2], (bk_u32x8){2, 3, 10, 11, 6, 7, 14, 15});
+		b[i + 2] = __builtin_shuffle(a[i + 1], a[i + 3], (bk_u32x8){0, 1, 8, 9, 4, 5, 12, 13});
+		b[i + 3] = __builtin_shuffle(a[i + 1], a[i + 3], (bk_u32x8){2, 3, 10, 11, 6, 7, 14, 15});
+	}
+	for (int i = 0; i < 4; i++) {
+		c[i] = __builtin_shuffle(b[i], b[i + 4], (bk_u32x8){0, 1, 2, 3, 8, 9, 10, 11});
+		c[i + 4] = __builtin_shuffle(b[i], b[i + 4], (bk_u32x8){4, 5, 6, 7, 12, 13, 14, 15});
+	}
+}
+
+// Writes source pixel (x, y) to dst (y', x') where y' = x or width-1-x
+// (mirror_rows) and x' = y or height-1-y (mirror_cols). The transpose is
+// neither; quarter turns mirror one of the two.
+void bki_transpose_into(bki_view src, bki_view dst, int mirror_rows, int mirror_cols) {
+	uint32_t w = src.width, h = src.height;
+	for (uint32_t by = 0; by < h; by += BKI_BLOCK) {
+		for (uint32_t bx = 0; bx < w; bx += BKI_BLOCK) {
+			uint32_t ey = by + BKI_BLOCK < h ? by + BKI_BLOCK : h;
+			uint32_t ex = bx + BKI_BLOCK < w ? bx + BKI_BLOCK : w;
+
+			for (uint32_t y = by; y < ey; y += 8) {
+				for (uint32_t x = bx; x < ex; x += 8) {
+					if (y + 8 <= ey && x + 8 <= ex) {
+						bk_u32x8 r[8], c[8];
+						for (int i = 0; i < 8; i++) r[i] = bk_u32x8_load((const uint32_t*)bki_pixel(src, x, y + i));
+						bki_transpose8(r, c);
+						uint32_t col = mirror_cols ? h - 8 - y : y;
+						for (int k = 0; k < 8; k++) {
+							uint32_t row = mirror_rows ? w - 1 - (x + k) : x + k;
+							bk_u32x8_store((uint32_t*)bki_pixel(dst, col, row), mirror_cols ? bki_reverse(c[k]) : c[k]);
+						}
+						continue;
+					}
+
+					// Partial tile at the right or bottom edge
+					for (uint32_t sy = y; sy < y + 8 && sy < ey; sy++) {
+						for (uint32_t sx = x; sx < x + 8 && sx < ex; sx++) {
+							uint32_t row = mirror_rows ? w - 1 - sx : sx;
+							uint32_t col = mirror_cols ? h - 1 - sy : sy;
+							memcpy(bki_pixel(dst, col, row), bki_pixel(src, sx, sy), 4);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// dst must be src.height x src.width and must not overlap src
+void bki_transpose(bki_view src, bki_view dst) {
+	bki_transpose_into(src, dst, 0, 0);
+}
+
+// Rotates clockwise by quarter_turns * 90 degrees into dst, which is
+// src.height x src.width for odd turns, else src.width x src.height, and
+// must not overlap src
+void bki_rotate(bki_view src, bki_view dst, int quarter_turns) {
+	switch (quarter_turns & 3) {
+		case 0:
+			for (uint32_t y = 0; y < src.height; y++) memcpy(bki_pixel(dst, 0, y), bki_pixel(src, 0, y), (size_t)src.width * 4);
+			break;
+		case 1:
+			bki_transpose_into(src, dst, 0, 1);
+			break;
+		case 2:
+			for (uint32_t y = 0; y < src.height; y++) {
+				memcpy(bki_pixel(dst, 0, src.height - 1 - y), bki_pixel(src, 0, y), (size_t)src.width * 4);
+			}
+			bki_flip_horizontal(dst);
+			break;
+		case 3:
+			bki_transpose_into(src, dst, 1, 0);
+			break;
+	}
+}
+
+// Writes channel 'channel' (0 = R .. 3 = A) of every pixel to 'out',
+// 'out_stride' bytes per row
+void bki_extract(bki_view src, int channel, unsigned char* out, size_t out_stride) {
+	uint32_t shift = (uint32_t)channel * 8;
+	for (uint32_t y = 0; y < src.height; y++) {
+		const uint32_t* row = (const uint32_t*)bki_pixel(src, 0, y);
+		unsigned char* dst = out + (size_t)y * out_stride;
+		uint32_t x = 0;
+		for (; x + 8 <= src.width; x += 8) {
+			bki_u8x8 v = __builtin_convertvector((bk_u32x8_load(row + x) >> shift) & 0xFF, bki_u8x8);
+			memcpy(dst + x, &v, 8);
+		}
+		for (; x < src.width; x++) dst[x] = (unsigned char)(row[x] >> shift);
+	}
+}
+
+// Rebuilds each pixel of dst from its own channels: channel c takes
+// channel order[c] (0..3), or BKI_ZERO / BKI_ONE for 0 or 255. dst may be
+// src for an in-place swizzle, e.g. {2, 1, 0, 3} for RGBA <-> BGRA.
+void bki_swizzle(bki_view src, bki_view dst, const int order[4]) {
+	uint32_t fill = 0;
+	bk_u32x8 shift[4];
+	int used[4];
+	for (int c = 0; c < 4; c++) {
+		used[c] = order[c] >= 0 && order[c] < 4;
+		shift[c] = bk_u32x8_splat(used[c] ? (uint32_t)order[c] * 8 : 0);
+		if (order[c] == BKI_ONE) fill |= 0xFFu << (c * 8);
+	}
+
+	for (uint32_t y = 0; y < src.height; y++) {
+		const uint32_t* in = (const uint32_t*)bki_pixel(src, 0, y);
+		uint32_t* out = (uint32_t*)bki_pixel(dst, 0, y);
+		uint32_t x = 0;
+		for (; x + 8 <= src.width; x += 8) {
+			bk_u32x8 v = bk_u32x8_load(in + x);
+			bk_u32x8 r = bk_u32x8_splat(fill);
+			for (int c = 0; c < 4; c++) {
+				if (used[c]) r |= ((v >> shift[c]) & 0xFF) << (c * 8);
+			}
+			bk_u32x8_store(out + x, r);
+		}
+		for (; x < src.width; x++) {
+			uint32_t v = in[x], r = fill;
+			for (int c = 0; c < 4; c++) {
+				if (used[c]) r |= ((v >> (order[c] * 8)) & 0xFF) << (c * 8);
+			}
+			out[x] = r;
+		}
+	}
+}
+
+// Builds RGBA pixels from up to four 8-bit planes ('plane_stride' bytes
+// per row); a NULL plane is filled with fill[c]
+void bki_merge(const unsigned char* const planes[4], size_t plane_stride, const unsigned char fill[4], bki_view dst) {
+	uint32_t base = 0;
+	for (int c = 0; c < 4; c++) {
+		if (!planes[c]) base |= (uint32_t)fill[c] << (c * 8);
+	}
+
+	for (uint32_t y = 0; y < dst.height; y++) {
+		uint32_t* out = (uint32_t*)bki_pixel(dst, 0, y);
+		size_t offset = (size_t)y * plane_stride;
+		uint32_t x = 0;
+		for (; x + 8 <= dst.width; x += 8) {
+			bk_u32x8 r = bk_u32x8_splat(base);
+			for (int c = 0; c < 4; c++) {
+				if (!planes[c]) continue;
+				bki_u8x8 p;
+				memcpy(&p, planes[c] + offset + x, 8);
+				r |= __builtin_convertvector(p, bk_u32x8) << (c * 8);
+			}
+			bk_u32x8_store(out + x, r);
+		}
+		for (; x < dst.width; x++) {
+			uint32_t r = base;
+			for (int c = 0; c < 4; c++) {
+				if (planes[c]) r |= (uint32_t)planes[c][offset + x] << (c * 8);
+			}
+			out[x] = r;
+		}
+	}
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,168 @@
+/*
+bk_job.h - Worker pool for the Brickate project
+
+This header provides a small pthread-based pool that runs data-parallel
+loops: the caller hands it a count and a callback, and the callback is
+invoked once per index, spread over all workers. The calling thread
+takes part as worker 0, so a pool of N workers starts N - 1 threads.
+
+Includes functions for:
+  - Querying the number of online CPUs
+  - Creating and destroying a pool
+  - Running a parallel for loop and waiting for it to finish
+
+A NULL pool is accepted everywhere and runs the loop on the caller,
+which keeps single-threaded builds and tools free of special cases.
+One loop runs at a time per pool; callbacks must not start another
+loop on the same pool.
+*/
+
+#ifndef BK_JOB_H
+#define BK_JOB_H
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef void (*bkj_fn)(void* ctx, int index, int worker);
+
+typedef struct {
+	pthread_t* threads;
+	int n_workers; // including the caller
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;
+	pthread_cond_t done_cv;
+
+	// Current loop, published under 'lock' by bumping 'generation'
+	bkj_fn fn;
+	void* ctx;
+	int count;
+	int next; // next index to claim, updated atomically
+	int busy; // threads still inside the current loop
+	unsigned generation;
+	int quit;
+} bkj_pool;
+
+int bkj_cpu_count(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+int bkj_pool_size(const bkj_pool* pool) {
+	return pool ? pool->n_workers : 1;
+}
+
+void bkj_run_items(bkj_pool* pool, int worker) {
+	for (;;) {
+		int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= pool->count) break;
+		pool->fn(pool->ctx, i, worker);
+	}
+}
+
+typedef struct {
+	bkj_pool* pool;
+	int worker;
+} bkj_thread_arg;
+
+void* bkj_thread_main(void* arg) {
+	bkj_thread_arg* a = arg;
+	bkj_pool* pool = a->pool;
+	int worker = a->worker;
+	unsigned seen = 0;
+	free(a);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == seen) pthread_cond_wait(&pool->work_cv, &pool->lock);
+		if (pool->quit) break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		bkj_run_items(pool, worker);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) pthread_cond_signal(&pool->done_cv);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void bkj_pool_destroy(bkj_pool* pool) {
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 1; i < pool->n_workers; i++) pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cv);
+	pthread_cond_destroy(&pool->work_cv);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+// n_workers <= 0 uses one worker per online CPU
+bkj_pool* bkj_pool_create(int n_workers) {
+	if (n_workers <= 0) n_workers = bkj_cpu_count();
+
+	bkj_pool* pool = calloc(1, sizeof(bkj_pool));
+	if (!pool) return NULL;
+
+	pool->threads = calloc(n_workers, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cv, NULL);
+	pthread_cond_init(&pool->done_cv, NULL);
+
+	// Worker 0 is whoever calls bkj_parallel_for
+	pool->n_workers = 1;
+	for (int i = 1; i < n_workers; i++) {
+		bkj_thread_arg* arg = malloc(sizeof(bkj_thread_arg));
+		if (!arg) break;
+		arg->pool = pool;
+		arg->worker = i;
+		if (pthread_create(&pool->threads[i], NULL, bkj_thread_main, arg) != 0) {
+			free(arg);
+			break;
+		}
+		pool->n_workers++;
+	}
+
+	return pool;
+}
+
+void bkj_parallel_for(bkj_pool* pool, int count, bkj_fn fn, void* ctx) {
+	if (count <= 0) return;
+
+	if (!pool || pool->n_workers <= 1 || count == 1) {
+		for (int i = 0; i < count; i++) fn(ctx, i, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->count = count;
+	pool->next = 0;
+	pool->busy = pool->n_workers - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	bkj_run_items(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0) pthread_cond_wait(&pool->done_cv, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+bk_layers.h - Texture array and cube map loading for the Brickate project
+
+This header loads several same-sized PNG images into one contiguous
+RGBA8 buffer, one slice after another, for skyboxes and block texture
+arrays.
+
+Includes functions for:
+  - Loading N files as array layers
+  - Loading six files as cube map faces (+X, -X, +Y, -Y, +Z, -Z), which
+    must also be square
+
+Every input's IHDR is probed first and all sizes must agree, so the
+buffer is allocated once; each layer is then decoded straight into its
+slice through bkp_load_png_into, in parallel on an optional bk_job pool.
+Layers may use different color types, since all are converted to RGBA.
+*/
+
+#ifndef BK_LAYERS_H
+#define BK_LAYERS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_png.h"
+#include "bk_job.h"
+
+#define BKL_CUBE_FACES 6
+
+typedef struct {
+	unsigned char* pixels; // n_layers slices of width * height * 4 bytes
+	uint32_t width;
+	uint32_t height;
+	int n_layers;
+	size_t layer_size;     // bytes per slice
+} bkl_array;
+
+void bkl_free(bkl_array* a) {
+	free(a->pixels);
+	memset(a, 0, sizeof(*a));
+}
+
+unsigned char* bkl_layer(const bkl_array* a, int layer) {
+	return a->pixels + (size_t)layer * a->layer_size;
+}
+
+typedef struct {
+	bkl_array* array;
+	const char* const* paths;
+	int failed;
+} bkl_job;
+
+void bkl_decode_layer(void* ctx, int layer, int worker) {
+	bkl_job* j = ctx;
+	bkl_array* a = j->array;
+	bkp_ihdr ihdr;
+	(void)worker;
+
+	// The file may have changed since it was probed
+	if (!bkp_load_png_into(j->paths[layer], bkl_layer(a, layer), (size_t)a->width * 4, a->width, a->height, &ihdr)
+		|| ihdr.width != a->width || ihdr.height != a->height) {
+		__atomic_store_n(&j->failed, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// Reads the size of every file; fails if any is missing or sizes differ
+int bkl_probe(bkl_array* a, const char* const* paths, int n) {
+	for (int i = 0; i < n; i++) {
+		bkp_ihdr ihdr;
+		if (!bkp_probe_png(paths[i], &ihdr)) return 0;
+		if (i == 0) {
+			a->width = ihdr.width;
+			a->height = ihdr.height;
+		} else if (ihdr.width != a->width || ihdr.height != a->height) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Allocates the layers and decodes into them, once the size is known
+int bkl_decode(bkl_array* a, const char* const* paths, int n, bkj_pool* pool) {
+	a->n_layers = n;
+	a->layer_size = (size_t)a->width * a->height * 4;
+	a->pixels = malloc(a->layer_size * n);
+	if (!a->pixels) {
+		bkl_free(a);
+		return 0;
+	}
+
+	bkl_job j = {a, paths, 0};
+	bkj_parallel_for(pool, n, bkl_decode_layer, &j);
+	if (j.failed) {
+		bkl_free(a);
+		return 0;
+	}
+	return 1;
+}
+
+// Loads n PNG files as the layers of one array. 'pool' may be NULL.
+// Returns 1 on success; fails if any file is missing or sizes differ.
+int bkl_load(bkl_array* a, const char* const* paths, int n, bkj_pool* pool) {
+	memset(a, 0, sizeof(*a));
+	if (n <= 0 || !bkl_probe(a, paths, n)) return 0;
+	return bkl_decode(a, paths, n, pool);
+}
+
+// Loads the six faces of a cube map, in +X, -X, +Y, -Y, +Z, -Z order.
+// Faces must be square, which is checked before anything is decoded.
+int bkl_load_cube(bkl_array* a, const char* const faces[BKL_CUBE_FACES], bkj_pool* pool) {
+	memset(a, 0, sizeof(*a));
+	if (!bkl_probe(a, faces, BKL_CUBE_FACES) || a->width != a->height) return 0;
+	return bkl_decode(a, faces, BKL_CUBE_FACES, pool);
+}
+
+#endif
@@ -95,21 +95,21 @@ void bkm_mat4_identity(mat4 dest) {
 }
 
 void bkm_mat4_translate(vec3 v, mat4 dest) {
-	bkm_mat4_identity(m);
+	bkm_mat4_identity(dest);
 	dest[12] = v[0];
 	dest[13] = v[1];
 	dest[14] = v[2];
 }
 
 void bkm_mat4_scale(vec3 v, mat4 dest) {
-	bkm_mat4_identity(m);
+	bkm_mat4_identity(dest);
 	dest[0] = v[0];
 	dest[5] = v[1];
 	dest[10] = v[2];
 }
 
 void bkm_mat4_rotate_x(float angle_rad, mat4 dest) {
-	bkm_mat4_identity(m);
+	bkm_mat4_identity(dest);
 	float s = sinf(angle_rad);
 	float c = cosf(angle_rad);
 	dest[5] = c;
@@ -119,7 +119,7 @@ void bkm_mat4_rotate_x(float angle_rad, mat4 dest) {
 }
 
 void bkm_mat4_rotate_y(float angle_rad, mat4 dest) {
-	bkm_mat4_identity(m);
+	bkm_mat4_identity(dest);
 	float s = sinf(angle_rad);
 	float c = cosf(angle_rad);
 	dest[0] = c;
@@ -129,7 +129,7 @@ void bkm_mat4_rotate_y(float angle_rad, mat4 dest) {
 }
 
 void bkm_mat4_rotate_z(float angle_rad, mat4 dest) {
-	bkm_mat4_identity(m);
+	bkm_mat4_identity(dest);
 	float s = sinf(angle_rad);
 	float c = cosf(angle_rad);
 	dest[0] = c;
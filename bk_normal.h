@@ -0,0 +1,276 @@
+/*
+bk_normal.h - Normal maps from heightmaps for the Brickate project
+
+This header turns grayscale heightmaps into tangent-space normal maps
+for terrain and materials.
+
+Features:
+  - 3x3 Sobel gradients and normalization 8 texels at a time (bk_simd)
+  - Packed output: RGB8, or octahedral RG8 for two-channel textures
+  - Streaming: rows are pushed one at a time and each output row is
+    written as soon as the row below it arrives, so only three rows of
+    heights are kept; bkn_load_png runs it as the PNG decodes
+  - 16-bit heights from memory, in parallel row bands on a bk_job pool
+
+Normals follow the OpenGL convention: +X right, +Y up (toward the top of
+the image), +Z out of the surface. Edges clamp. 'strength' scales the
+height range (0..1) relative to one texel of spacing.
+
+bk_png only decodes 8-bit images so far; 16-bit heightmaps can be fed
+through bkn_generate until it handles deeper bit depths.
+*/
+
+#ifndef BK_NORMAL_H
+#define BK_NORMAL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_png.h"
+#include "bk_simd.h"
+#include "bk_job.h"
+
+BK_SIMD_BEGIN
+
+#define BKN_RGB8 0
+#define BKN_OCT_RG8 1
+
+#define BKN_BAND_ROWS 32
+
+typedef struct {
+	int width;
+	int height;
+	float strength;
+	int format;          // BKN_*
+	int row_len;         // floats per ring row: 1 + width padded to 8 + 1
+	float* ring;         // three rows of heights with one clamped texel each side
+	int y0, y1;          // output rows produced
+	int next_y;
+	unsigned char* out;  // points at output row 0
+	size_t out_stride;   // bytes
+} bkn_stream;
+
+int bkn_texel_size(int format) {
+	return format == BKN_OCT_RG8 ? 2 : 3;
+}
+
+void bkn_stream_free(bkn_stream* s) {
+	free(s->ring);
+	memset(s, 0, sizeof(*s));
+}
+
+int bkn_stream_init(bkn_stream* s, int width, int height, float strength, int format,
+	unsigned char* out, size_t out_stride) {
+	memset(s, 0, sizeof(*s));
+	if (width <= 0 || height <= 0) return 0;
+
+	s->width = width;
+	s->height = height;
+	s->strength = strength;
+	s->format = format;
+	s->row_len = ((width + 7) & ~7) + 2;
+	s->ring = calloc((size_t)s->row_len * 3, sizeof(float));
+	if (!s->ring) return 0;
+
+	s->y1 = height;
+	s->out = out;
+	s->out_stride = out_stride;
+	return 1;
+}
+
+// Retargets a stream at another band of output rows
+void bkn_stream_reset(bkn_stream* s, int y0, int y1) {
+	s->y0 = y0;
+	s->y1 = y1;
+	s->next_y = y0;
+}
+
+// Heights [*first, *last) that the stream's output rows read
+void bkn_stream_source_rows(const bkn_stream* s, int* first, int* last) {
+	*first = s->y0 > 0 ? s->y0 - 1 : 0;
+	*last = s->y1 < s->height ? s->y1 + 1 : s->height;
+}
+
+// Where height row y goes: width floats, to be filled before bkn_stream_commit
+float* bkn_stream_row(bkn_stream* s, int y) {
+	return s->ring + (size_t)(y % 3) * s->row_len + 1;
+}
+
+BK_SIMD_INLINE void bkn_encode(const bkn_stream* s, bk_f32x8 nx, bk_f32x8 ny, bk_f32x8 nz, int x, unsigned char* out) {
+	int n = s->width - x < 8 ? s->width - x : 8;
+	if (s->format == BKN_OCT_RG8) {
+		// Heightmap normals never point backwards, so no fold is needed
+		bk_f32x8 ax = bk_f32x8_select(nx < 0.0f, -nx, nx);
+		bk_f32x8 ay = bk_f32x8_select(ny < 0.0f, -ny, ny);
+		bk_f32x8 l1 = 1.0f / (ax + ay + nz);
+		bk_i32x8 r = bk_f32x8_to_i32((nx * l1 * 0.5f + 0.5f) * 255.0f + 0.5f);
+		bk_i32x8 g = bk_f32x8_to_i32((ny * l1 * 0.5f + 0.5f) * 255.0f + 0.5f);
+		for (int l = 0; l < n; l++) {
+			out[(x + l) * 2 + 0] = (unsigned char)r[l];
+			out[(x + l) * 2 + 1] = (unsigned char)g[l];
+		}
+	} else {
+		bk_i32x8 r = bk_f32x8_to_i32((nx * 0.5f + 0.5f) * 255.0f + 0.5f);
+		bk_i32x8 g = bk_f32x8_to_i32((ny * 0.5f + 0.5f) * 255.0f + 0.5f);
+		bk_i32x8 b = bk_f32x8_to_i32((nz * 0.5f + 0.5f) * 255.0f + 0.5f);
+		for (int l = 0; l < n; l++) {
+			out[(x + l) * 3 + 0] = (unsigned char)r[l];
+			out[(x + l) * 3 + 1] = (unsigned char)g[l];
+			out[(x + l) * 3 + 2] = (unsigned char)b[l];
+		}
+	}
+}
+
+void bkn_emit_row(bkn_stream* s, int y) {
+	int above = y > 0 ? y - 1 : 0;
+	int below = y + 1 < s->height ? y + 1 : y;
+	const float* a = bkn_stream_row(s, above) - 1;
+	const float* m = bkn_stream_row(s, y) - 1;
+	const float* b = bkn_stream_row(s, below) - 1;
+	unsigned char* out = s->out + (size_t)y * s->out_stride;
+
+	// Sobel weights sum to 8 per side
+	float k = s->strength / 8.0f;
+	for (int x = 0; x < s->width; x += 8) {
+		// Texel x sits at index x + 1 of each padded row
+		bk_f32x8 a0 = bk_f32x8_load(a + x), a1 = bk_f32x8_load(a + x + 1), a2 = bk_f32x8_load(a + x + 2);
+		bk_f32x8 m0 = bk_f32x8_load(m + x), m2 = bk_f32x8_load(m + x + 2);
+		bk_f32x8 b0 = bk_f32x8_load(b + x), b1 = bk_f32x8_load(b + x + 1), b2 = bk_f32x8_load(b + x + 2);
+
+		bk_f32x8 dx = (a2 + 2.0f * m2 + b2) - (a0 + 2.0f * m0 + b0);
+		bk_f32x8 dy = (b0 + 2.0f * b1 + b2) - (a0 + 2.0f * a1 + a2);
+
+		// Image rows grow downwards, +Y points up
+		bk_f32x8 nx = -dx * k;
+		bk_f32x8 ny = dy * k;
+		bk_f32x8 inv = 1.0f / bk_f32x8_sqrt(nx * nx + ny * ny + 1.0f);
+		bkn_encode(s, nx * inv, ny * inv, inv, x, out);
+	}
+}
+
+// Finishes height row y (rows arrive in increasing order) and writes every
+// output row that no longer waits for input. Rows outside the band are ignored.
+void bkn_stream_commit(bkn_stream* s, int y) {
+	int first, last;
+	bkn_stream_source_rows(s, &first, &last);
+	if (y < first || y >= last) return;
+
+	float* row = bkn_stream_row(s, y);
+	row[-1] = row[0];
+	for (int x = s->width; x < s->row_len - 1; x++) row[x] = row[s->width - 1];
+
+	while (s->next_y < s->y1) {
+		int below = s->next_y + 1 < s->height ? s->next_y + 1 : s->next_y;
+		if (below > y) break;
+		bkn_emit_row(s, s->next_y++);
+	}
+}
+
+// Pushes a row of 8-bit heights read from the first channel of pixels
+// 'pixel_bytes' apart, e.g. 4 for bkp_load_png output
+void bkn_stream_push_u8(bkn_stream* s, int y, const unsigned char* px, int pixel_bytes) {
+	float* row = bkn_stream_row(s, y);
+	for (int x = 0; x < s->width; x++) row[x] = px[(size_t)x * pixel_bytes] * (1.0f / 255.0f);
+	bkn_stream_commit(s, y);
+}
+
+void bkn_stream_push_u16(bkn_stream* s, int y, const uint16_t* h) {
+	float* row = bkn_stream_row(s, y);
+	for (int x = 0; x < s->width; x++) row[x] = h[x] * (1.0f / 65535.0f);
+	bkn_stream_commit(s, y);
+}
+
+typedef struct {
+	const uint16_t* heights;
+	size_t stride; // elements
+	bkn_stream* streams; // one per worker
+} bkn_job;
+
+void bkn_band(void* ctx, int band, int worker) {
+	bkn_job* j = ctx;
+	bkn_stream* s = &j->streams[worker];
+	int y0 = band * BKN_BAND_ROWS;
+	int y1 = y0 + BKN_BAND_ROWS < s->height ? y0 + BKN_BAND_ROWS : s->height;
+	bkn_stream_reset(s, y0, y1);
+
+	int first, last;
+	bkn_stream_source_rows(s, &first, &last);
+	for (int y = first; y < last; y++) bkn_stream_push_u16(s, y, j->heights + (size_t)y * j->stride);
+}
+
+// Generates a normal map from 16-bit heights ('stride' elements per row)
+// into 'out' ('out_stride' bytes per row). 'pool' may be NULL. Returns 1
+// on success.
+int bkn_generate(const uint16_t* heights, int width, int height, size_t stride, float strength, int format,
+	unsigned char* out, size_t out_stride, bkj_pool* pool) {
+	int n_workers = bkj_pool_size(pool);
+	bkn_stream* streams = calloc(n_workers, sizeof(bkn_stream));
+	int ok = streams != NULL;
+	for (int i = 0; ok && i < n_workers; i++) {
+		ok = bkn_stream_init(&streams[i], width, height, strength, format, out, out_stride);
+	}
+
+	if (ok) {
+		bkn_job j = {heights, stride, streams};
+		bkj_parallel_for(pool, (height + BKN_BAND_ROWS - 1) / BKN_BAND_ROWS, bkn_band, &j);
+	}
+
+	for (int i = 0; streams && i < n_workers; i++) bkn_stream_free(&streams[i]);
+	free(streams);
+	return ok;
+}
+
+typedef struct {
+	float strength;
+	int format;
+	bkn_stream stream;
+	unsigned char* pixels;
+	unsigned char* row;
+} bkn_decode_sink;
+
+unsigned char* bkn_decode_begin_row(void* user, const bkp_ihdr* ihdr, uint32_t y) {
+	bkn_decode_sink* s = user;
+	if (y == 0) {
+		size_t out_stride = (size_t)ihdr->width * bkn_texel_size(s->format);
+		s->pixels = malloc(out_stride * ihdr->height);
+		s->row = malloc((size_t)ihdr->width * 4);
+		if (!s->pixels || !s->row) return NULL;
+		if (!bkn_stream_init(&s->stream, ihdr->width, ihdr->height, s->strength, s->format, s->pixels, out_stride)) return NULL;
+	}
+	return s->row;
+}
+
+int bkn_decode_end_row(void* user, const bkp_ihdr* ihdr, uint32_t y, unsigned char* rgba) {
+	bkn_decode_sink* s = user;
+	(void)ihdr;
+	bkn_stream_push_u8(&s->stream, (int)y, rgba, 4);
+	return 1;
+}
+
+// Decodes a grayscale heightmap (the red channel of other color types)
+// and generates its normal map as it goes. Heights are used as stored,
+// without gamma or color management. Returns NULL on failure.
+unsigned char* bkn_load_png(const char* path, float strength, int format, uint32_t* out_width, uint32_t* out_height) {
+	bkn_decode_sink s = {0};
+	s.strength = strength;
+	s.format = format;
+	bkp_row_sink sink = {bkn_decode_begin_row, bkn_decode_end_row, &s, NULL, 1};
+
+	bkp_ihdr ihdr;
+	int ok = bkp_decode_rows(path, &ihdr, &sink);
+	bkn_stream_free(&s.stream);
+	free(s.row);
+	if (!ok) {
+		free(s.pixels);
+		return NULL;
+	}
+
+	if (out_width) *out_width = ihdr.width;
+	if (out_height) *out_height = ihdr.height;
+	return s.pixels;
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,294 @@
+/*
+bk_particle.h - CPU particle simulation for the Brickate project
+
+This header simulates large numbers of simple particles (sparks, dust,
+debris) with structure-of-arrays storage, so every kernel streams
+through plain float arrays 8 particles at a time (bk_simd).
+
+Includes functions for:
+  - Creating a particle system with a fixed capacity
+  - Spawning particles from a box emitter with randomized velocity,
+    color and lifetime, generated 8 at a time (bk_rand)
+  - Separate kernels for gravity and drag, integration and aging over a
+    range of particles
+  - Removing dead particles by stream compaction: each block of 8 is
+    packed with a lane shuffle chosen by its mask of live particles
+  - A full update that runs all of the above in parallel chunks on a
+    bk_job pool, compacting every chunk straight to its final place in a
+    second set of arrays
+
+Positions, velocities and colors are stored as three arrays each (x, y,
+z or r, g, b); particle i of a vec3 attribute is (a[0][i], a[1][i],
+a[2][i]). Particles are kept packed in [0, count), in no particular
+order once some have died. bkpt_update switches between two sets of
+arrays, so pointers into them must be read again after each update.
+*/
+
+#ifndef BK_PARTICLE_H
+#define BK_PARTICLE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_math.h"
+#include "bk_simd.h"
+#include "bk_job.h"
+#include "bk_rand.h"
+
+BK_SIMD_BEGIN
+
+#define BKPT_CHUNK 16384 // particles per parallel task
+#define BKPT_BLOCK 1024  // particles run through all kernels at once, sized to stay in L1
+#define BKPT_ARRAYS 10
+
+typedef struct {
+	float* pos[3];
+	float* vel[3];
+	float* color[3];
+	float* life;       // seconds left; dead at or below 0
+	size_t count;
+	size_t capacity;
+	size_t stride;     // floats between arrays
+	float* data;
+	float* back;       // arrays the next compaction writes to
+	uint32_t* chunk_alive;
+	bkrng_state rng;
+} bkpt_system;
+
+typedef struct {
+	vec3 position;
+	vec3 extent;       // half size of the spawn box
+	vec3 velocity;
+	vec3 spread;       // each velocity component varies by up to this much
+	vec3 color0;       // colors are picked between color0 and color1
+	vec3 color1;
+	float life_min;
+	float life_max;
+} bkpt_emitter;
+
+// Lane indices that pack the set lanes of each 8-bit mask to the front
+static int32_t bkpt_compress_table[256][8];
+
+static pthread_once_t bkpt_compress_once = PTHREAD_ONCE_INIT;
+
+void bkpt_build_compress_table(void) {
+	for (int m = 0; m < 256; m++) {
+		int n = 0;
+		for (int i = 0; i < 8; i++) {
+			if (m >> i & 1) bkpt_compress_table[m][n++] = i;
+		}
+		while (n < 8) bkpt_compress_table[m][n++] = 0;
+	}
+}
+
+// Points the attribute arrays into s->data
+void bkpt_set_arrays(bkpt_system* s) {
+	for (int k = 0; k < 3; k++) {
+		s->pos[k] = s->data + s->stride * k;
+		s->vel[k] = s->data + s->stride * (3 + k);
+		s->color[k] = s->data + s->stride * (6 + k);
+	}
+	s->life = s->data + s->stride * 9;
+}
+
+void bkpt_free(bkpt_system* s) {
+	free(s->data);
+	free(s->back);
+	free(s->chunk_alive);
+	memset(s, 0, sizeof(*s));
+}
+
+// Allocates room for 'capacity' particles. Returns 1 on success.
+int bkpt_init(bkpt_system* s, size_t capacity, uint32_t seed) {
+	memset(s, 0, sizeof(*s));
+	pthread_once(&bkpt_compress_once, bkpt_build_compress_table);
+
+	// Whole blocks of 8 may be written past the last particle
+	s->capacity = capacity;
+	s->stride = (capacity + 15) & ~(size_t)7;
+	s->data = calloc(s->stride * BKPT_ARRAYS, sizeof(float));
+	s->back = calloc(s->stride * BKPT_ARRAYS, sizeof(float));
+	s->chunk_alive = calloc(capacity / BKPT_CHUNK + 2, sizeof(uint32_t));
+	if (!s->data || !s->back || !s->chunk_alive) {
+		bkpt_free(s);
+		return 0;
+	}
+	bkpt_set_arrays(s);
+	bkrng_seed(&s->rng, seed, 0);
+	return 1;
+}
+
+// Spawns up to n particles, fewer if the system is full. Returns the
+// number spawned.
+size_t bkpt_spawn(bkpt_system* s, const bkpt_emitter* e, size_t n) {
+	if (n > s->capacity - s->count) n = s->capacity - s->count;
+	bkrng_lanes rng = bkrng_load(&s->rng);
+	size_t end = s->count + n;
+
+	for (size_t i = s->count; i < end; i += 8) {
+		for (int k = 0; k < 3; k++) {
+			bk_f32x8 u = bkrng_range8(&rng, -1.0f, 1.0f);
+			bk_f32x8_store(s->pos[k] + i, bk_f32x8_splat(e->position[k]) + u * e->extent[k]);
+			u = bkrng_range8(&rng, -1.0f, 1.0f);
+			bk_f32x8_store(s->vel[k] + i, bk_f32x8_splat(e->velocity[k]) + u * e->spread[k]);
+		}
+		bk_f32x8 t = bkrng_float8(&rng);
+		for (int k = 0; k < 3; k++) {
+			bk_f32x8_store(s->color[k] + i, bk_f32x8_splat(e->color0[k]) + t * (e->color1[k] - e->color0[k]));
+		}
+		t = bkrng_float8(&rng);
+		bk_f32x8_store(s->life + i, bk_f32x8_splat(e->life_min) + t * (e->life_max - e->life_min));
+	}
+
+	bkrng_save(&s->rng, &rng);
+	s->count = end;
+	return n;
+}
+
+// Kernels over particles [begin, end); begin must be a multiple of 8 and
+// end is rounded up to one
+
+// v = (v + gravity * dt) / (1 + drag * dt), which stays stable for any dt
+void bkpt_apply_forces(bkpt_system* s, size_t begin, size_t end, const vec3 gravity, float drag, float dt) {
+	float damp = 1.0f / (1.0f + drag * dt);
+	for (int k = 0; k < 3; k++) {
+		bk_f32x8 g = bk_f32x8_splat(gravity[k] * dt);
+		float* v = s->vel[k];
+		for (size_t i = begin; i < end; i += 8) {
+			bk_f32x8_store(v + i, (bk_f32x8_load(v + i) + g) * damp);
+		}
+	}
+}
+
+void bkpt_integrate(bkpt_system* s, size_t begin, size_t end, float dt) {
+	for (int k = 0; k < 3; k++) {
+		float* p = s->pos[k];
+		const float* v = s->vel[k];
+		for (size_t i = begin; i < end; i += 8) {
+			bk_f32x8_store(p + i, bk_f32x8_load(p + i) + bk_f32x8_load(v + i) * dt);
+		}
+	}
+}
+
+void bkpt_age(bkpt_system* s, size_t begin, size_t end, float dt) {
+	for (size_t i = begin; i < end; i += 8) {
+		bk_f32x8_store(s->life + i, bk_f32x8_load(s->life + i) - dt);
+	}
+}
+
+// Lanes of the block at i whose particle is alive, limited to [i, end)
+static inline int bkpt_alive_mask(const bkpt_system* s, size_t i, size_t end) {
+	// 0 - life has its sign bit set exactly when life > 0, which is
+	// cheaper than a compare on targets without 8-wide vectors
+	int mask = bk_i32x8_movemask(bk_f32x8_bits(0.0f - bk_f32x8_load(s->life + i)));
+	if (end - i < 8) mask &= (1 << (end - i)) - 1;
+	return mask;
+}
+
+size_t bkpt_count_alive(const bkpt_system* s, size_t begin, size_t end) {
+	size_t n = 0;
+	for (size_t i = begin; i < end; i += 8) n += __builtin_popcount(bkpt_alive_mask(s, i, end));
+	return n;
+}
+
+// Packs the live particles of [begin, end), keeping their order, into
+// s->back from index 'out'. Writes nothing at or past out + alive, where
+// alive is what bkpt_count_alive returns for the range, so ranges can be
+// compacted in parallel.
+void bkpt_compact(bkpt_system* s, size_t begin, size_t end, size_t out, size_t alive) {
+	float* src[BKPT_ARRAYS];
+	float* dst[BKPT_ARRAYS];
+	for (int a = 0; a < BKPT_ARRAYS; a++) {
+		src[a] = s->data + s->stride * a;
+		dst[a] = s->back + s->stride * a;
+	}
+
+	size_t out_end = out + alive;
+	for (size_t i = begin; i < end && out < out_end; i += 8) {
+		int mask = bkpt_alive_mask(s, i, end);
+		if (!mask) continue;
+		int n = __builtin_popcount(mask);
+		bk_i32x8 perm = bk_i32x8_load(bkpt_compress_table[mask]);
+		for (int a = 0; a < BKPT_ARRAYS; a++) {
+			// Full blocks skip the shuffle; each store's unused lanes are
+			// overwritten by the next one, except near the end of the range
+			bk_f32x8 v = bk_f32x8_load(src[a] + i);
+			if (mask != 0xFF) v = __builtin_shuffle(v, perm);
+			if (out + 8 <= out_end) {
+				bk_f32x8_store(dst[a] + out, v);
+			} else {
+				float tail[8];
+				bk_f32x8_store(tail, v);
+				memcpy(dst[a] + out, tail, n * sizeof(float));
+			}
+		}
+		out += n;
+	}
+}
+
+typedef struct {
+	bkpt_system* s;
+	vec3 gravity;
+	float drag;
+	float dt;
+} bkpt_update_job;
+
+void bkpt_update_chunk(void* ctx, int chunk, int worker) {
+	(void)worker;
+	bkpt_update_job* j = ctx;
+	bkpt_system* s = j->s;
+	size_t begin = (size_t)chunk * BKPT_CHUNK;
+	size_t end = begin + BKPT_CHUNK < s->count ? begin + BKPT_CHUNK : s->count;
+
+	size_t alive = 0;
+	for (size_t b = begin; b < end; b += BKPT_BLOCK) {
+		size_t e = b + BKPT_BLOCK < end ? b + BKPT_BLOCK : end;
+		bkpt_apply_forces(s, b, e, j->gravity, j->drag, j->dt);
+		bkpt_integrate(s, b, e, j->dt);
+		bkpt_age(s, b, e, j->dt);
+		alive += bkpt_count_alive(s, b, e);
+	}
+	s->chunk_alive[chunk] = (uint32_t)alive;
+}
+
+// chunk_alive holds each chunk's first output index by now
+void bkpt_compact_chunk(void* ctx, int chunk, int worker) {
+	(void)worker;
+	bkpt_system* s = ctx;
+	size_t begin = (size_t)chunk * BKPT_CHUNK;
+	size_t end = begin + BKPT_CHUNK < s->count ? begin + BKPT_CHUNK : s->count;
+	size_t out = s->chunk_alive[chunk];
+	bkpt_compact(s, begin, end, out, s->chunk_alive[chunk + 1] - out);
+}
+
+// Advances every particle by dt and removes the ones that died, in
+// parallel chunks on 'pool' (NULL runs on the caller). The live particles
+// of each chunk are packed straight to their final index in the other
+// set of arrays, which then becomes the current one.
+void bkpt_update(bkpt_system* s, float dt, const vec3 gravity, float drag, bkj_pool* pool) {
+	bkpt_update_job j = {s, {gravity[0], gravity[1], gravity[2]}, drag, dt};
+	int n_chunks = (int)((s->count + BKPT_CHUNK - 1) / BKPT_CHUNK);
+	bkj_parallel_for(pool, n_chunks, bkpt_update_chunk, &j);
+
+	// Counts to start indices; one more entry holds the total
+	size_t count = 0;
+	for (int c = 0; c < n_chunks; c++) {
+		size_t n = s->chunk_alive[c];
+		s->chunk_alive[c] = (uint32_t)count;
+		count += n;
+	}
+	s->chunk_alive[n_chunks] = (uint32_t)count;
+	if (count == s->count) return;
+
+	bkj_parallel_for(pool, n_chunks, bkpt_compact_chunk, s);
+	float* t = s->data;
+	s->data = s->back;
+	s->back = t;
+	bkpt_set_arrays(s);
+	s->count = count;
+}
+
+BK_SIMD_END
+
+#endif
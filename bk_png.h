@@ -9,8 +9,14 @@ Features:
   - Supports critical chunks: IHDR, PLTE, IDAT, IEND
   - Optional support for gAMA chunk
   - Performs CRC validation on all chunks
-  - Collects IDAT data for later decompression
-  - Reads palette data and image gamma if present
+  - Inflates IDAT data row by row as it is read
+  - Reads palette data (with tRNS alpha) and image gamma if present
+  - Optional 4x4-tiled or Morton-ordered output for cache-friendly sampling
+  - sRGB, cHRM and iCCP (matrix/TRC RGB profiles) color management through
+    cached 3D LUTs, plus optional user grading LUTs (.cube)
+  - Encoding of every 8-bit color type, including indexed with tRNS
+  - Resumable decoding in time-budgeted steps for single-threaded loops
+  - Optional per-stage timing and hardware counters (perf_event_open)
 
 Intended for use in software rasterizers or custom game engines
 where lightweight image loading is preferred.
@@ -23,9 +29,20 @@ where lightweight image loading is preferred.
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <zlib.h>
 #include <assert.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "bk_simd.h"
 
 // PNG color types
 #define BK_PNG_GRAY 0
@@ -55,20 +72,42 @@ typedef struct {
 } bkp_buffer;
 
 uint32_t bkp_crc32(uint32_t crc, const unsigned char* buf, size_t len) {
-	static uint32_t table[256];
-	static int have_table = 0;
-
-	if (!have_table) {
-		for (uint32_t i = 0; i < 256; i++) {
-			uint32_t rem = i;
-			for (int j = 0; j < 8; j++) {
-				if (rem & 1) rem = (rem >> 1) ^ 0xEDB88320;
-				else rem >>= 1;
-			}
-			table[i] = rem;
-		}
-		have_table = 1;
-	}
+	// Polynomial 0xEDB88320; a constant table, since decodes run on many
+	// threads at once
+	static const uint32_t table[256] = {
+		0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+		0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+		0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+		0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+		0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+		0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+		0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+		0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+		0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+		0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+		0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+		0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+		0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+		0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+		0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+		0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+		0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+		0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+		0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+		0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+		0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+		0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+		0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+		0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+		0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+		0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+		0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+		0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+		0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+		0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+		0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+		0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+	};
 
 	crc = ~crc;
 	for (size_t i = 0; i < len; i++) {
@@ -214,47 +253,58 @@ int bkp_collect_idat_data(FILE* f, bkp_buffer* idat_buf, uint32_t length) {
 	return 1;
 }
 
-unsigned char* bkp_decompress_zlib(const unsigned char* compressed, size_t compressed_size, size_t* out_size) {
-	size_t max_out = compressed_size * 4;
-	unsigned char* out = malloc(max_out);
+// Inflates a complete zlib stream into at most max_size bytes. Returns
+// NULL if the stream is corrupt, truncated or inflates to more.
+unsigned char* bkp_decompress_zlib_max(const unsigned char* compressed, size_t compressed_size, size_t max_size, size_t* out_size) {
+	if (compressed_size > UINT_MAX) return NULL; // avail_in is 32-bit
+	size_t cap = compressed_size < UINT_MAX / 4 ? compressed_size * 4 + 64 : UINT_MAX;
+	if (cap > max_size) cap = max_size;
+	unsigned char* out = malloc(cap ? cap : 1);
 	if (!out) return NULL;
 
 	z_stream strm = {0};
 	strm.next_in = (unsigned char*)compressed;
 	strm.avail_in = compressed_size;
 	strm.next_out = out;
-	strm.avail_out = max_out;
+	strm.avail_out = cap;
 
 	if (inflateInit(&strm) != Z_OK) {
 		free(out);
 		return NULL;
 	}
-	
-	int ret;
-	do {
-		ret = inflate(&strm, Z_NO_FLUSH);
-		if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-			inflateEnd(&strm);
-			free(out);
-			return NULL;
-		}
+
+	for (;;) {
+		int ret = inflate(&strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) break;
+		// Z_BUF_ERROR means no progress was possible
+		if (ret != Z_OK) goto fail;
 		if (strm.avail_out == 0) {
-			size_t old_size = strm.total_out;
-			unsigned char* new_out = realloc(out, old_size * 2);
-			if (!new_out) {
-				inflateEnd(&strm);
-				free(out);
-				return NULL;
-			}
+			if (cap == max_size) goto fail;
+			size_t new_cap = cap <= max_size / 2 ? cap * 2 : max_size;
+			if (new_cap - cap > UINT_MAX) new_cap = cap + UINT_MAX;
+			unsigned char* new_out = realloc(out, new_cap);
+			if (!new_out) goto fail;
 			out = new_out;
-			strm.next_out = out + old_size;
-			strm.avail_out = old_size;
+			strm.next_out = out + cap;
+			strm.avail_out = new_cap - cap;
+			cap = new_cap;
+		} else if (strm.avail_in == 0) {
+			goto fail; // truncated
 		}
-	} while (ret != Z_STREAM_END);
-	
+	}
+
 	*out_size = strm.total_out;
 	inflateEnd(&strm);
 	return out;
+
+fail:
+	inflateEnd(&strm);
+	free(out);
+	return NULL;
+}
+
+unsigned char* bkp_decompress_zlib(const unsigned char* compressed, size_t compressed_size, size_t* out_size) {
+	return bkp_decompress_zlib_max(compressed, compressed_size, SIZE_MAX, out_size);
 }
 
 unsigned char bkp_paeth_predictor(int a, int b, int c) {
@@ -268,6 +318,47 @@ unsigned char bkp_paeth_predictor(int a, int b, int c) {
 	return c;
 }
 
+// Reverses filter type 'filter' on one row of 'len' bytes. 'raw' and 'out'
+// may be the same buffer; prev is NULL for the first row. Returns 0 for an
+// unknown filter type.
+int bkp_unfilter_row(int filter, const unsigned char* raw, const unsigned char* prev, size_t len, int bpp, unsigned char* out) {
+	switch (filter) {
+		case 0: // None
+			if (out != raw) memcpy(out, raw, len);
+			break;
+		case 1: // Sub
+			for (size_t i = 0; i < len; i++) {
+				unsigned char left = (i >= (size_t)bpp) ? out[i - bpp] : 0;
+				out[i] = raw[i] + left;
+			}
+			break;
+		case 2: // Up
+			for (size_t i = 0; i < len; i++) {
+				unsigned char up = prev ? prev[i] : 0;
+				out[i] = raw[i] + up;
+			}
+			break;
+		case 3: // Average
+			for (size_t i = 0; i < len; i++) {
+				unsigned char left = (i >= (size_t)bpp) ? out[i - bpp] : 0;
+				unsigned char up = prev ? prev[i] : 0;
+				out[i] = raw[i] + ((left + up) >> 1);
+			}
+			break;
+		case 4: // Paeth
+			for (size_t i = 0; i < len; i++) {
+				unsigned char left = (i >= (size_t)bpp) ? out[i - bpp] : 0;
+				unsigned char up = prev ? prev[i] : 0;
+				unsigned char up_left = (prev && i >= (size_t)bpp) ? prev[i - bpp] : 0;
+				out[i] = raw[i] + bkp_paeth_predictor(left, up, up_left);
+			}
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
 int bkp_filter_decode(const unsigned char* data, int width, int height, int bpp, unsigned char* out) {
 	const int stride = width * bpp;
 	const unsigned char* prev_row = NULL;
@@ -276,41 +367,7 @@ int bkp_filter_decode(const unsigned char* data, int width, int height, int bpp,
 	for (int y = 0; y < height; y++) {
 		unsigned char filter = *curr_ptr++;
 		unsigned char* out_row = out + y * stride;
-
-		switch (filter) {
-			case 0: // None
-				memcpy(out_row, curr_ptr, stride);
-				break;
-			case 1: // Sub
-				for (int i = 0; i < stride; i++) {
-					unsigned char left = (i >= bpp) ? out_row[i - bpp] : 0;
-					out_row[i] = curr_ptr[i] + left;
-				}
-				break;
-			case 2: // Up
-				for (int i = 0; i < stride; i++) {
-					unsigned char up = prev_row ? prev_row[i] : 0;
-					out_row[i] = curr_ptr[i] + up;
-				}
-				break;
-			case 3: // Average
-				for (int i = 0; i < stride; i++) {
-					unsigned char left = (i >= bpp) ? out_row[i - bpp] : 0;
-					unsigned char up = prev_row ? prev_row[i] : 0;
-					out_row[i] = curr_ptr[i] + ((left + up) >> 1);
-				}
-				break;
-			case 4: // Paeth
-				for (int i = 0; i < stride; i++) {
-					unsigned char left = (i >= bpp) ? out_row[i - bpp] : 0;
-					unsigned char up = prev_row ? prev_row[i] : 0;
-					unsigned char up_left = (prev_row && i >= bpp) ? prev_row[i - bpp] : 0;
-					out_row[i] = curr_ptr[i] + bkp_paeth_predictor(left, up, up_left);
-				}
-				break;
-			default:
-				return 0;
-		}
+		if (!bkp_unfilter_row(filter, curr_ptr, prev_row, stride, bpp, out_row)) return 0;
 
 		prev_row = out_row;
 		curr_ptr += stride;
@@ -508,162 +565,1531 @@ fail:
 	return 0;
 }
 
-unsigned char* bkp_load_png(const char* path, uint32_t* out_width, uint32_t* out_height, int* out_color_type) {
-	FILE* f = fopen(path, "rb");
-	if (!f) return NULL;
-	
-	unsigned char png_signature[8] = {137,80,78,71,13,10,26,10};
-	unsigned char signature_read[8];
+// Reads a whole chunk body and checks its CRC. The caller frees *out.
+int bkp_read_chunk_data(FILE* f, uint32_t length, const char* type, unsigned char** out) {
+	unsigned char* buf = malloc(length + 4);
+	if (!buf) return 0;
 
-	if (fread(signature_read, 1, 8, f) != 8) {
-		fclose(f);
-		return NULL;
+	uint32_t crc_read;
+	memcpy(buf, type, 4);
+	if (fread(buf + 4, 1, length, f) != length || !bkp_read_be32(f, &crc_read)
+		|| bkp_crc32(0, buf, length + 4) != crc_read) {
+		free(buf);
+		return 0;
+	}
+
+	memmove(buf, buf + 4, length);
+	*out = buf;
+	return 1;
+}
+
+// tRNS for indexed images: alpha for the first palette entries. The color
+// key forms used by other color types are verified and ignored.
+int bkp_read_trns(FILE* f, uint32_t length, int color_type, bkp_palette* pal) {
+	unsigned char* data;
+	if (!bkp_read_chunk_data(f, length, "tRNS", &data)) return 0;
+	if (color_type == BK_PNG_INDEXED) {
+		for (uint32_t i = 0; i < length && i < pal->size; i++) pal->palette[i][3] = data[i];
 	}
-	if (memcmp(png_signature, signature_read, 8) != 0) {
-		fclose(f);
+	free(data);
+	return 1;
+}
+
+uint32_t bkp_be32(const unsigned char* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Color management
+//
+// Images that carry sRGB, iCCP or cHRM information are converted to sRGB
+// through a 3D lookup table, built once per distinct source color space
+// and cached. An sRGB chunk takes precedence over iCCP, and iCCP over
+// cHRM/gAMA, as the PNG specification asks. Images with only a gAMA
+// chunk keep the plain gamma correction above, and so do gray images
+// unless they carry sRGB or a gray profile.
+
+#define BKP_COLOR_NONE 0 // no color chunks, or gAMA only
+#define BKP_COLOR_SRGB 1
+#define BKP_COLOR_CHRM 2
+#define BKP_COLOR_ICC 3
+
+#define BKP_LUT_SIZE 33
+#define BKP_LUT_CACHE 8
+#define BKP_ICC_MAX (4 << 20) // largest iCCP profile accepted, decompressed
+
+typedef struct {
+	int has_srgb;
+	int has_chrm;
+	float chrm[8];        // white x, y, red x, y, green x, y, blue x, y
+	unsigned char* icc;   // decompressed profile
+	size_t icc_size;
+} bkp_color;
+
+// RGB to RGB table; index (b * size + g) * size + r, values 0..255
+typedef struct {
+	int size;
+	float* r;
+	float* g;
+	float* b;
+} bkp_lut;
+
+// Transfer curve in the form of ICC parametric type 4:
+// x >= d ? (a * x + b) ^ g + e : c * x + f, or a sampled table
+typedef struct {
+	float g, a, b, c, d, e, f;
+	const unsigned char* table; // big-endian uint16 samples
+	uint32_t n;
+} bkp_curve;
+
+void bkp_lut_free(bkp_lut* lut) {
+	if (!lut) return;
+	free(lut->r);
+	free(lut->g);
+	free(lut->b);
+	free(lut);
+}
+
+bkp_lut* bkp_lut_create(int size) {
+	if (size < 2 || size > 256) return NULL;
+	bkp_lut* lut = calloc(1, sizeof(bkp_lut));
+	if (!lut) return NULL;
+
+	size_t n = (size_t)size * size * size;
+	lut->size = size;
+	lut->r = malloc(n * sizeof(float));
+	lut->g = malloc(n * sizeof(float));
+	lut->b = malloc(n * sizeof(float));
+	if (!lut->r || !lut->g || !lut->b) {
+		bkp_lut_free(lut);
 		return NULL;
 	}
+	return lut;
+}
+
+// Loads a color grading LUT in the .cube text format (LUT_3D_SIZE, red
+// changing fastest, values 0..1)
+bkp_lut* bkp_lut_load_cube(const char* path) {
+	FILE* f = fopen(path, "r");
+	if (!f) return NULL;
+
+	bkp_lut* lut = NULL;
+	size_t n = 0, count = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		int size;
+		float r, g, b;
+		if (sscanf(line, "LUT_3D_SIZE %d", &size) == 1) {
+			if (lut) break;
+			lut = bkp_lut_create(size);
+			if (!lut) break;
+			n = (size_t)size * size * size;
+		} else if (lut && count < n && sscanf(line, "%f %f %f", &r, &g, &b) == 3) {
+			lut->r[count] = r * 255.0f;
+			lut->g[count] = g * 255.0f;
+			lut->b[count] = b * 255.0f;
+			count++;
+		}
+	}
+	fclose(f);
 
-	bkp_ihdr ihdr = {0};
-	if (!bkp_read_ihdr(f, &ihdr)) {
-		fclose(f);
+	if (!lut || count != n) {
+		bkp_lut_free(lut);
 		return NULL;
 	}
+	return lut;
+}
 
-	bkp_palette palette = {0};
-	bkp_buffer idat_buf = {0};
+BK_SIMD_BEGIN
+
+// Tetrahedral interpolation of 8 pixels: the cube cell is split along its
+// diagonal into the tetrahedron picked by the order of the fractions, so
+// each pixel reads 4 entries instead of 8. Written with vector operators
+// rather than the bk_simd helpers so that including the loader never
+// trips GCC's -Wpsabi (see bk_simd.h).
+static inline void bkp_lut_apply8(const bkp_lut* lut, uint32_t* px) {
+	const bk_i32x8 zero = {0};
+	const bk_f32x8 fzero = {0};
+	bk_u32x8 c;
+	memcpy(&c, px, sizeof(c));
+	float scale = (lut->size - 1) / 255.0f;
+	int last = lut->size - 2;
+	int plane = lut->size * lut->size;
+
+// Per lane: mask ? a : b, on integer vectors
+#define BKP_SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+	bk_f32x8 f[3];
+	bk_i32x8 cell[3];
+	for (int i = 0; i < 3; i++) {
+		f[i] = __builtin_convertvector((bk_i32x8)((c >> (i * 8)) & 0xFF), bk_f32x8) * scale;
+		cell[i] = __builtin_convertvector(f[i], bk_i32x8);
+		cell[i] = BKP_SELECT(cell[i] > last, zero + last, cell[i]);
+		f[i] -= __builtin_convertvector(cell[i], bk_f32x8);
+	}
+	bk_i32x8 base = (cell[2] * lut->size + cell[1]) * lut->size + cell[0];
+
+	// Sort the fractions, largest first, carrying each axis' index step
+	bk_f32x8 t0 = f[0], t1 = f[1], t2 = f[2];
+	bk_i32x8 s0 = zero + 1, s1 = zero + lut->size, s2 = zero + plane;
+#define BKP_SWAP_IF_LESS(ta, sa, tb, sb) do { \
+		bk_i32x8 m = ta < tb; \
+		bk_f32x8 t = (bk_f32x8)BKP_SELECT(m, (bk_i32x8)tb, (bk_i32x8)ta); \
+		tb = (bk_f32x8)BKP_SELECT(m, (bk_i32x8)ta, (bk_i32x8)tb); ta = t; \
+		bk_i32x8 s = BKP_SELECT(m, sb, sa); sb = BKP_SELECT(m, sa, sb); sa = s; \
+	} while (0)
+	BKP_SWAP_IF_LESS(t0, s0, t1, s1);
+	BKP_SWAP_IF_LESS(t1, s1, t2, s2);
+	BKP_SWAP_IF_LESS(t0, s0, t1, s1);
+#undef BKP_SWAP_IF_LESS
+
+	bk_i32x8 idx[4] = {base, base + s0, base + s0 + s1, base + 1 + lut->size + plane};
+	bk_f32x8 w[4] = {1.0f - t0, t0 - t1, t1 - t2, t2};
+
+	const float* planes[3] = {lut->r, lut->g, lut->b};
+	bk_u32x8 out = c & 0xFF000000;
+	for (int i = 0; i < 3; i++) {
+		bk_f32x8 v = fzero + 0.5f;
+		for (int k = 0; k < 4; k++) {
+#ifdef __AVX2__
+			bk_f32x8 e = (bk_f32x8)_mm256_i32gather_ps(planes[i], (__m256i)idx[k], 4);
+#else
+			bk_f32x8 e;
+			for (int l = 0; l < 8; l++) memcpy(&e[l], planes[i] + idx[k][l], 4);
+#endif
+			v += e * w[k];
+		}
+		v = (bk_f32x8)BKP_SELECT(v > 0.0f, (bk_i32x8)v, zero);
+		v = (bk_f32x8)BKP_SELECT(v < 255.0f, (bk_i32x8)v, (bk_i32x8)(fzero + 255.0f));
+		out |= (bk_u32x8)__builtin_convertvector(v, bk_i32x8) << (i * 8);
+	}
+#undef BKP_SELECT
+	memcpy(px, &out, sizeof(out));
+}
 
-	int have_plte = 0;
-	float gamma = 0.0f;
+BK_SIMD_END
+
+// Maps the RGB of n RGBA pixels through the table; alpha is kept
+void bkp_lut_apply(const bkp_lut* lut, unsigned char* rgba, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) bkp_lut_apply8(lut, (uint32_t*)(rgba + i * 4));
+	if (i < n) {
+		uint32_t tail[8] = {0};
+		memcpy(tail, rgba + i * 4, (n - i) * 4);
+		bkp_lut_apply8(lut, tail);
+		memcpy(rgba + i * 4, tail, (n - i) * 4);
+	}
+}
 
-	// Read next chunk(s) until IDAT/IEND
-	while (1) {
-		uint32_t length;
-		char type[5] = {0};
-		if (!bkp_read_chunk_header(f, &length, type)) break;
-
-		if (strcmp(type, "PLTE") == 0) {
-			if (!bkp_read_plte(f, length, &palette)) break;
-			have_plte = 1;
-		} else if (strcmp(type, "IDAT") == 0) {
-			if (!bkp_collect_idat_data(f, &idat_buf, length)) break;
-		} else if (strcmp(type, "IEND") == 0) {
-			break;
-		} else if (strcmp(type, "gAMA") == 0) {
-			if (!bkp_read_gama(f, &gamma, length)) break;
-		} else {
-			if (!bkp_skip_and_verify_chunk(f, length, type, &idat_buf)) break;
+float bkp_curve_eval(const bkp_curve* c, float x) {
+	if (c->table) {
+		float p = x * (c->n - 1);
+		uint32_t i = (uint32_t)p;
+		if (i >= c->n - 1) return ((c->table[(c->n - 1) * 2] << 8) | c->table[(c->n - 1) * 2 + 1]) / 65535.0f;
+		float v0 = ((c->table[i * 2] << 8) | c->table[i * 2 + 1]) / 65535.0f;
+		float v1 = ((c->table[i * 2 + 2] << 8) | c->table[i * 2 + 3]) / 65535.0f;
+		return v0 + (v1 - v0) * (p - i);
+	}
+	if (x >= c->d) {
+		float t = c->a * x + c->b;
+		return (t > 0.0f ? powf(t, c->g) : 0.0f) + c->e;
+	}
+	return c->c * x + c->f;
+}
+
+// Extended to negative and above-one values, so that out-of-gamut colors
+// are clipped after interpolation rather than in the table
+float bkp_srgb_encode(float v) {
+	if (v < 0.0f) return -bkp_srgb_encode(-v);
+	return v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+}
+
+void bkp_mat3_mul(const float a[9], const float b[9], float out[9]) {
+	float t[9];
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++) {
+			t[r * 3 + c] = a[r * 3] * b[c] + a[r * 3 + 1] * b[3 + c] + a[r * 3 + 2] * b[6 + c];
 		}
 	}
-	
-	fclose(f);
+	memcpy(out, t, sizeof(t));
+}
 
-	if (idat_buf.data == NULL) return NULL;
+int bkp_mat3_inverse(const float m[9], float out[9]) {
+	float c0 = m[4] * m[8] - m[5] * m[7];
+	float c1 = m[5] * m[6] - m[3] * m[8];
+	float c2 = m[3] * m[7] - m[4] * m[6];
+	float det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+	if (fabsf(det) < 1e-12f) return 0;
+
+	float id = 1.0f / det;
+	float t[9] = {
+		c0 * id, (m[2] * m[7] - m[1] * m[8]) * id, (m[1] * m[5] - m[2] * m[4]) * id,
+		c1 * id, (m[0] * m[8] - m[2] * m[6]) * id, (m[2] * m[3] - m[0] * m[5]) * id,
+		c2 * id, (m[1] * m[6] - m[0] * m[7]) * id, (m[0] * m[4] - m[1] * m[3]) * id,
+	};
+	memcpy(out, t, sizeof(t));
+	return 1;
+}
 
-	size_t decompressed_size = 0;
-	unsigned char* decompressed = bkp_decompress_zlib(idat_buf.data, idat_buf.size, &decompressed_size);
-	free(idat_buf.data);
-	if (!decompressed) return NULL;
+// Bradford chromatic adaptation from one white point (XYZ) to another
+int bkp_adapt(const float src[3], const float dst[3], float out[9]) {
+	static const float bradford[9] = {
+		0.8951f, 0.2664f, -0.1614f,
+		-0.7502f, 1.7135f, 0.0367f,
+		0.0389f, -0.0685f, 1.0296f,
+	};
+	float inv[9];
+	if (!bkp_mat3_inverse(bradford, inv)) return 0;
+
+	float s[3], d[3];
+	for (int i = 0; i < 3; i++) {
+		s[i] = bradford[i * 3] * src[0] + bradford[i * 3 + 1] * src[1] + bradford[i * 3 + 2] * src[2];
+		d[i] = bradford[i * 3] * dst[0] + bradford[i * 3 + 1] * dst[1] + bradford[i * 3 + 2] * dst[2];
+	}
+	float scale[9] = {d[0] / s[0], 0, 0, 0, d[1] / s[1], 0, 0, 0, d[2] / s[2]};
+	bkp_mat3_mul(scale, bradford, out);
+	bkp_mat3_mul(inv, out, out);
+	return 1;
+}
 
-	// Expected raw size: (width * bpp + 1 filter byte) * height
-	int bpp;
-	switch (ihdr.color_type) {
-		case BK_PNG_GRAY: bpp = 1; break;
-		case BK_PNG_GRAY_ALPHA: bpp = 2; break;
-		case BK_PNG_RGB: bpp = 3; break;
-		case BK_PNG_INDEXED: bpp = 1; break;
-		case BK_PNG_RGBA: bpp = 4; break;
-		default:
-			free(decompressed);
-			return NULL;
+// Linear RGB to XYZ (adapted to D65) from cHRM chromaticities
+int bkp_chrm_matrix(const float chrm[8], float out[9]) {
+	float m[9];
+	for (int i = 0; i < 3; i++) {
+		float x = chrm[2 + i * 2], y = chrm[3 + i * 2];
+		if (y <= 0.0f) return 0;
+		m[i] = x / y;
+		m[3 + i] = 1.0f;
+		m[6 + i] = (1.0f - x - y) / y;
+	}
+	if (chrm[1] <= 0.0f) return 0;
+	float white[3] = {chrm[0] / chrm[1], 1.0f, (1.0f - chrm[0] - chrm[1]) / chrm[1]};
+
+	float inv[9];
+	if (!bkp_mat3_inverse(m, inv)) return 0;
+	for (int i = 0; i < 3; i++) {
+		float s = inv[i * 3] * white[0] + inv[i * 3 + 1] * white[1] + inv[i * 3 + 2] * white[2];
+		for (int r = 0; r < 3; r++) m[r * 3 + i] *= s;
 	}
 
-	size_t expected_size = (bpp * ihdr.width + 1) * ihdr.height;
-	if (decompressed_size < expected_size) {
-		free(decompressed);
-		return NULL;
+	static const float d65[3] = {0.95047f, 1.0f, 1.08883f};
+	float adapt[9];
+	if (!bkp_adapt(white, d65, adapt)) return 0;
+	bkp_mat3_mul(adapt, m, out);
+	return 1;
+}
+
+float bkp_s15f16(const unsigned char* p) {
+	return (int32_t)bkp_be32(p) / 65536.0f;
+}
+
+// Finds a tag in an ICC profile; returns its data or NULL
+const unsigned char* bkp_icc_tag(const unsigned char* icc, size_t size, const char* sig, uint32_t* out_size) {
+	if (size < 132) return NULL;
+	uint32_t count = bkp_be32(icc + 128);
+	if (count > (size - 132) / 12) return NULL;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const unsigned char* t = icc + 132 + i * 12;
+		if (memcmp(t, sig, 4) != 0) continue;
+		uint32_t offset = bkp_be32(t + 4), length = bkp_be32(t + 8);
+		if (offset > size || length > size - offset || length < 12) return NULL;
+		*out_size = length;
+		return icc + offset;
 	}
+	return NULL;
+}
 
-	unsigned char* raw_pixels = malloc(ihdr.width * ihdr.height * 4); // output RGBA
-	if (!raw_pixels) {
-		free(decompressed);
-		return NULL;
+int bkp_icc_curve(const unsigned char* icc, size_t size, const char* sig, bkp_curve* c) {
+	uint32_t n;
+	const unsigned char* t = bkp_icc_tag(icc, size, sig, &n);
+	if (!t) return 0;
+
+	memset(c, 0, sizeof(*c));
+	c->g = 1.0f;
+	c->a = 1.0f;
+	if (memcmp(t, "curv", 4) == 0) {
+		uint32_t count = bkp_be32(t + 8);
+		if (count > (n - 12) / 2) return 0;
+		if (count == 1) c->g = ((t[12] << 8) | t[13]) / 256.0f;
+		else if (count > 1) {
+			c->table = t + 12;
+			c->n = count;
+		}
+		return 1;
+	}
+	if (memcmp(t, "para", 4) == 0) {
+		static const int n_params[5] = {1, 3, 4, 5, 7};
+		int type = (t[8] << 8) | t[9];
+		if (type > 4 || n < 12 + n_params[type] * 4u) return 0;
+		float p[7] = {0};
+		for (int i = 0; i < n_params[type]; i++) p[i] = bkp_s15f16(t + 12 + i * 4);
+
+		c->g = p[0];
+		switch (type) {
+			case 0: break;
+			case 1: c->a = p[1]; c->b = p[2]; c->d = p[1] != 0.0f ? -p[2] / p[1] : 0.0f; break;
+			case 2: c->a = p[1]; c->b = p[2]; c->e = c->f = p[3]; c->d = p[1] != 0.0f ? -p[2] / p[1] : 0.0f; break;
+			case 3: c->a = p[1]; c->b = p[2]; c->c = p[3]; c->d = p[4]; break;
+			case 4: c->a = p[1]; c->b = p[2]; c->c = p[3]; c->d = p[4]; c->e = p[5]; c->f = p[6]; break;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// Reads a matrix/TRC RGB profile: curves plus linear RGB to XYZ (D65). A
+// gray profile gives its one curve for all channels and the sRGB matrix.
+int bkp_icc_parse(const unsigned char* icc, size_t size, bkp_curve curves[3], float to_xyz[9]) {
+	if (size >= 132 && memcmp(icc + 16, "GRAY", 4) == 0) {
+		static const float srgb_to_xyz[9] = {
+			0.4124564f, 0.3575761f, 0.1804375f,
+			0.2126729f, 0.7151522f, 0.0721750f,
+			0.0193339f, 0.1191920f, 0.9503041f,
+		};
+		if (!bkp_icc_curve(icc, size, "kTRC", &curves[0])) return 0;
+		curves[1] = curves[2] = curves[0];
+		memcpy(to_xyz, srgb_to_xyz, sizeof(srgb_to_xyz));
+		return 1;
+	}
+	if (size < 132 || memcmp(icc + 16, "RGB ", 4) != 0) return 0;
+
+	static const char* xyz_tags[3] = {"rXYZ", "gXYZ", "bXYZ"};
+	static const char* trc_tags[3] = {"rTRC", "gTRC", "bTRC"};
+	float m[9];
+	for (int i = 0; i < 3; i++) {
+		uint32_t n;
+		const unsigned char* t = bkp_icc_tag(icc, size, xyz_tags[i], &n);
+		if (!t || n < 20 || memcmp(t, "XYZ ", 4) != 0) return 0;
+		for (int r = 0; r < 3; r++) m[r * 3 + i] = bkp_s15f16(t + 8 + r * 4);
+		if (!bkp_icc_curve(icc, size, trc_tags[i], &curves[i])) return 0;
+	}
+
+	// Profile connection space colors are adapted to D50
+	static const float d50[3] = {0.9642f, 1.0f, 0.8249f};
+	static const float d65[3] = {0.95047f, 1.0f, 1.08883f};
+	float adapt[9];
+	if (!bkp_adapt(d50, d65, adapt)) return 0;
+	bkp_mat3_mul(adapt, m, to_xyz);
+	return 1;
+}
+
+bkp_lut* bkp_lut_build(const bkp_curve curves[3], const float to_xyz[9]) {
+	static const float to_srgb[9] = {
+		3.2404542f, -1.5371385f, -0.4985314f,
+		-0.9692660f, 1.8760108f, 0.0415560f,
+		0.0556434f, -0.2040259f, 1.0572252f,
+	};
+	float m[9];
+	bkp_mat3_mul(to_srgb, to_xyz, m);
+
+	bkp_lut* lut = bkp_lut_create(BKP_LUT_SIZE);
+	if (!lut) return NULL;
+
+	float lin[3][BKP_LUT_SIZE];
+	for (int c = 0; c < 3; c++) {
+		for (int i = 0; i < BKP_LUT_SIZE; i++) lin[c][i] = bkp_curve_eval(&curves[c], i / (float)(BKP_LUT_SIZE - 1));
 	}
 
-	unsigned char* filtered_pixels = malloc(ihdr.width * ihdr.height * bpp);
-	if (!filtered_pixels) {
-		free(decompressed);
-		free(raw_pixels);
+	size_t k = 0;
+	for (int b = 0; b < BKP_LUT_SIZE; b++) {
+		for (int g = 0; g < BKP_LUT_SIZE; g++) {
+			for (int r = 0; r < BKP_LUT_SIZE; r++, k++) {
+				float v[3] = {lin[0][r], lin[1][g], lin[2][b]};
+				lut->r[k] = bkp_srgb_encode(m[0] * v[0] + m[1] * v[1] + m[2] * v[2]) * 255.0f;
+				lut->g[k] = bkp_srgb_encode(m[3] * v[0] + m[4] * v[1] + m[5] * v[2]) * 255.0f;
+				lut->b[k] = bkp_srgb_encode(m[6] * v[0] + m[7] * v[1] + m[8] * v[2]) * 255.0f;
+			}
+		}
+	}
+	return lut;
+}
+
+// LUTs are keyed by a CRC of what they were built from and kept for the
+// life of the process. A full cache stops caching rather than evicting,
+// since other decodes may still be using its tables.
+typedef struct {
+	uint32_t key;
+	size_t key_size;
+	bkp_lut* lut;
+} bkp_lut_entry;
+
+static bkp_lut_entry bkp_lut_cache[BKP_LUT_CACHE];
+static int bkp_lut_cache_count = 0;
+static char bkp_lut_cache_lock = 0;
+
+// Returns the table that converts this image's colors to sRGB, or NULL if
+// none is needed. *owned is set when the caller must free it.
+bkp_lut* bkp_color_lut(const bkp_color* color, float gamma, int* owned) {
+	*owned = 0;
+	if (color->has_srgb) return NULL;
+
+	bkp_curve curves[3];
+	float to_xyz[9];
+	unsigned char key_buf[sizeof(float) * 9];
+	const unsigned char* key_data;
+	size_t key_size;
+
+	if (color->icc && bkp_icc_parse(color->icc, color->icc_size, curves, to_xyz)) {
+		key_data = color->icc;
+		key_size = color->icc_size;
+	} else if (color->has_chrm && bkp_chrm_matrix(color->chrm, to_xyz)) {
+		// gAMA holds the encoding exponent; without one assume 1 / 2.2
+		memset(curves, 0, sizeof(curves));
+		for (int i = 0; i < 3; i++) {
+			curves[i].g = gamma > 0.0f ? 1.0f / gamma : 2.2f;
+			curves[i].a = 1.0f;
+		}
+		memcpy(key_buf, color->chrm, sizeof(color->chrm));
+		memcpy(key_buf + sizeof(color->chrm), &gamma, sizeof(float));
+		key_data = key_buf;
+		key_size = sizeof(key_buf);
+	} else {
 		return NULL;
 	}
-	
-	int success = 0;
-	if (ihdr.interlace_method == 0) {
-	success = bkp_filter_decode(decompressed, ihdr.width, ihdr.height, bpp, filtered_pixels);
-	} else if (ihdr.interlace_method == 1) {
-		success = bkp_decode_adam7(decompressed, ihdr.width, ihdr.height, bpp, filtered_pixels);
+
+	uint32_t key = bkp_crc32(0, key_data, key_size);
+	while (__atomic_test_and_set(&bkp_lut_cache_lock, __ATOMIC_ACQUIRE)) {}
+	for (int i = 0; i < bkp_lut_cache_count; i++) {
+		if (bkp_lut_cache[i].key == key && bkp_lut_cache[i].key_size == key_size) {
+			bkp_lut* lut = bkp_lut_cache[i].lut;
+			__atomic_clear(&bkp_lut_cache_lock, __ATOMIC_RELEASE);
+			return lut;
+		}
+	}
+	__atomic_clear(&bkp_lut_cache_lock, __ATOMIC_RELEASE);
+
+	// Built outside the lock; two threads may race to add the same table
+	bkp_lut* lut = bkp_lut_build(curves, to_xyz);
+	if (!lut) return NULL;
+
+	while (__atomic_test_and_set(&bkp_lut_cache_lock, __ATOMIC_ACQUIRE)) {}
+	if (bkp_lut_cache_count < BKP_LUT_CACHE) {
+		bkp_lut_cache[bkp_lut_cache_count++] = (bkp_lut_entry){key, key_size, lut};
 	} else {
-		success = 0;
+		*owned = 1;
 	}
-	
-	if (!success) {
-		free(decompressed);
-		free(filtered_pixels);
-		free(raw_pixels);
-		return NULL;
+	__atomic_clear(&bkp_lut_cache_lock, __ATOMIC_RELEASE);
+	return lut;
+}
+
+int bkp_read_srgb(FILE* f, uint32_t length, bkp_color* color) {
+	unsigned char* data;
+	if (length != 1 || !bkp_read_chunk_data(f, length, "sRGB", &data)) return 0;
+	free(data);
+	color->has_srgb = 1;
+	return 1;
+}
+
+int bkp_read_chrm(FILE* f, uint32_t length, bkp_color* color) {
+	unsigned char* data;
+	if (length != 32 || !bkp_read_chunk_data(f, length, "cHRM", &data)) return 0;
+	for (int i = 0; i < 8; i++) color->chrm[i] = bkp_be32(data + i * 4) / 100000.0f;
+	free(data);
+	color->has_chrm = 1;
+	return 1;
+}
+
+// iCCP: profile name, NUL, compression method (0), zlib-compressed profile
+int bkp_read_iccp(FILE* f, uint32_t length, bkp_color* color) {
+	unsigned char* data;
+	if (!bkp_read_chunk_data(f, length, "iCCP", &data)) return 0;
+
+	const unsigned char* nul = memchr(data, 0, length < 80 ? length : 80);
+	if (nul && (size_t)(nul - data) + 2 < length && nul[1] == 0) {
+		size_t offset = (size_t)(nul - data) + 2;
+		free(color->icc);
+		color->icc = bkp_decompress_zlib_max(data + offset, length - offset, BKP_ICC_MAX, &color->icc_size);
 	}
+	free(data);
+	return 1;
+}
 
-	free(decompressed);
+// Pixel layouts for the decoded RGBA output
+#define BK_PNG_LAYOUT_LINEAR 0 // row-major, width * 4 bytes per row
+#define BK_PNG_LAYOUT_TILED 1  // 4x4 pixel blocks of 64 bytes, blocks in row-major order
+#define BK_PNG_LAYOUT_MORTON 2 // 32x32 pixel tiles in row-major order, Z-order inside each tile
+
+// Edge length in pixels of the blocks a layout pads the image to
+uint32_t bkp_layout_block(int layout) {
+	switch (layout) {
+		case BK_PNG_LAYOUT_TILED: return 4;
+		case BK_PNG_LAYOUT_MORTON: return 32;
+		default: return 1;
+	}
+}
 
-	// Convert pixel data to RGBA output
-	if (ihdr.color_type == BK_PNG_INDEXED) {
-		if (!have_plte) {
-			free(filtered_pixels);
-			free(raw_pixels);
-			return NULL;
+// Size in bytes of a width x height RGBA image stored in 'layout'
+size_t bkp_layout_size(uint32_t width, uint32_t height, int layout) {
+	size_t b = bkp_layout_block(layout);
+	size_t padded_w = (width + b - 1) / b * b;
+	size_t padded_h = (height + b - 1) / b * b;
+	return padded_w * padded_h * 4;
+}
+
+// Moves the low 8 bits of v to the even bit positions
+uint32_t bkp_morton_spread(uint32_t v) {
+	v = (v | (v << 4)) & 0x0F0F;
+	v = (v | (v << 2)) & 0x3333;
+	v = (v | (v << 1)) & 0x5555;
+	return v;
+}
+
+// Pixel index of (x, y) in an image of the given width stored in 'layout'
+size_t bkp_layout_index(uint32_t x, uint32_t y, uint32_t width, int layout) {
+	switch (layout) {
+		case BK_PNG_LAYOUT_TILED: {
+			size_t blocks_x = (width + 3) / 4;
+			return ((y >> 2) * blocks_x + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3);
 		}
-		bkp_expand_palette(filtered_pixels, ihdr.width * ihdr.height, &palette, raw_pixels);
-	} else if (ihdr.color_type == BK_PNG_GRAY) {
-		for (uint32_t i = 0; i < ihdr.width * ihdr.height; i++) {
-			unsigned char v = filtered_pixels[i];
-			raw_pixels[i*4+0] = v;
-			raw_pixels[i*4+1] = v;
-			raw_pixels[i*4+2] = v;
-			raw_pixels[i*4+3] = 255;
+		case BK_PNG_LAYOUT_MORTON: {
+			size_t tiles_x = (width + 31) / 32;
+			size_t inner = bkp_morton_spread(x & 31) | (bkp_morton_spread(y & 31) << 1);
+			return ((y >> 5) * tiles_x + (x >> 5)) * 1024 + inner;
 		}
-	} else if (ihdr.color_type == BK_PNG_GRAY_ALPHA) {
-		for (uint32_t i = 0; i < ihdr.width * ihdr.height; i++) {
-			raw_pixels[i*4+0] = filtered_pixels[i*2+0];
-			raw_pixels[i*4+1] = filtered_pixels[i*2+0];
-			raw_pixels[i*4+2] = filtered_pixels[i*2+0];
-			raw_pixels[i*4+3] = filtered_pixels[i*2+1];
+		default:
+			return (size_t)y * width + x;
+	}
+}
+
+// Scatters one row of RGBA pixels into an image stored in 'layout'
+void bkp_layout_store_row(const unsigned char* row, uint32_t y, uint32_t width, int layout, unsigned char* out) {
+	if (layout == BK_PNG_LAYOUT_TILED) {
+		// A block row is 4 contiguous pixels
+		for (uint32_t x = 0; x < width; x += 4) {
+			uint32_t n = width - x < 4 ? width - x : 4;
+			memcpy(out + bkp_layout_index(x, y, width, layout) * 4, row + x * 4, n * 4);
 		}
-	} else if (ihdr.color_type == BK_PNG_RGB) {
-		for (uint32_t i = 0; i < ihdr.width * ihdr.height; i++) {
-			raw_pixels[i*4+0] = filtered_pixels[i*3+0];
-			raw_pixels[i*4+1] = filtered_pixels[i*3+1];
-			raw_pixels[i*4+2] = filtered_pixels[i*3+2];
-			raw_pixels[i*4+3] = 255;
+	} else if (layout == BK_PNG_LAYOUT_MORTON) {
+		// Horizontal neighbours 2k and 2k+1 are adjacent in Z-order
+		for (uint32_t x = 0; x < width; x += 2) {
+			uint32_t n = width - x < 2 ? width - x : 2;
+			memcpy(out + bkp_layout_index(x, y, width, layout) * 4, row + x * 4, n * 4);
 		}
-	} else if (ihdr.color_type == BK_PNG_RGBA) {
-		memcpy(raw_pixels, filtered_pixels, ihdr.width * ihdr.height * 4);
 	} else {
-		free(filtered_pixels);
-		free(raw_pixels);
+		memcpy(out + (size_t)y * width * 4, row, (size_t)width * 4);
+	}
+}
+
+// Converts one unfiltered scanline of the given color type to RGBA
+int bkp_convert_row(const unsigned char* src, uint32_t width, int color_type, const bkp_palette* pal, unsigned char* out) {
+	switch (color_type) {
+		case BK_PNG_INDEXED:
+			bkp_expand_palette(src, width, pal, out);
+			break;
+		case BK_PNG_GRAY:
+			for (uint32_t i = 0; i < width; i++) {
+				unsigned char v = src[i];
+				out[i*4+0] = v;
+				out[i*4+1] = v;
+				out[i*4+2] = v;
+				out[i*4+3] = 255;
+			}
+			break;
+		case BK_PNG_GRAY_ALPHA:
+			for (uint32_t i = 0; i < width; i++) {
+				out[i*4+0] = src[i*2+0];
+				out[i*4+1] = src[i*2+0];
+				out[i*4+2] = src[i*2+0];
+				out[i*4+3] = src[i*2+1];
+			}
+			break;
+		case BK_PNG_RGB:
+			for (uint32_t i = 0; i < width; i++) {
+				out[i*4+0] = src[i*3+0];
+				out[i*4+1] = src[i*3+1];
+				out[i*4+2] = src[i*3+2];
+				out[i*4+3] = 255;
+			}
+			break;
+		case BK_PNG_RGBA:
+			memcpy(out, src, (size_t)width * 4);
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+// Receives decoded RGBA rows from bkp_decode_rows, top to bottom
+typedef struct {
+	// Returns where row y should be converted to (width * 4 bytes), or NULL to stop
+	unsigned char* (*begin_row)(void* user, const bkp_ihdr* ihdr, uint32_t y);
+	// Called once row y is written; may be NULL. Returns 0 to stop.
+	int (*end_row)(void* user, const bkp_ihdr* ihdr, uint32_t y, unsigned char* rgba);
+	void* user;
+	const bkp_lut* grade; // optional grading LUT, applied after color management
+	int raw;              // nonzero for data such as heights: no gamma or color management
+} bkp_row_sink;
+
+typedef struct {
+	int layout;
+	unsigned char* pixels;
+	unsigned char* row; // staging row for tiled layouts
+} bkp_layout_sink;
+
+unsigned char* bkp_layout_begin_row(void* user, const bkp_ihdr* ihdr, uint32_t y) {
+	bkp_layout_sink* s = user;
+	if (y == 0) {
+		// tiled layouts are zeroed so their padding is defined
+		size_t size = bkp_layout_size(ihdr->width, ihdr->height, s->layout);
+		if (s->layout == BK_PNG_LAYOUT_LINEAR) {
+			s->pixels = malloc(size);
+		} else {
+			s->pixels = calloc(1, size);
+			s->row = malloc((size_t)ihdr->width * 4);
+			if (!s->row) return NULL;
+		}
+		if (!s->pixels) return NULL;
+	}
+	return s->row ? s->row : s->pixels + (size_t)y * ihdr->width * 4;
+}
+
+int bkp_layout_end_row(void* user, const bkp_ihdr* ihdr, uint32_t y, unsigned char* rgba) {
+	bkp_layout_sink* s = user;
+	if (s->row) bkp_layout_store_row(rgba, y, ihdr->width, s->layout, s->pixels);
+	return 1;
+}
+
+// Decode profiling
+//
+// A bkp_profile attached to a bkp_decoder accumulates wall-clock time
+// and, where perf_event_open is available, hardware counters for each
+// stage of the decode. Counters that cannot be opened (no kernel support,
+// perf_event_paranoid, containers) are reported as unavailable and the
+// wall-clock times still work. Counters follow the thread that called
+// bkp_profile_begin, so decode on that thread. Each stage boundary costs
+// a clock read and a syscall, so profiled decodes run somewhat slower.
+
+#define BKP_STAGE_IO 0       // reading chunks from the file, including CRCs of non-IDAT chunks
+#define BKP_STAGE_CRC 1      // IDAT CRCs
+#define BKP_STAGE_INFLATE 2
+#define BKP_STAGE_UNFILTER 3
+#define BKP_STAGE_CONVERT 4  // to RGBA, plus color management and grading
+#define BKP_STAGE_COUNT 5
+
+#define BKP_COUNTER_CYCLES 0
+#define BKP_COUNTER_INSTRUCTIONS 1
+#define BKP_COUNTER_L1D_MISSES 2
+#define BKP_COUNTER_LLC_MISSES 3
+#define BKP_COUNTER_BRANCH_MISSES 4
+#define BKP_COUNTER_COUNT 5
+
+typedef struct {
+	uint64_t calls[BKP_STAGE_COUNT];
+	uint64_t ns[BKP_STAGE_COUNT];
+	uint64_t counters[BKP_STAGE_COUNT][BKP_COUNTER_COUNT];
+	int slot[BKP_COUNTER_COUNT]; // position in the group read, or -1 if unavailable
+	int fds[BKP_COUNTER_COUNT];
+	int n_open;
+} bkp_profile;
+
+typedef struct {
+	uint64_t ns;
+	uint64_t values[BKP_COUNTER_COUNT];
+} bkp_sample;
+
+uint64_t bkp_now_ns(void) {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC); // strict ISO C hides the POSIX clocks
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef __linux__
+// unistd.h declares it only with _DEFAULT_SOURCE or _GNU_SOURCE, which
+// strict ISO C builds lack; the loader itself needs neither
+long syscall(long number, ...);
+
+int bkp_perf_open(int counter, int group_fd) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	switch (counter) {
+		case BKP_COUNTER_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case BKP_COUNTER_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case BKP_COUNTER_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		case BKP_COUNTER_L1D_MISSES:
+		case BKP_COUNTER_LLC_MISSES:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = (counter == BKP_COUNTER_L1D_MISSES ? PERF_COUNT_HW_CACHE_L1D : PERF_COUNT_HW_CACHE_LL)
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+	}
+	attr.disabled = group_fd < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+void bkp_profile_end(bkp_profile* p) {
+	for (int c = 0; c < BKP_COUNTER_COUNT; c++) {
+#ifdef __linux__
+		if (p->fds[c] >= 0) close(p->fds[c]);
+#endif
+		p->fds[c] = -1;
+		p->slot[c] = -1;
+	}
+	p->n_open = 0;
+}
+
+// Clears the profile and, if 'hardware' is set, opens as many counters as
+// the system allows. Returns the number of counters available.
+int bkp_profile_begin(bkp_profile* p, int hardware) {
+	memset(p, 0, sizeof(*p));
+	for (int c = 0; c < BKP_COUNTER_COUNT; c++) {
+		p->fds[c] = -1;
+		p->slot[c] = -1;
+	}
+
+#ifdef __linux__
+	// One group, so all counters are read with a single syscall; the
+	// first one that opens leads it
+	int leader = -1;
+	for (int c = 0; hardware && c < BKP_COUNTER_COUNT; c++) {
+		int fd = bkp_perf_open(c, leader);
+		if (fd < 0) continue;
+		if (leader < 0) leader = fd;
+		p->fds[c] = fd;
+		p->slot[c] = p->n_open++;
+	}
+	if (leader >= 0) {
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+#else
+	(void)hardware;
+#endif
+	return p->n_open;
+}
+
+void bkp_profile_sample(const bkp_profile* p, bkp_sample* s) {
+	s->ns = bkp_now_ns();
+#ifdef __linux__
+	if (p->n_open) {
+		uint64_t buf[1 + BKP_COUNTER_COUNT] = {0};
+		int leader = -1;
+		for (int c = 0; c < BKP_COUNTER_COUNT && leader < 0; c++) leader = p->fds[c];
+		if (read(leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) memset(buf, 0, sizeof(buf));
+		for (int c = 0; c < BKP_COUNTER_COUNT; c++) s->values[c] = p->slot[c] >= 0 ? buf[1 + p->slot[c]] : 0;
+	}
+#endif
+}
+
+// Bracket a stage: bkp_stage_begin before it, bkp_stage_end after. Both
+// do nothing without a profile.
+void bkp_stage_begin(const bkp_profile* p, bkp_sample* s) {
+	if (p) bkp_profile_sample(p, s);
+}
+
+void bkp_stage_end(bkp_profile* p, int stage, const bkp_sample* start) {
+	if (!p) return;
+	bkp_sample now;
+	bkp_profile_sample(p, &now);
+	p->calls[stage]++;
+	p->ns[stage] += now.ns - start->ns;
+	for (int c = 0; c < BKP_COUNTER_COUNT; c++) p->counters[stage][c] += now.values[c] - start->values[c];
+}
+
+// Prints one line per stage: calls, milliseconds, then each counter
+// ("-" when unavailable) and instructions per cycle
+void bkp_profile_print(const bkp_profile* p, FILE* out) {
+	static const char* stages[BKP_STAGE_COUNT] = {"io", "crc", "inflate", "unfilter", "convert"};
+	static const char* counters[BKP_COUNTER_COUNT] = {"cycles", "instructions", "l1d-miss", "llc-miss", "branch-miss"};
+
+	fprintf(out, "%-9s %9s %10s", "stage", "calls", "ms");
+	for (int c = 0; c < BKP_COUNTER_COUNT; c++) fprintf(out, " %13s", counters[c]);
+	fprintf(out, " %6s\n", "ipc");
+
+	for (int s = 0; s < BKP_STAGE_COUNT; s++) {
+		fprintf(out, "%-9s %9llu %10.3f", stages[s], (unsigned long long)p->calls[s], p->ns[s] / 1e6);
+		for (int c = 0; c < BKP_COUNTER_COUNT; c++) {
+			if (p->slot[c] >= 0) fprintf(out, " %13llu", (unsigned long long)p->counters[s][c]);
+			else fprintf(out, " %13s", "-");
+		}
+		uint64_t cycles = p->counters[s][BKP_COUNTER_CYCLES];
+		if (p->slot[BKP_COUNTER_CYCLES] >= 0 && p->slot[BKP_COUNTER_INSTRUCTIONS] >= 0 && cycles) {
+			fprintf(out, " %6.2f\n", (double)p->counters[s][BKP_COUNTER_INSTRUCTIONS] / cycles);
+		} else {
+			fprintf(out, " %6s\n", "-");
+		}
+	}
+}
+
+// Resumable decoding
+//
+// A bkp_decoder holds everything an in-progress decode needs: the open
+// file, the inflate stream and two raw rows. bkp_decode_step advances it
+// one unit of work at a time (a chunk, a read of compressed data, or an
+// inflated, unfiltered and converted row) until the time budget is used,
+// so a large image can load over several frames on a single thread.
+
+#define BKP_STEP_ERROR -1
+#define BKP_STEP_MORE 0
+#define BKP_STEP_DONE 1
+
+#define BKP_DEC_HEADER 0 // signature and IHDR
+#define BKP_DEC_CHUNKS 1 // chunks before the first IDAT
+#define BKP_DEC_START 2  // color setup and buffers
+#define BKP_DEC_IDAT 3   // inflating rows
+#define BKP_DEC_DONE 4
+#define BKP_DEC_FAILED 5
+
+#define BKP_DEC_READ 16384 // compressed bytes read per unit of work
+
+typedef struct {
+	int state;
+	FILE* f;
+	bkp_row_sink sink;
+	bkp_layout_sink own;  // RGBA output when no sink is given
+	bkp_ihdr ihdr;        // valid after the first successful step
+
+	bkp_palette palette;
+	int have_plte;
+	float gamma;
+	bkp_color color;
+	bkp_lut* lut;
+	int lut_owned;
+	int has_color;
+
+	int bpp;
+	size_t row_bytes;     // filter byte + width * bpp
+	z_stream strm;
+	int strm_ready;
+	uint32_t chunk_left;  // unread bytes of the current IDAT
+	uint32_t chunk_crc;
+	unsigned char* in;    // BKP_DEC_READ bytes of compressed data
+	unsigned char* cur;   // raw row being inflated
+	unsigned char* prev;  // previous unfiltered row
+	size_t row_fill;
+	uint32_t y;           // rows finished
+	bkp_profile* profile; // optional, set after bkp_decoder_open
+} bkp_decoder;
+
+// Releases the file and inflate state; output pixels stay
+void bkp_decoder_release(bkp_decoder* dec) {
+	if (dec->f) fclose(dec->f);
+	dec->f = NULL;
+	if (dec->strm_ready) inflateEnd(&dec->strm);
+	dec->strm_ready = 0;
+	free(dec->in);
+	free(dec->cur);
+	free(dec->prev);
+	dec->in = dec->cur = dec->prev = NULL;
+	free(dec->color.icc);
+	dec->color.icc = NULL;
+	if (dec->lut_owned) bkp_lut_free(dec->lut);
+	dec->lut = NULL;
+	dec->lut_owned = 0;
+}
+
+// Starts decoding 'path' into 'sink', or into an RGBA buffer owned by the
+// decoder when 'sink' is NULL (see bkp_decoder_take). The decoder must not
+// move while in use. Only opens the file; the work happens in
+// bkp_decode_step. Returns 1 on success.
+int bkp_decoder_open(bkp_decoder* dec, const char* path, const bkp_row_sink* sink) {
+	memset(dec, 0, sizeof(*dec));
+	if (sink) {
+		dec->sink = *sink;
+	} else {
+		dec->own.layout = BK_PNG_LAYOUT_LINEAR;
+		dec->sink = (bkp_row_sink){bkp_layout_begin_row, bkp_layout_end_row, &dec->own, NULL, 0};
+	}
+
+	dec->f = fopen(path, "rb");
+	if (!dec->f) {
+		dec->state = BKP_DEC_FAILED;
+		return 0;
+	}
+	dec->state = BKP_DEC_HEADER;
+	return 1;
+}
+
+void bkp_decoder_close(bkp_decoder* dec) {
+	bkp_decoder_release(dec);
+	free(dec->own.pixels);
+	free(dec->own.row);
+	dec->own.pixels = dec->own.row = NULL;
+}
+
+// Hands over the RGBA pixels of a finished decode that was opened without
+// a sink; the caller frees them. Returns NULL if there are none.
+unsigned char* bkp_decoder_take(bkp_decoder* dec, uint32_t* out_width, uint32_t* out_height, int* out_color_type) {
+	if (dec->state != BKP_DEC_DONE || !dec->own.pixels) return NULL;
+	unsigned char* pixels = dec->own.pixels;
+	dec->own.pixels = NULL;
+	if (out_width) *out_width = dec->ihdr.width;
+	if (out_height) *out_height = dec->ihdr.height;
+	if (out_color_type) *out_color_type = dec->ihdr.color_type;
+	return pixels;
+}
+
+int bkp_dec_header(bkp_decoder* dec) {
+	unsigned char png_signature[8] = {137,80,78,71,13,10,26,10};
+	unsigned char signature_read[8];
+	if (fread(signature_read, 1, 8, dec->f) != 8) return 0;
+	if (memcmp(png_signature, signature_read, 8) != 0) return 0;
+	if (!bkp_read_ihdr(dec->f, &dec->ihdr)) return 0;
+
+	switch (dec->ihdr.color_type) {
+		case BK_PNG_GRAY: dec->bpp = 1; break;
+		case BK_PNG_GRAY_ALPHA: dec->bpp = 2; break;
+		case BK_PNG_RGB: dec->bpp = 3; break;
+		case BK_PNG_INDEXED: dec->bpp = 1; break;
+		case BK_PNG_RGBA: dec->bpp = 4; break;
+		default: return 0;
+	}
+	dec->state = BKP_DEC_CHUNKS;
+	return 1;
+}
+
+// Reads one chunk ahead of the image data
+int bkp_dec_chunk(bkp_decoder* dec) {
+	FILE* f = dec->f;
+	uint32_t length;
+	char type[5] = {0};
+	if (!bkp_read_chunk_header(f, &length, type)) return 0;
+
+	if (strcmp(type, "IDAT") == 0) {
+		dec->chunk_left = length;
+		dec->chunk_crc = bkp_crc32(0, (const unsigned char*)type, 4);
+		dec->state = BKP_DEC_START;
+		return 1;
+	} else if (strcmp(type, "PLTE") == 0) {
+		if (!bkp_read_plte(f, length, &dec->palette)) return 0;
+		dec->have_plte = 1;
+		return 1;
+	} else if (strcmp(type, "IEND") == 0) {
+		return 0; // no image data
+	} else if (strcmp(type, "gAMA") == 0) {
+		return bkp_read_gama(f, &dec->gamma, length);
+	} else if (strcmp(type, "tRNS") == 0) {
+		return bkp_read_trns(f, length, dec->ihdr.color_type, &dec->palette);
+	} else if (strcmp(type, "sRGB") == 0) {
+		return bkp_read_srgb(f, length, &dec->color);
+	} else if (strcmp(type, "cHRM") == 0) {
+		return bkp_read_chrm(f, length, &dec->color);
+	} else if (strcmp(type, "iCCP") == 0) {
+		return bkp_read_iccp(f, length, &dec->color);
+	}
+	return bkp_skip_and_verify_chunk(f, length, type, NULL);
+}
+
+int bkp_dec_start(bkp_decoder* dec) {
+	if (dec->ihdr.color_type == BK_PNG_INDEXED && !dec->have_plte) return 0;
+
+	// Gray images have no primaries, so cHRM means nothing to them, and
+	// they only take gray profiles (and color images only RGB ones)
+	bkp_color color = dec->color;
+	int gray = dec->ihdr.color_type == BK_PNG_GRAY || dec->ihdr.color_type == BK_PNG_GRAY_ALPHA;
+	if (gray) color.has_chrm = 0;
+	if (color.icc && (color.icc_size < 20 || memcmp(color.icc + 16, gray ? "GRAY" : "RGB ", 4) != 0)) color.icc = NULL;
+	if (dec->sink.raw) {
+		memset(&color, 0, sizeof(color));
+		dec->gamma = 0.0f;
+	}
+	dec->lut = bkp_color_lut(&color, dec->gamma, &dec->lut_owned);
+
+	// gAMA is replaced only by a table built from it or a profile, or by sRGB
+	dec->has_color = color.has_srgb || dec->lut;
+	free(dec->color.icc);
+	dec->color.icc = NULL;
+
+	dec->row_bytes = (size_t)dec->ihdr.width * dec->bpp + 1;
+	dec->in = malloc(BKP_DEC_READ);
+	dec->cur = malloc(dec->row_bytes);
+	dec->prev = malloc(dec->row_bytes);
+	if (!dec->in || !dec->cur || !dec->prev) return 0;
+
+	if (inflateInit(&dec->strm) != Z_OK) return 0;
+	dec->strm_ready = 1;
+	dec->state = BKP_DEC_IDAT;
+	return 1;
+}
+
+// Checks the CRC of the IDAT just consumed
+int bkp_dec_end_chunk(bkp_decoder* dec) {
+	bkp_sample t;
+	bkp_stage_begin(dec->profile, &t);
+	uint32_t crc_read;
+	int ok = bkp_read_be32(dec->f, &crc_read);
+	bkp_stage_end(dec->profile, BKP_STAGE_IO, &t);
+	return ok && crc_read == dec->chunk_crc;
+}
+
+// Feeds the next piece of compressed data to inflate. Image data may be
+// split across any number of consecutive IDAT chunks.
+int bkp_dec_read(bkp_decoder* dec) {
+	if (dec->chunk_left == 0) {
+		uint32_t length;
+		char type[5] = {0};
+		if (!bkp_dec_end_chunk(dec)) return 0;
+		bkp_sample t;
+		bkp_stage_begin(dec->profile, &t);
+		int ok = bkp_read_chunk_header(dec->f, &length, type);
+		bkp_stage_end(dec->profile, BKP_STAGE_IO, &t);
+		if (!ok || strcmp(type, "IDAT") != 0) return 0;
+		dec->chunk_left = length;
+		dec->chunk_crc = bkp_crc32(0, (const unsigned char*)type, 4);
+		return 1;
+	}
+
+	uint32_t n = dec->chunk_left < BKP_DEC_READ ? dec->chunk_left : BKP_DEC_READ;
+	bkp_sample t;
+	bkp_stage_begin(dec->profile, &t);
+	int ok = fread(dec->in, 1, n, dec->f) == n;
+	bkp_stage_end(dec->profile, BKP_STAGE_IO, &t);
+	if (!ok) return 0;
+
+	bkp_stage_begin(dec->profile, &t);
+	dec->chunk_crc = bkp_crc32(dec->chunk_crc, dec->in, n);
+	bkp_stage_end(dec->profile, BKP_STAGE_CRC, &t);
+	dec->chunk_left -= n;
+	dec->strm.next_in = dec->in;
+	dec->strm.avail_in = n;
+	return 1;
+}
+
+// Unfilters and converts the row just inflated and hands it to the sink
+int bkp_dec_row(bkp_decoder* dec) {
+	const bkp_ihdr* ihdr = &dec->ihdr;
+	const bkp_row_sink* sink = &dec->sink;
+	unsigned char* raw = dec->cur + 1;
+	bkp_sample t;
+	bkp_stage_begin(dec->profile, &t);
+	int ok = bkp_unfilter_row(dec->cur[0], raw, dec->y > 0 ? dec->prev + 1 : NULL, dec->row_bytes - 1, dec->bpp, raw);
+	bkp_stage_end(dec->profile, BKP_STAGE_UNFILTER, &t);
+	if (!ok) return 0;
+
+	unsigned char* dst = sink->begin_row(sink->user, ihdr, dec->y);
+	if (!dst) return 0;
+	bkp_stage_begin(dec->profile, &t);
+	bkp_convert_row(raw, ihdr->width, ihdr->color_type, &dec->palette, dst);
+	if (dec->lut) {
+		bkp_lut_apply(dec->lut, dst, ihdr->width);
+	} else if (dec->gamma > 0.0f && !dec->has_color) {
+		bkp_apply_gamma_correction(dst, ihdr->width, 1, dec->gamma);
+	}
+	if (sink->grade) bkp_lut_apply(sink->grade, dst, ihdr->width);
+	bkp_stage_end(dec->profile, BKP_STAGE_CONVERT, &t);
+	if (sink->end_row && !sink->end_row(sink->user, ihdr, dec->y, dst)) return 0;
+
+	unsigned char* done = dec->prev;
+	dec->prev = dec->cur;
+	dec->cur = done;
+	dec->row_fill = 0;
+	if (++dec->y < ihdr->height) return 1;
+
+	// Verify the rest of the last IDAT; later chunks carry nothing we use
+	while (dec->chunk_left > 0) {
+		dec->strm.avail_in = 0;
+		if (!bkp_dec_read(dec)) return 0;
+	}
+	if (!bkp_dec_end_chunk(dec)) return 0;
+	bkp_decoder_release(dec);
+	dec->state = BKP_DEC_DONE;
+	return 1;
+}
+
+int bkp_dec_inflate(bkp_decoder* dec) {
+	if (dec->strm.avail_in == 0) return bkp_dec_read(dec);
+
+	dec->strm.next_out = dec->cur + dec->row_fill;
+	dec->strm.avail_out = (uInt)(dec->row_bytes - dec->row_fill);
+	bkp_sample t;
+	bkp_stage_begin(dec->profile, &t);
+	int ret = inflate(&dec->strm, Z_NO_FLUSH);
+	bkp_stage_end(dec->profile, BKP_STAGE_INFLATE, &t);
+	if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return 0;
+	dec->row_fill = dec->row_bytes - dec->strm.avail_out;
+
+	if (dec->row_fill == dec->row_bytes) return bkp_dec_row(dec);
+	return ret != Z_STREAM_END; // the stream ended before the image did
+}
+
+// Chunk reads before the image data, timed as I/O
+int bkp_dec_io(bkp_decoder* dec, int (*fn)(bkp_decoder* dec)) {
+	bkp_sample t;
+	bkp_stage_begin(dec->profile, &t);
+	int ok = fn(dec);
+	bkp_stage_end(dec->profile, BKP_STAGE_IO, &t);
+	return ok;
+}
+
+// One unit of work
+int bkp_dec_advance(bkp_decoder* dec) {
+	switch (dec->state) {
+		case BKP_DEC_HEADER: return bkp_dec_io(dec, bkp_dec_header);
+		case BKP_DEC_CHUNKS: return bkp_dec_io(dec, bkp_dec_chunk);
+		case BKP_DEC_START: return bkp_dec_start(dec);
+		case BKP_DEC_IDAT: return bkp_dec_inflate(dec);
+		default: return 0;
+	}
+}
+
+uint64_t bkp_now_us(void) {
+	return bkp_now_ns() / 1000;
+}
+
+// Advances the decode until 'budget_us' microseconds have passed (0 runs
+// to the end), always doing at least one unit of work. Returns
+// BKP_STEP_MORE while unfinished, then BKP_STEP_DONE or BKP_STEP_ERROR.
+int bkp_decode_step(bkp_decoder* dec, uint32_t budget_us) {
+	uint64_t start = bkp_now_us();
+	for (;;) {
+		if (dec->state == BKP_DEC_DONE) return BKP_STEP_DONE;
+		if (dec->state == BKP_DEC_FAILED) return BKP_STEP_ERROR;
+		if (!bkp_dec_advance(dec)) {
+			bkp_decoder_release(dec);
+			dec->state = BKP_DEC_FAILED;
+			return BKP_STEP_ERROR;
+		}
+		if (budget_us && dec->state != BKP_DEC_DONE && bkp_now_us() - start >= budget_us) return BKP_STEP_MORE;
+	}
+}
+
+// Decodes a PNG and hands each converted row to 'sink' as soon as it is
+// ready, so callers can resize, re-layout or otherwise consume the image
+// without a full-size RGBA copy. Returns 1 on success.
+int bkp_decode_rows(const char* path, bkp_ihdr* out_ihdr, const bkp_row_sink* sink) {
+	bkp_decoder dec;
+	int ok = bkp_decoder_open(&dec, path, sink) && bkp_decode_step(&dec, 0) == BKP_STEP_DONE;
+	if (ok && out_ihdr) *out_ihdr = dec.ihdr;
+	bkp_decoder_close(&dec);
+	return ok;
+}
+
+unsigned char* bkp_load_png_layout(const char* path, uint32_t* out_width, uint32_t* out_height, int* out_color_type, int layout) {
+	bkp_layout_sink s = {layout, NULL, NULL};
+	bkp_row_sink sink = {bkp_layout_begin_row, bkp_layout_end_row, &s, NULL, 0};
+	bkp_ihdr ihdr;
+
+	int ok = bkp_decode_rows(path, &ihdr, &sink);
+	free(s.row);
+	if (!ok) {
+		free(s.pixels);
 		return NULL;
 	}
 
-	free(filtered_pixels);
+	if (out_width) *out_width = ihdr.width;
+	if (out_height) *out_height = ihdr.height;
+	if (out_color_type) *out_color_type = ihdr.color_type;
+
+	return s.pixels;
+}
+
+typedef struct {
+	unsigned char* dst;
+	size_t stride; // bytes
+	uint32_t max_width;
+	uint32_t max_height;
+} bkp_stride_sink;
+
+unsigned char* bkp_stride_begin_row(void* user, const bkp_ihdr* ihdr, uint32_t y) {
+	bkp_stride_sink* s = user;
+	if (ihdr->width > s->max_width || ihdr->height > s->max_height) return NULL;
+	return s->dst + (size_t)y * s->stride;
+}
+
+// Decodes into caller-owned RGBA memory with a row stride in bytes, e.g.
+// a sub-rectangle of an atlas. Fails without writing anything if the
+// image is larger than max_width x max_height.
+int bkp_load_png_into(const char* path, unsigned char* dst, size_t stride, uint32_t max_width, uint32_t max_height, bkp_ihdr* out_ihdr) {
+	bkp_stride_sink s = {dst, stride, max_width, max_height};
+	bkp_row_sink sink = {bkp_stride_begin_row, NULL, &s, NULL, 0};
+	return bkp_decode_rows(path, out_ihdr, &sink);
+}
+
+// Reads only the signature and IHDR, e.g. to size buffers before decoding
+int bkp_probe_png(const char* path, bkp_ihdr* out_ihdr) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	unsigned char png_signature[8] = {137,80,78,71,13,10,26,10};
+	unsigned char signature_read[8];
+	int ok = fread(signature_read, 1, 8, f) == 8
+		&& memcmp(png_signature, signature_read, 8) == 0
+		&& bkp_read_ihdr(f, out_ihdr);
+
+	fclose(f);
+	return ok;
+}
+
+// Like bkp_load_png, with a color grading LUT applied to every pixel
+unsigned char* bkp_load_png_graded(const char* path, uint32_t* out_width, uint32_t* out_height, int* out_color_type, const bkp_lut* grade) {
+	bkp_layout_sink s = {BK_PNG_LAYOUT_LINEAR, NULL, NULL};
+	bkp_row_sink sink = {bkp_layout_begin_row, bkp_layout_end_row, &s, grade, 0};
+	bkp_ihdr ihdr;
+
+	if (!bkp_decode_rows(path, &ihdr, &sink)) {
+		free(s.pixels);
+		return NULL;
+	}
 
 	if (out_width) *out_width = ihdr.width;
 	if (out_height) *out_height = ihdr.height;
 	if (out_color_type) *out_color_type = ihdr.color_type;
-	
-	if (gamma > 0.0f) {
-		bkp_apply_gamma_correction(raw_pixels, ihdr.width, ihdr.height, gamma);
+
+	return s.pixels;
+}
+
+unsigned char* bkp_load_png(const char* path, uint32_t* out_width, uint32_t* out_height, int* out_color_type) {
+	return bkp_load_png_layout(path, out_width, out_height, out_color_type, BK_PNG_LAYOUT_LINEAR);
+}
+
+// Like bkp_load_png, adding the time and counters of each stage to 'profile'
+unsigned char* bkp_load_png_profiled(const char* path, uint32_t* out_width, uint32_t* out_height, int* out_color_type, bkp_profile* profile) {
+	bkp_decoder dec;
+	unsigned char* pixels = NULL;
+	if (bkp_decoder_open(&dec, path, NULL)) {
+		dec.profile = profile;
+		if (bkp_decode_step(&dec, 0) == BKP_STEP_DONE) pixels = bkp_decoder_take(&dec, out_width, out_height, out_color_type);
+	}
+	bkp_decoder_close(&dec);
+	return pixels;
+}
+
+// Encoding
+//
+// bkp_encode_png writes 8-bit PNGs of any color type from pixels in that
+// type's own layout (1 byte gray or index, 2 gray + alpha, 3 RGB, 4 RGBA).
+// Indexed images get a PLTE chunk and, if any entry is not opaque, tRNS.
+// The steps are exposed separately so tools can pick filters or add chunks.
+
+#define BKP_FILTER_ADAPTIVE 5 // per row, the filter with the smallest sum of absolute values
+
+typedef struct {
+	int filter;                   // 0..4 for one filter on every row, or BKP_FILTER_ADAPTIVE
+	const unsigned char* filters; // optional filter per row (0..5), overrides 'filter'
+	int level;                    // zlib level, 0..9
+	int strategy;                 // zlib strategy, e.g. Z_DEFAULT_STRATEGY or Z_FILTERED
+} bkp_encode_options;
+
+int bkp_bytes_per_pixel(int color_type) {
+	switch (color_type) {
+		case BK_PNG_GRAY: return 1;
+		case BK_PNG_GRAY_ALPHA: return 2;
+		case BK_PNG_RGB: return 3;
+		case BK_PNG_INDEXED: return 1;
+		case BK_PNG_RGBA: return 4;
+		default: return 0;
+	}
+}
+
+int bkp_buffer_append(bkp_buffer* buf, const void* data, size_t size) {
+	if (size == 0) return 1;
+	unsigned char* grown = realloc(buf->data, buf->size + size);
+	if (!grown) return 0;
+	buf->data = grown;
+	memcpy(buf->data + buf->size, data, size);
+	buf->size += size;
+	return 1;
+}
+
+void bkp_put_be32(unsigned char* p, uint32_t v) {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+int bkp_write_chunk(bkp_buffer* buf, const char* type, const unsigned char* data, uint32_t length) {
+	unsigned char head[8], tail[4];
+	bkp_put_be32(head, length);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = bkp_crc32(0, (const unsigned char*)type, 4);
+	crc = bkp_crc32(crc, data, length);
+	bkp_put_be32(tail, crc);
+	return bkp_buffer_append(buf, head, 8) && bkp_buffer_append(buf, data, length) && bkp_buffer_append(buf, tail, 4);
+}
+
+// Applies filter type 'filter' to one row of 'len' bytes; prev is NULL for the first row
+void bkp_filter_row(int filter, const unsigned char* row, const unsigned char* prev, size_t len, int bpp, unsigned char* out) {
+	for (size_t i = 0; i < len; i++) {
+		int left = i >= (size_t)bpp ? row[i - bpp] : 0;
+		int up = prev ? prev[i] : 0;
+		int up_left = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+		int pred;
+		switch (filter) {
+			case 1: pred = left; break;
+			case 2: pred = up; break;
+			case 3: pred = (left + up) >> 1; break;
+			case 4: pred = bkp_paeth_predictor(left, up, up_left); break;
+			default: pred = 0; break;
+		}
+		out[i] = (unsigned char)(row[i] - pred);
 	}
+}
+
+// Sum of the filtered bytes read as signed values, the usual estimate of
+// how well a row will compress
+size_t bkp_filter_cost(const unsigned char* filtered, size_t len) {
+	size_t sum = 0;
+	for (size_t i = 0; i < len; i++) sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+	return sum;
+}
+
+// Builds the filtered scanlines (filter byte + row) that go into IDAT.
+// Returns a malloc'd buffer of (width * bpp + 1) * height bytes.
+unsigned char* bkp_filter_image(const unsigned char* pixels, uint32_t width, uint32_t height, size_t stride, int bpp,
+	const bkp_encode_options* opt) {
+	size_t len = (size_t)width * bpp;
+	unsigned char* out = malloc((len + 1) * height);
+	unsigned char* trial = malloc(len);
+	if (!out || !trial) {
+		free(out);
+		free(trial);
+		return NULL;
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = pixels + y * stride;
+		const unsigned char* prev = y > 0 ? row - stride : NULL;
+		unsigned char* dst = out + y * (len + 1);
+
+		int filter = opt->filters ? opt->filters[y] : opt->filter;
+		if (filter == BKP_FILTER_ADAPTIVE) {
+			size_t best = (size_t)-1;
+			for (int f = 0; f < 5; f++) {
+				bkp_filter_row(f, row, prev, len, bpp, trial);
+				size_t cost = bkp_filter_cost(trial, len);
+				if (cost < best) {
+					best = cost;
+					filter = f;
+					memcpy(dst + 1, trial, len);
+				}
+			}
+		} else {
+			bkp_filter_row(filter, row, prev, len, bpp, dst + 1);
+		}
+		dst[0] = (unsigned char)filter;
+	}
+
+	free(trial);
+	return out;
+}
+
+int bkp_deflate(const unsigned char* data, size_t size, int level, int strategy, bkp_buffer* out) {
+	z_stream strm = {0};
+	if (deflateInit2(&strm, level, Z_DEFLATED, 15, 9, strategy) != Z_OK) return 0;
+
+	size_t bound = deflateBound(&strm, size);
+	unsigned char* buf = malloc(bound);
+	if (!buf) {
+		deflateEnd(&strm);
+		return 0;
+	}
+
+	strm.next_in = (unsigned char*)data;
+	strm.next_out = buf;
+	size_t in_left = size, out_left = bound;
+	int ret;
+	// avail_in and avail_out are 32-bit, so larger images go in pieces
+	do {
+		if (strm.avail_in == 0) {
+			strm.avail_in = in_left < UINT_MAX ? (uInt)in_left : UINT_MAX;
+			in_left -= strm.avail_in;
+		}
+		if (strm.avail_out == 0) {
+			strm.avail_out = out_left < UINT_MAX ? (uInt)out_left : UINT_MAX;
+			out_left -= strm.avail_out;
+		}
+		ret = deflate(&strm, in_left ? Z_NO_FLUSH : Z_FINISH);
+	} while (ret == Z_OK);
+	size_t written = strm.total_out;
+	deflateEnd(&strm);
+
+	if (ret != Z_STREAM_END) {
+		free(buf);
+		return 0;
+	}
+	out->data = buf;
+	out->size = written;
+	return 1;
+}
+
+// Writes the signature and IHDR
+int bkp_write_header(bkp_buffer* buf, uint32_t width, uint32_t height, int color_type) {
+	static const unsigned char signature[8] = {137,80,78,71,13,10,26,10};
+	unsigned char ihdr[13];
+	bkp_put_be32(ihdr, width);
+	bkp_put_be32(ihdr + 4, height);
+	ihdr[8] = 8;
+	ihdr[9] = (unsigned char)color_type;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	return bkp_buffer_append(buf, signature, 8) && bkp_write_chunk(buf, "IHDR", ihdr, 13);
+}
+
+// Writes PLTE and, when needed, tRNS with trailing opaque entries trimmed
+int bkp_write_palette(bkp_buffer* buf, const bkp_palette* pal) {
+	if (pal->size == 0 || pal->size > 256) return 0;
+
+	unsigned char rgb[256 * 3], alpha[256];
+	size_t n_alpha = 0;
+	for (size_t i = 0; i < pal->size; i++) {
+		memcpy(rgb + i * 3, pal->palette[i], 3);
+		alpha[i] = pal->palette[i][3];
+		if (alpha[i] != 255) n_alpha = i + 1;
+	}
+	if (!bkp_write_chunk(buf, "PLTE", rgb, pal->size * 3)) return 0;
+	return n_alpha == 0 || bkp_write_chunk(buf, "tRNS", alpha, n_alpha);
+}
 
-	return raw_pixels;
+// Encodes a PNG into 'out' (which the caller frees). 'stride' is in bytes;
+// 'pal' is only used for BK_PNG_INDEXED; 'opt' may be NULL for adaptive
+// filtering at zlib level 6. Returns 1 on success, 0 on failure or a
+// filter outside 0..5.
+int bkp_encode_png(const unsigned char* pixels, uint32_t width, uint32_t height, size_t stride, int color_type,
+	const bkp_palette* pal, const bkp_encode_options* opt, bkp_buffer* out) {
+	static const bkp_encode_options defaults = {BKP_FILTER_ADAPTIVE, NULL, 6, Z_DEFAULT_STRATEGY};
+	if (!opt) opt = &defaults;
+	memset(out, 0, sizeof(*out));
+
+	int bpp = bkp_bytes_per_pixel(color_type);
+	if (!bpp || width == 0 || height == 0) return 0;
+	if (color_type == BK_PNG_INDEXED && !pal) return 0;
+	if (opt->filters) {
+		for (uint32_t y = 0; y < height; y++) if (opt->filters[y] > BKP_FILTER_ADAPTIVE) return 0;
+	} else if (opt->filter < 0 || opt->filter > BKP_FILTER_ADAPTIVE) {
+		return 0;
+	}
+
+	unsigned char* raw = bkp_filter_image(pixels, width, height, stride, bpp, opt);
+	if (!raw) return 0;
+
+	bkp_buffer idat = {0};
+	int ok = bkp_deflate(raw, ((size_t)width * bpp + 1) * height, opt->level, opt->strategy, &idat);
+	free(raw);
+
+	ok = ok && bkp_write_header(out, width, height, color_type);
+	if (ok && color_type == BK_PNG_INDEXED) ok = bkp_write_palette(out, pal);
+	ok = ok && bkp_write_chunk(out, "IDAT", idat.data, idat.size);
+	ok = ok && bkp_write_chunk(out, "IEND", NULL, 0);
+	free(idat.data);
+
+	if (!ok) {
+		free(out->data);
+		memset(out, 0, sizeof(*out));
+	}
+	return ok;
+}
+
+int bkp_write_png(const char* path, const unsigned char* pixels, uint32_t width, uint32_t height, size_t stride,
+	int color_type, const bkp_palette* pal) {
+	bkp_buffer png;
+	if (!bkp_encode_png(pixels, width, height, stride, color_type, pal, NULL, &png)) return 0;
+
+	FILE* f = fopen(path, "wb");
+	int ok = f && fwrite(png.data, 1, png.size, f) == png.size;
+	if (f && fclose(f) != 0) ok = 0;
+	free(png.data);
+	return ok;
 }
 
 #endif
\ No newline at end of file
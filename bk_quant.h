@@ -0,0 +1,350 @@
+/*
+bk_quant.h - Palette quantization for the Brickate project
+
+This header reduces RGBA8 images (from bkp_load_png or a renderer) to at
+most 256 colors, so they can be written as indexed PNGs with
+bkp_encode_png and decoded through the cheap palette path.
+
+Steps:
+  - Images with few enough distinct colors keep them exactly
+  - Otherwise colors are counted in a 5-bit-per-channel histogram, split
+    by median cut on the widest channel of the most populous boxes, and
+    refined by a few rounds of k-means over the histogram
+  - Each pixel is mapped to its nearest palette entry, comparing against
+    8 entries per iteration (bk_simd), with a small cache for repeated
+    colors, and optionally Floyd-Steinberg dithering of RGB
+
+Alpha is quantized like the other channels but never dithered.
+*/
+
+#ifndef BK_QUANT_H
+#define BK_QUANT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+#include "bk_png.h"
+#include "bk_simd.h"
+
+BK_SIMD_BEGIN
+
+#define BKQ_BITS 5
+#define BKQ_BUCKETS (1 << (BKQ_BITS * 4))
+#define BKQ_KMEANS_ROUNDS 3
+#define BKQ_CACHE 4096
+
+typedef struct {
+	uint32_t count;
+	float c[4]; // mean color of the pixels in this histogram bucket
+	float key;  // scratch: sort key
+} bkq_entry;
+
+typedef struct {
+	int start, end; // entry range
+	uint32_t count;
+} bkq_box;
+
+// Palette in structure-of-arrays form, padded to a multiple of 8 with
+// entries too far away to ever be picked
+typedef struct {
+	int n;
+	float r[256], g[256], b[256], a[256];
+} bkq_soa;
+
+void bkq_soa_init(bkq_soa* s, const bkp_palette* pal) {
+	s->n = ((int)pal->size + 7) & ~7;
+	for (int i = 0; i < s->n; i++) {
+		int valid = i < (int)pal->size;
+		s->r[i] = valid ? pal->palette[i][0] : 1e9f;
+		s->g[i] = valid ? pal->palette[i][1] : 1e9f;
+		s->b[i] = valid ? pal->palette[i][2] : 1e9f;
+		s->a[i] = valid ? pal->palette[i][3] : 1e9f;
+	}
+}
+
+// Plain vector operators rather than the bk_simd helpers, which would
+// trip GCC's -Wpsabi in every tool built on this header (see bk_simd.h)
+int bkq_nearest(const bkq_soa* s, float r, float g, float b, float a) {
+	bk_f32x8 best = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+	bk_i32x8 best_i = {0};
+	const bk_i32x8 lane = {0, 1, 2, 3, 4, 5, 6, 7};
+	for (int i = 0; i < s->n; i += 8) {
+		bk_f32x8 dr, dg, db, da;
+		memcpy(&dr, s->r + i, sizeof(dr));
+		memcpy(&dg, s->g + i, sizeof(dg));
+		memcpy(&db, s->b + i, sizeof(db));
+		memcpy(&da, s->a + i, sizeof(da));
+		dr -= r;
+		dg -= g;
+		db -= b;
+		da -= a;
+		bk_f32x8 d = dr * dr + dg * dg + db * db + da * da;
+		bk_i32x8 closer = d < best;
+		best = (bk_f32x8)(((bk_i32x8)d & closer) | ((bk_i32x8)best & ~closer));
+		best_i = ((lane + i) & closer) | (best_i & ~closer);
+	}
+
+	int idx = best_i[0];
+	float d = best[0];
+	for (int l = 1; l < 8; l++) {
+		if (best[l] < d || (best[l] == d && best_i[l] < idx)) {
+			d = best[l];
+			idx = best_i[l];
+		}
+	}
+	return idx;
+}
+
+uint32_t bkq_hash(uint32_t c) {
+	c ^= c >> 16;
+	c *= 0x7FEB352D;
+	c ^= c >> 15;
+	return c;
+}
+
+// Collects up to max_colors distinct colors; returns 0 if there are more
+int bkq_exact_palette(const unsigned char* rgba, uint32_t width, uint32_t height, size_t stride, int max_colors, bkp_palette* pal) {
+	// Open addressing; 1024 slots stay sparse for up to 256 colors
+	uint32_t slots[1024];
+	unsigned char used[1024] = {0};
+	pal->size = 0;
+
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = rgba + y * stride;
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t c;
+			memcpy(&c, row + x * 4, 4);
+			uint32_t h = bkq_hash(c) & 1023;
+			while (used[h] && slots[h] != c) h = (h + 1) & 1023;
+			if (used[h]) continue;
+			if ((int)pal->size == max_colors) return 0;
+			used[h] = 1;
+			slots[h] = c;
+			memcpy(pal->palette[pal->size++], &c, 4);
+		}
+	}
+	return 1;
+}
+
+int bkq_entry_cmp(const void* a, const void* b) {
+	float ka = ((const bkq_entry*)a)->key, kb = ((const bkq_entry*)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+// Splits the box holding the most pixels (that can still be split) along
+// its widest channel at the pixel-weighted median. Returns 0 when no box
+// can be split.
+int bkq_split(bkq_entry* e, bkq_box* boxes, int n_boxes) {
+	int best = -1;
+	for (int i = 0; i < n_boxes; i++) {
+		if (boxes[i].end - boxes[i].start < 2) continue;
+		if (best < 0 || boxes[i].count > boxes[best].count) best = i;
+	}
+	if (best < 0) return 0;
+
+	bkq_box* box = &boxes[best];
+	float lo[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX}, hi[4] = {-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for (int i = box->start; i < box->end; i++) {
+		for (int c = 0; c < 4; c++) {
+			if (e[i].c[c] < lo[c]) lo[c] = e[i].c[c];
+			if (e[i].c[c] > hi[c]) hi[c] = e[i].c[c];
+		}
+	}
+	int axis = 0;
+	for (int c = 1; c < 4; c++) {
+		if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+	}
+
+	for (int i = box->start; i < box->end; i++) e[i].key = e[i].c[axis];
+	qsort(e + box->start, box->end - box->start, sizeof(bkq_entry), bkq_entry_cmp);
+
+	uint32_t half = box->count / 2, sum = 0;
+	int mid = box->start + 1;
+	for (int i = box->start; i < box->end - 1; i++) {
+		sum += e[i].count;
+		mid = i + 1;
+		if (sum >= half) break;
+	}
+
+	bkq_box right = {mid, box->end, box->count - sum};
+	box->end = mid;
+	box->count = sum;
+	boxes[n_boxes] = right;
+	return 1;
+}
+
+// Builds a palette of at most max_colors (2..256) entries for the image.
+// 'stride' is in bytes. Returns 1 on success.
+int bkq_build_palette(const unsigned char* rgba, uint32_t width, uint32_t height, size_t stride, int max_colors, bkp_palette* pal) {
+	if (max_colors < 2 || max_colors > 256 || width == 0 || height == 0) return 0;
+	if (bkq_exact_palette(rgba, width, height, stride, max_colors, pal)) return 1;
+
+	const int shift = 8 - BKQ_BITS;
+	int32_t* slot = malloc(BKQ_BUCKETS * sizeof(int32_t));
+	if (!slot) return 0;
+	memset(slot, 0xFF, BKQ_BUCKETS * sizeof(int32_t));
+
+	// First pass finds the used buckets, the second averages their colors
+	int n = 0;
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = rgba + y * stride;
+		for (uint32_t x = 0; x < width; x++) {
+			const unsigned char* p = row + x * 4;
+			uint32_t k = (p[0] >> shift) | (p[1] >> shift) << BKQ_BITS | (p[2] >> shift) << (BKQ_BITS * 2) | (p[3] >> shift) << (BKQ_BITS * 3);
+			if (slot[k] < 0) slot[k] = n++;
+		}
+	}
+
+	bkq_entry* e = calloc(n, sizeof(bkq_entry));
+	bkq_box* boxes = malloc(max_colors * sizeof(bkq_box));
+	double* sums = calloc((size_t)n * 4, sizeof(double));
+	if (!e || !boxes || !sums) {
+		free(slot);
+		free(e);
+		free(boxes);
+		free(sums);
+		return 0;
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = rgba + y * stride;
+		for (uint32_t x = 0; x < width; x++) {
+			const unsigned char* p = row + x * 4;
+			uint32_t k = (p[0] >> shift) | (p[1] >> shift) << BKQ_BITS | (p[2] >> shift) << (BKQ_BITS * 2) | (p[3] >> shift) << (BKQ_BITS * 3);
+			int i = slot[k];
+			e[i].count++;
+			for (int c = 0; c < 4; c++) sums[i * 4 + c] += p[c];
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		for (int c = 0; c < 4; c++) e[i].c[c] = (float)(sums[i * 4 + c] / e[i].count);
+	}
+	free(slot);
+
+	boxes[0] = (bkq_box){0, n, width * height};
+	int n_boxes = 1;
+	while (n_boxes < max_colors && bkq_split(e, boxes, n_boxes)) n_boxes++;
+
+	float means[256][4];
+	for (int b = 0; b < n_boxes; b++) {
+		double s[4] = {0};
+		for (int i = boxes[b].start; i < boxes[b].end; i++) {
+			for (int c = 0; c < 4; c++) s[c] += (double)e[i].c[c] * e[i].count;
+		}
+		for (int c = 0; c < 4; c++) means[b][c] = (float)(s[c] / boxes[b].count);
+	}
+
+	// k-means over the histogram, each bucket weighted by its pixel count
+	bkq_soa soa;
+	pal->size = n_boxes;
+	for (int round = 0; round <= BKQ_KMEANS_ROUNDS; round++) {
+		for (int b = 0; b < n_boxes; b++) {
+			for (int c = 0; c < 4; c++) {
+				float v = means[b][c] + 0.5f;
+				pal->palette[b][c] = (unsigned char)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+			}
+		}
+		if (round == BKQ_KMEANS_ROUNDS) break;
+
+		bkq_soa_init(&soa, pal);
+		double acc[256][5];
+		memset(acc, 0, sizeof(acc));
+		for (int i = 0; i < n; i++) {
+			int k = bkq_nearest(&soa, e[i].c[0], e[i].c[1], e[i].c[2], e[i].c[3]);
+			for (int c = 0; c < 4; c++) acc[k][c] += (double)e[i].c[c] * e[i].count;
+			acc[k][4] += e[i].count;
+		}
+		for (int b = 0; b < n_boxes; b++) {
+			if (acc[b][4] == 0.0) continue;
+			for (int c = 0; c < 4; c++) means[b][c] = (float)(acc[b][c] / acc[b][4]);
+		}
+	}
+
+	free(e);
+	free(boxes);
+	free(sums);
+	return 1;
+}
+
+// Maps every pixel to a palette index ('out_stride' bytes per row).
+// With 'dither', RGB quantization error is diffused Floyd-Steinberg style.
+int bkq_map(const unsigned char* rgba, uint32_t width, uint32_t height, size_t stride, const bkp_palette* pal,
+	int dither, unsigned char* out, size_t out_stride) {
+	bkq_soa soa;
+	bkq_soa_init(&soa, pal);
+
+	uint32_t cache_key[BKQ_CACHE];
+	int16_t cache_index[BKQ_CACHE];
+	memset(cache_index, 0xFF, sizeof(cache_index));
+
+	// Error rows in 1/16 units, with a guard pixel at each end
+	int* err = NULL;
+	if (dither) {
+		err = calloc((size_t)(width + 2) * 3 * 2, sizeof(int));
+		if (!err) return 0;
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = rgba + y * stride;
+		unsigned char* dst = out + y * out_stride;
+		int* cur = err ? err + ((y & 1) ? (width + 2) * 3 : 0) + 3 : NULL;
+		int* next = err ? err + ((y & 1) ? 0 : (width + 2) * 3) + 3 : NULL;
+		if (next) memset(next - 3, 0, (width + 2) * 3 * sizeof(int));
+
+		for (uint32_t x = 0; x < width; x++) {
+			unsigned char c[4];
+			memcpy(c, row + x * 4, 4);
+			if (cur) {
+				for (int k = 0; k < 3; k++) {
+					int v = c[k] + (cur[x * 3 + k] + (cur[x * 3 + k] >= 0 ? 8 : -8)) / 16;
+					c[k] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+				}
+			}
+
+			uint32_t key;
+			memcpy(&key, c, 4);
+			uint32_t h = bkq_hash(key) & (BKQ_CACHE - 1);
+			int idx;
+			if (cache_index[h] >= 0 && cache_key[h] == key) {
+				idx = cache_index[h];
+			} else {
+				idx = bkq_nearest(&soa, c[0], c[1], c[2], c[3]);
+				cache_key[h] = key;
+				cache_index[h] = (int16_t)idx;
+			}
+			dst[x] = (unsigned char)idx;
+
+			if (cur) {
+				for (int k = 0; k < 3; k++) {
+					int e = c[k] - pal->palette[idx][k];
+					cur[(x + 1) * 3 + k] += e * 7;
+					next[((int)x - 1) * 3 + k] += e * 3;
+					next[x * 3 + k] += e * 5;
+					next[(x + 1) * 3 + k] += e;
+				}
+			}
+		}
+	}
+
+	free(err);
+	return 1;
+}
+
+// Writes an RGBA image as an indexed PNG with at most max_colors colors
+int bkq_write_png(const char* path, const unsigned char* rgba, uint32_t width, uint32_t height, size_t stride,
+	int max_colors, int dither) {
+	bkp_palette pal;
+	unsigned char* indices = malloc((size_t)width * height);
+	int ok = indices
+		&& bkq_build_palette(rgba, width, height, stride, max_colors, &pal)
+		&& bkq_map(rgba, width, height, stride, &pal, dither, indices, width)
+		&& bkp_write_png(path, indices, width, height, width, BK_PNG_INDEXED, &pal);
+	free(indices);
+	return ok;
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,199 @@
+/*
+bk_rand.h - Vectorized random numbers for the Brickate project
+
+This header generates pseudo-random numbers 8 at a time, for procedural
+generation, particles and Monte Carlo sampling, as a replacement for
+rand(): no hidden global state or lock, and much better statistics.
+
+Includes functions for:
+  - Seeding independent streams (one per thread or per job) from a
+    64-bit seed and a stream number (splitmix64)
+  - xoshiro128+ on 8 lanes (bk_simd), usable directly in vector loops
+    through bkrng_load, bkrng_next8 and bkrng_save
+  - Single draws, buffered 8 at a time, for scalar call sites
+  - Filling arrays with uniform floats in [0, 1) or a range, and with
+    integers in a range
+  - Filling vec3 arrays with unit vectors uniform on the sphere and with
+    points uniform in a box
+
+Floats are made from the top 24 bits of each output, which are the
+strongest bits of xoshiro128+. A state must only be used by one thread
+at a time.
+*/
+
+#ifndef BK_RAND_H
+#define BK_RAND_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bk_math.h"
+#include "bk_simd.h"
+
+BK_SIMD_BEGIN
+
+typedef struct {
+	uint32_t s[4][8];  // xoshiro128+ state: word k of lane i is s[k][i]
+	uint32_t buf[8];   // outputs not yet returned by bkrng_u32
+	int buffered;
+} bkrng_state;
+
+// The state in registers, for loops that draw many vectors
+typedef struct {
+	bk_u32x8 s[4];
+} bkrng_lanes;
+
+uint64_t bkrng_splitmix64(uint64_t* x) {
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Seeds stream number 'stream' of 'seed'. Different streams of one seed
+// are independent for all practical purposes.
+void bkrng_seed(bkrng_state* r, uint64_t seed, uint64_t stream) {
+	uint64_t x = seed ^ bkrng_splitmix64(&stream);
+	for (int i = 0; i < 8; i++) {
+		for (int k = 0; k < 4; k += 2) {
+			uint64_t z = bkrng_splitmix64(&x);
+			r->s[k][i] = (uint32_t)z;
+			r->s[k + 1][i] = (uint32_t)(z >> 32);
+		}
+		// The all-zero state never leaves zero
+		if (!(r->s[0][i] | r->s[1][i] | r->s[2][i] | r->s[3][i])) r->s[0][i] = 1;
+	}
+	r->buffered = 0;
+}
+
+BK_SIMD_INLINE bkrng_lanes bkrng_load(const bkrng_state* r) {
+	bkrng_lanes l;
+	for (int k = 0; k < 4; k++) l.s[k] = bk_u32x8_load(r->s[k]);
+	return l;
+}
+
+static inline void bkrng_save(bkrng_state* r, const bkrng_lanes* l) {
+	for (int k = 0; k < 4; k++) bk_u32x8_store(r->s[k], l->s[k]);
+}
+
+// Next 32 random bits in every lane (xoshiro128+)
+BK_SIMD_INLINE bk_u32x8 bkrng_next8(bkrng_lanes* l) {
+	bk_u32x8 s0 = l->s[0], s1 = l->s[1], s2 = l->s[2], s3 = l->s[3];
+	bk_u32x8 result = s0 + s3;
+	bk_u32x8 t = s1 << 9;
+	s2 ^= s0;
+	s3 ^= s1;
+	s1 ^= s2;
+	s0 ^= s3;
+	s2 ^= t;
+	s3 = (s3 << 11) | (s3 >> 21);
+	l->s[0] = s0;
+	l->s[1] = s1;
+	l->s[2] = s2;
+	l->s[3] = s3;
+	return result;
+}
+
+// Uniform in [0, 1)
+BK_SIMD_INLINE bk_f32x8 bkrng_float8(bkrng_lanes* l) {
+	return bk_i32x8_to_f32((bk_i32x8)(bkrng_next8(l) >> 8)) * bk_f32x8_splat(1.0f / 16777216.0f);
+}
+
+// Uniform in [lo, hi)
+BK_SIMD_INLINE bk_f32x8 bkrng_range8(bkrng_lanes* l, float lo, float hi) {
+	return bk_f32x8_splat(lo) + bkrng_float8(l) * (hi - lo);
+}
+
+uint32_t bkrng_u32(bkrng_state* r) {
+	if (!r->buffered) {
+		bkrng_lanes l = bkrng_load(r);
+		bk_u32x8_store(r->buf, bkrng_next8(&l));
+		bkrng_save(r, &l);
+		r->buffered = 8;
+	}
+	return r->buf[--r->buffered];
+}
+
+// Uniform in [0, 1)
+float bkrng_float(bkrng_state* r) {
+	return (bkrng_u32(r) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Fills out[0..n) with floats uniform in [lo, hi)
+void bkrng_range(bkrng_state* r, float* out, size_t n, float lo, float hi) {
+	bkrng_lanes l = bkrng_load(r);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) bk_f32x8_store(out + i, bkrng_range8(&l, lo, hi));
+	if (i < n) {
+		float tail[8];
+		bk_f32x8_store(tail, bkrng_range8(&l, lo, hi));
+		memcpy(out + i, tail, (n - i) * sizeof(float));
+	}
+	bkrng_save(r, &l);
+}
+
+// Fills out[0..n) with floats uniform in [0, 1)
+void bkrng_uniform(bkrng_state* r, float* out, size_t n) {
+	bkrng_range(r, out, n, 0.0f, 1.0f);
+}
+
+// Fills out[0..n) with integers uniform in [lo, hi], for ranges of up to
+// 2^24 values (drawn through a float, without modulo bias)
+void bkrng_int_range(bkrng_state* r, int32_t* out, size_t n, int32_t lo, int32_t hi) {
+	bkrng_lanes l = bkrng_load(r);
+	float span = (float)((int64_t)hi - lo + 1);
+	for (size_t i = 0; i < n; i += 8) {
+		bk_i32x8 v = bk_i32x8_splat(lo) + bk_f32x8_to_i32(bkrng_float8(&l) * span);
+		// Rounding can land on span itself for very wide ranges
+		v = bk_i32x8_min(v, bk_i32x8_splat(hi));
+		if (n - i >= 8) bk_i32x8_store(out + i, v);
+		else memcpy(out + i, &v, (n - i) * sizeof(int32_t));
+	}
+	bkrng_save(r, &l);
+}
+
+// Fills out[0..n) with points uniform in the box [min, max)
+void bkrng_in_box(bkrng_state* r, vec3* out, size_t n, const vec3 min, const vec3 max) {
+	bkrng_lanes l = bkrng_load(r);
+	for (size_t i = 0; i < n; i += 8) {
+		bk_f32x8 c[3];
+		for (int k = 0; k < 3; k++) c[k] = bkrng_range8(&l, min[k], max[k]);
+		size_t m = n - i < 8 ? n - i : 8;
+		for (size_t j = 0; j < m; j++) {
+			for (int k = 0; k < 3; k++) out[i + j][k] = c[k][j];
+		}
+	}
+	bkrng_save(r, &l);
+}
+
+// Fills out[0..n) with unit vectors uniform on the sphere. Points are
+// drawn in the cube and the ones inside the ball (about half) projected
+// onto the sphere, which needs no trigonometry.
+void bkrng_on_sphere(bkrng_state* r, vec3* out, size_t n) {
+	bkrng_lanes l = bkrng_load(r);
+	size_t i = 0;
+	while (i < n) {
+		bk_f32x8 x = bkrng_range8(&l, -1.0f, 1.0f);
+		bk_f32x8 y = bkrng_range8(&l, -1.0f, 1.0f);
+		bk_f32x8 z = bkrng_range8(&l, -1.0f, 1.0f);
+		bk_f32x8 d2 = x * x + y * y + z * z;
+		// Points too close to the center have no reliable direction
+		int mask = bk_i32x8_movemask((d2 <= 1.0f) & (d2 > 1e-6f));
+		bk_f32x8 inv = 1.0f / bk_f32x8_sqrt(d2);
+		float c[3][8];
+		bk_f32x8_store(c[0], x * inv);
+		bk_f32x8_store(c[1], y * inv);
+		bk_f32x8_store(c[2], z * inv);
+		for (; mask && i < n; mask &= mask - 1, i++) {
+			int j = __builtin_ctz(mask);
+			out[i][0] = c[0][j];
+			out[i][1] = c[1][j];
+			out[i][2] = c[2][j];
+		}
+	}
+	bkrng_save(r, &l);
+}
+
+BK_SIMD_END
+
+#endif
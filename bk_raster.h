@@ -0,0 +1,438 @@
+/*
+bk_raster.h - Tile-binned software rasterizer for the Brickate project
+
+This header renders indexed, textured triangle meshes into an RGBA8
+color buffer with a float depth buffer, entirely on the CPU. It is
+meant for headless servers and thumbnail generation where no GPU is
+available.
+
+Pipeline:
+  - bkr_draw transforms each referenced vertex once by model * view *
+    projection (bk_math) through the bk_clip post-transform cache, clips
+    only the triangles that straddle the frustum, culls back faces, sets
+    up edge and attribute plane equations and bins each triangle into
+    every 64x64 screen tile its bounding box touches
+  - bkr_flush rasterizes all tiles in parallel on a bk_job pool; each
+    tile walks its bin in submission order and evaluates the edge
+    functions 8 pixels at a time (bk_simd), with depth test and
+    perspective-correct nearest texture sampling
+
+Each tile is owned by a single worker, so no locking is needed on the
+color or depth buffers. Buffers are padded to whole tiles; use 'stride'
+(in pixels) when reading them back.
+
+Textures are RGBA8 images as returned by bkp_load_png (bk_png).
+*/
+
+#ifndef BK_RASTER_H
+#define BK_RASTER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bk_math.h"
+#include "bk_png.h"
+#include "bk_simd.h"
+#include "bk_job.h"
+#include "bk_clip.h"
+
+BK_SIMD_BEGIN
+
+#define BKR_TILE 64
+
+typedef struct {
+	float pos[3];
+	float uv[2];
+} bkr_vertex;
+
+typedef struct {
+	unsigned char* pixels; // RGBA8, row-major, width * 4 bytes per row
+	uint32_t width;
+	uint32_t height;
+} bkr_texture;
+
+// Screen-space triangle after setup. Each plane is (a, b, c) so that the
+// value at pixel center (x, y) is a * x + b * y + c.
+typedef struct {
+	float edge[3][3];
+	int top_left[3];
+	float z[3];  // depth in [0, 1]
+	float iw[3]; // 1 / w
+	float uw[3]; // u / w
+	float vw[3]; // v / w
+	int min_x, min_y, max_x, max_y; // inclusive pixel bounds, clamped to screen
+	const bkr_texture* tex;
+	uint32_t color; // used when tex is NULL, multiplied with texels otherwise
+} bkr_tri;
+
+typedef struct {
+	uint32_t* items;
+	size_t count;
+	size_t capacity;
+} bkr_bin;
+
+typedef struct {
+	int width;
+	int height;
+	int stride; // pixels per row in color and depth
+	uint32_t* color; // RGBA8 packed, R in the lowest byte
+	float* depth;
+
+	int tiles_x;
+	int tiles_y;
+	bkr_bin* bins;
+
+	bkr_tri* tris;
+	size_t n_tris;
+	size_t cap_tris;
+
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	int cull_backfaces;
+
+	bkc_cache cache;
+	bkj_pool* pool; // not owned, may be NULL
+} bkr_context;
+
+int bkr_texture_load(bkr_texture* tex, const char* path) {
+	tex->pixels = bkp_load_png(path, &tex->width, &tex->height, NULL);
+	return tex->pixels != NULL;
+}
+
+void bkr_texture_free(bkr_texture* tex) {
+	free(tex->pixels);
+	tex->pixels = NULL;
+	tex->width = tex->height = 0;
+}
+
+void bkr_destroy(bkr_context* ctx) {
+	if (!ctx) return;
+	if (ctx->bins) {
+		for (int i = 0; i < ctx->tiles_x * ctx->tiles_y; i++) free(ctx->bins[i].items);
+		free(ctx->bins);
+	}
+	free(ctx->tris);
+	bkc_cache_free(&ctx->cache);
+	free(ctx->color);
+	free(ctx->depth);
+	free(ctx);
+}
+
+bkr_context* bkr_create(int width, int height, bkj_pool* pool) {
+	if (width <= 0 || height <= 0) return NULL;
+
+	bkr_context* ctx = calloc(1, sizeof(bkr_context));
+	if (!ctx) return NULL;
+
+	ctx->width = width;
+	ctx->height = height;
+	ctx->tiles_x = (width + BKR_TILE - 1) / BKR_TILE;
+	ctx->tiles_y = (height + BKR_TILE - 1) / BKR_TILE;
+	ctx->stride = ctx->tiles_x * BKR_TILE;
+	ctx->pool = pool;
+	ctx->cull_backfaces = 1;
+
+	size_t n = (size_t)ctx->stride * ctx->tiles_y * BKR_TILE;
+	ctx->color = calloc(n, sizeof(uint32_t));
+	ctx->depth = malloc(n * sizeof(float));
+	ctx->bins = calloc((size_t)ctx->tiles_x * ctx->tiles_y, sizeof(bkr_bin));
+	if (!ctx->color || !ctx->depth || !ctx->bins) {
+		bkr_destroy(ctx);
+		return NULL;
+	}
+	for (size_t i = 0; i < n; i++) ctx->depth[i] = 1.0f;
+
+	bkm_mat4_identity(ctx->view);
+	bkm_mat4_identity(ctx->proj);
+	bkm_mat4_identity(ctx->viewproj);
+	return ctx;
+}
+
+void bkr_clear(bkr_context* ctx, uint32_t color, float depth) {
+	size_t n = (size_t)ctx->stride * ctx->tiles_y * BKR_TILE;
+	for (size_t i = 0; i < n; i++) {
+		ctx->color[i] = color;
+		ctx->depth[i] = depth;
+	}
+}
+
+void bkr_set_camera(bkr_context* ctx, vec3 eye, vec3 center, vec3 up, float fovy_rad, float near, float far) {
+	bkm_mat4_lookat(eye, center, up, ctx->view);
+	mat4_perspective(fovy_rad, (float)ctx->width / ctx->height, near, far, ctx->proj);
+	bkm_mat4_mul(ctx->proj, ctx->view, ctx->viewproj);
+}
+
+int bkr_bin_push(bkr_bin* bin, uint32_t tri) {
+	if (bin->count == bin->capacity) {
+		size_t cap = bin->capacity ? bin->capacity * 2 : 64;
+		uint32_t* items = realloc(bin->items, cap * sizeof(uint32_t));
+		if (!items) return 0;
+		bin->items = items;
+		bin->capacity = cap;
+	}
+	bin->items[bin->count++] = tri;
+	return 1;
+}
+
+// Plane through the three per-vertex values of an attribute, in pixel space
+void bkr_attr_plane(const float e[3][3], float inv_area, float a0, float a1, float a2, float out[3]) {
+	for (int k = 0; k < 3; k++) out[k] = (a0 * e[0][k] + a1 * e[1][k] + a2 * e[2][k]) * inv_area;
+}
+
+// v[i] = screen x, y, depth, 1/w (from bkc_project), u, v
+int bkr_setup_triangle(bkr_context* ctx, const float v[3][6], const bkr_texture* tex, uint32_t color) {
+	float sx[3], sy[3], sz[3], iw[3];
+	for (int i = 0; i < 3; i++) {
+		sx[i] = v[i][0];
+		sy[i] = v[i][1];
+		sz[i] = v[i][2];
+		iw[i] = v[i][3];
+	}
+
+	// Screen y points down, so counter-clockwise triangles in NDC have a
+	// negative signed area here
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+	if (area == 0.0f) return 1;
+	if (area > 0.0f && ctx->cull_backfaces) return 1;
+
+	bkr_tri t;
+	int i1 = 1, i2 = 2;
+	if (area > 0.0f) { // back face with culling off: flip to front winding
+		i1 = 2;
+		i2 = 1;
+		area = -area;
+	}
+	const int idx[3] = {0, i1, i2};
+
+	// Edge k is opposite vertex k and is positive inside the triangle
+	for (int k = 0; k < 3; k++) {
+		int a = idx[(k + 1) % 3], b = idx[(k + 2) % 3];
+		float ea = sy[b] - sy[a];
+		float eb = sx[a] - sx[b];
+		t.edge[k][0] = ea;
+		t.edge[k][1] = eb;
+		t.edge[k][2] = -(ea * sx[a] + eb * sy[a]);
+		// Top edges have the interior below them, left edges to their right
+		t.top_left[k] = ea > 0.0f || (ea == 0.0f && eb > 0.0f);
+	}
+
+	float inv_area = 1.0f / -area;
+	float az[3], aiw[3], au[3], av[3];
+	for (int k = 0; k < 3; k++) {
+		int i = idx[k];
+		az[k] = sz[i];
+		aiw[k] = iw[i];
+		au[k] = v[i][4] * iw[i];
+		av[k] = v[i][5] * iw[i];
+	}
+	bkr_attr_plane(t.edge, inv_area, az[0], az[1], az[2], t.z);
+	bkr_attr_plane(t.edge, inv_area, aiw[0], aiw[1], aiw[2], t.iw);
+	bkr_attr_plane(t.edge, inv_area, au[0], au[1], au[2], t.uw);
+	bkr_attr_plane(t.edge, inv_area, av[0], av[1], av[2], t.vw);
+
+	float fx0 = fminf(sx[0], fminf(sx[1], sx[2]));
+	float fx1 = fmaxf(sx[0], fmaxf(sx[1], sx[2]));
+	float fy0 = fminf(sy[0], fminf(sy[1], sy[2]));
+	float fy1 = fmaxf(sy[0], fmaxf(sy[1], sy[2]));
+	if (fx1 < 0.0f || fy1 < 0.0f || fx0 > ctx->width || fy0 > ctx->height) return 1;
+
+	t.min_x = fx0 < 0.0f ? 0 : (int)fx0;
+	t.min_y = fy0 < 0.0f ? 0 : (int)fy0;
+	t.max_x = fx1 >= ctx->width ? ctx->width - 1 : (int)fx1;
+	t.max_y = fy1 >= ctx->height ? ctx->height - 1 : (int)fy1;
+	if (t.min_x > t.max_x || t.min_y > t.max_y) return 1;
+
+	t.tex = (tex && tex->pixels) ? tex : NULL;
+	t.color = color;
+
+	if (ctx->n_tris == ctx->cap_tris) {
+		size_t cap = ctx->cap_tris ? ctx->cap_tris * 2 : 1024;
+		bkr_tri* tris = realloc(ctx->tris, cap * sizeof(bkr_tri));
+		if (!tris) return 0;
+		ctx->tris = tris;
+		ctx->cap_tris = cap;
+	}
+	uint32_t id = (uint32_t)ctx->n_tris;
+	ctx->tris[ctx->n_tris++] = t;
+
+	for (int ty = t.min_y / BKR_TILE; ty <= t.max_y / BKR_TILE; ty++) {
+		for (int tx = t.min_x / BKR_TILE; tx <= t.max_x / BKR_TILE; tx++) {
+			if (!bkr_bin_push(&ctx->bins[ty * ctx->tiles_x + tx], id)) return 0;
+		}
+	}
+	return 1;
+}
+
+// Clips a triangle that straddles the frustum and sets up the pieces
+int bkr_clip_and_setup(bkr_context* ctx, const bkr_vertex* verts, const uint32_t idx[3], const bkr_texture* tex, uint32_t color) {
+	const bkc_cache* c = &ctx->cache;
+	float poly[BKC_MAX_POLY][BKC_MAX_FLOATS];
+	uint32_t planes = 0;
+	for (int k = 0; k < 3; k++) {
+		memcpy(poly[k], c->clip + (size_t)idx[k] * 4, 4 * sizeof(float));
+		poly[k][4] = verts[idx[k]].uv[0];
+		poly[k][5] = verts[idx[k]].uv[1];
+		planes |= c->outcode[idx[k]];
+	}
+
+	int n = bkc_clip_polygon(poly, 3, 6, planes);
+	if (n < 3) return 1;
+
+	float s[BKC_MAX_POLY][6];
+	for (int i = 0; i < n; i++) {
+		bkc_project(poly[i], ctx->width, ctx->height, s[i]);
+		s[i][4] = poly[i][4];
+		s[i][5] = poly[i][5];
+	}
+	for (int i = 1; i + 1 < n; i++) {
+		float tri[3][6];
+		memcpy(tri[0], s[0], sizeof(tri[0]));
+		memcpy(tri[1], s[i], sizeof(tri[0]));
+		memcpy(tri[2], s[i + 1], sizeof(tri[0]));
+		if (!bkr_setup_triangle(ctx, tri, tex, color)) return 0;
+	}
+	return 1;
+}
+
+// Queues an indexed triangle list for the next bkr_flush. Every index must
+// be below n_verts. 'model' may be NULL for identity. Returns 0 on
+// allocation failure.
+int bkr_draw(bkr_context* ctx, const bkr_vertex* verts, size_t n_verts, const uint32_t* indices, size_t n_indices,
+	mat4 model, const bkr_texture* tex, uint32_t color) {
+	if (n_verts == 0 || n_indices < 3) return 1;
+
+	mat4 mvp;
+	if (model) bkm_mat4_mul(ctx->viewproj, model, mvp);
+	else memcpy(mvp, ctx->viewproj, sizeof(mat4));
+
+	bkc_cache* c = &ctx->cache;
+	if (!bkc_cache_reserve(c, n_verts)) return 0;
+	bkc_cache_reset(c);
+	n_indices -= n_indices % 3;
+	bkc_transform_indices(c, mvp, verts[0].pos, sizeof(bkr_vertex), indices, n_indices, ctx->width, ctx->height);
+
+	for (size_t i = 0; i < n_indices; i += 3) {
+		const uint32_t* idx = indices + i;
+		switch (bkc_classify(c, idx[0], idx[1], idx[2])) {
+			case BKC_ACCEPT: {
+				float v[3][6];
+				for (int k = 0; k < 3; k++) {
+					memcpy(v[k], c->screen + (size_t)idx[k] * 4, 4 * sizeof(float));
+					v[k][4] = verts[idx[k]].uv[0];
+					v[k][5] = verts[idx[k]].uv[1];
+				}
+				if (!bkr_setup_triangle(ctx, v, tex, color)) return 0;
+				break;
+			}
+			case BKC_CLIP:
+				if (!bkr_clip_and_setup(ctx, verts, idx, tex, color)) return 0;
+				break;
+			default:
+				break;
+		}
+	}
+	return 1;
+}
+
+// Component-wise product of two RGBA8 colors, per lane
+BK_SIMD_INLINE bk_u32x8 bkr_modulate(bk_u32x8 a, bk_u32x8 b) {
+	bk_u32x8 r = bk_u32x8_splat(0);
+	for (int c = 0; c < 32; c += 8) {
+		bk_u32x8 ca = (a >> c) & 0xFF;
+		bk_u32x8 cb = (b >> c) & 0xFF;
+		bk_u32x8 p = ca * cb + 128;
+		r |= (((p + (p >> 8)) >> 8) & 0xFF) << c;
+	}
+	return r;
+}
+
+BK_SIMD_INLINE bk_u32x8 bkr_sample_nearest(const bkr_texture* tex, bk_f32x8 u, bk_f32x8 v, int mask) {
+	bk_i32x8 x = bk_f32x8_floor_i32(u * (float)tex->width);
+	bk_i32x8 y = bk_f32x8_floor_i32(v * (float)tex->height);
+	bk_u32x8 out = bk_u32x8_splat(0);
+	for (int l = 0; l < 8; l++) {
+		if (!(mask & (1 << l))) continue;
+		int tx = x[l] % (int)tex->width;
+		int ty = y[l] % (int)tex->height;
+		if (tx < 0) tx += tex->width;
+		if (ty < 0) ty += tex->height;
+		uint32_t texel;
+		memcpy(&texel, tex->pixels + ((size_t)ty * tex->width + tx) * 4, 4);
+		out[l] = texel;
+	}
+	return out;
+}
+
+void bkr_raster_tile(void* arg, int tile, int worker) {
+	bkr_context* ctx = arg;
+	const bkr_bin* bin = &ctx->bins[tile];
+	(void)worker;
+
+	int tile_x0 = (tile % ctx->tiles_x) * BKR_TILE;
+	int tile_y0 = (tile / ctx->tiles_x) * BKR_TILE;
+	const bk_f32x8 lane = bk_f32x8_iota();
+	const bk_f32x8 zero = bk_f32x8_splat(0.0f);
+
+	for (size_t k = 0; k < bin->count; k++) {
+		const bkr_tri* t = &ctx->tris[bin->items[k]];
+
+		int x0 = t->min_x > tile_x0 ? t->min_x : tile_x0;
+		int y0 = t->min_y > tile_y0 ? t->min_y : tile_y0;
+		int x1 = t->max_x < tile_x0 + BKR_TILE - 1 ? t->max_x : tile_x0 + BKR_TILE - 1;
+		int y1 = t->max_y < tile_y0 + BKR_TILE - 1 ? t->max_y : tile_y0 + BKR_TILE - 1;
+		x0 &= ~7; // blocks of 8 stay inside the (padded) tile
+
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+			float* depth_row = ctx->depth + (size_t)y * ctx->stride;
+			uint32_t* color_row = ctx->color + (size_t)y * ctx->stride;
+
+			for (int x = x0; x <= x1; x += 8) {
+				bk_f32x8 px = bk_f32x8_splat(x + 0.5f) + lane;
+
+				bk_i32x8 inside = bk_i32x8_splat(-1);
+				for (int e = 0; e < 3; e++) {
+					bk_f32x8 w = px * t->edge[e][0] + (t->edge[e][1] * py + t->edge[e][2]);
+					inside &= t->top_left[e] ? (w >= zero) : (w > zero);
+				}
+				inside &= (bk_i32x8_iota() + x) <= x1;
+				if (!bk_i32x8_any(inside)) continue;
+
+				bk_f32x8 z = px * t->z[0] + (t->z[1] * py + t->z[2]);
+				bk_f32x8 d = bk_f32x8_load(depth_row + x);
+				inside &= z < d;
+				int mask = bk_i32x8_movemask(inside);
+				if (!mask) continue;
+
+				bk_f32x8_store(depth_row + x, bk_f32x8_select(inside, z, d));
+
+				bk_u32x8 c = bk_u32x8_splat(t->color);
+				if (t->tex) {
+					bk_f32x8 rw = 1.0f / (px * t->iw[0] + (t->iw[1] * py + t->iw[2]));
+					bk_f32x8 u = (px * t->uw[0] + (t->uw[1] * py + t->uw[2])) * rw;
+					bk_f32x8 v = (px * t->vw[0] + (t->vw[1] * py + t->vw[2])) * rw;
+					bk_u32x8 texel = bkr_sample_nearest(t->tex, u, v, mask);
+					c = t->color == 0xFFFFFFFFu ? texel : bkr_modulate(texel, c);
+				}
+
+				bk_u32x8 dst = bk_u32x8_load(color_row + x);
+				bk_u32x8_store(color_row + x, bk_u32x8_select(inside, c, dst));
+			}
+		}
+	}
+}
+
+// Rasterizes everything queued since the last flush
+void bkr_flush(bkr_context* ctx) {
+	bkj_parallel_for(ctx->pool, ctx->tiles_x * ctx->tiles_y, bkr_raster_tile, ctx);
+
+	for (int i = 0; i < ctx->tiles_x * ctx->tiles_y; i++) ctx->bins[i].count = 0;
+	ctx->n_tris = 0;
+}
+
+BK_SIMD_END
+
+#endif
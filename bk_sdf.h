@@ -0,0 +1,247 @@
+/*
+bk_sdf.h - Signed distance fields for the Brickate project
+
+This header turns the alpha channel of an RGBA8 image (as returned by
+bkp_load_png) into a signed distance field, for scalable font glyphs and
+UI icons.
+
+Distances are exact Euclidean distances between texel centers, computed
+in linear time as two separable passes:
+  - Per column, the distance to the nearest feature texel, found with a
+    forward and a backward sweep over 8 columns at a time (bk_simd)
+  - Per row, the lower envelope of parabolas (Felzenszwalb and
+    Huttenlocher), which turns column distances into 2D ones
+
+Includes functions for:
+  - A float field in texels, negative inside the shape
+  - An 8-bit field at full or reduced resolution, where 128 is the edge
+    and 'spread' source texels map to the full range on either side
+
+Both passes are spread over a bk_job pool when one is given. This is a
+single-channel field; multi-channel fields need vector outlines, which a
+bitmap does not have.
+*/
+
+#ifndef BK_SDF_H
+#define BK_SDF_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bk_simd.h"
+#include "bk_job.h"
+
+BK_SIMD_BEGIN
+
+// Farther than any real distance, yet small enough to square in a float
+#define BKD_FAR 1e6f
+
+#define BKD_BAND_ROWS 16
+
+typedef struct {
+	const unsigned char* pixels;
+	size_t pixel_stride; // bytes
+	int width;
+	int height;
+	int stride;          // floats per grid row, a multiple of 8
+	int threshold;       // alpha at or above this is inside
+	float* grid[2];      // squared distance to the nearest inside / outside texel
+	float* scratch;      // per worker: f, d, z (n + 1 each) and v (n)
+	float* out;
+	size_t out_stride;   // floats
+} bkd_job;
+
+// Column pass for 8 columns and both fields
+void bkd_columns(void* ctx, int group, int worker) {
+	bkd_job* j = ctx;
+	int x = group * 8;
+	int n = j->width - x < 8 ? j->width - x : 8;
+	(void)worker;
+
+	for (int f = 0; f < 2; f++) {
+		float* g = j->grid[f] + x;
+		bk_f32x8 d = bk_f32x8_splat(BKD_FAR);
+
+		for (int y = 0; y < j->height; y++) {
+			const unsigned char* row = j->pixels + (size_t)y * j->pixel_stride + (size_t)x * 4;
+			bk_i32x8 inside = bk_i32x8_splat(0);
+			for (int l = 0; l < n; l++) inside[l] = -(row[l * 4 + 3] >= j->threshold);
+			bk_i32x8 feature = f == 0 ? inside : ~inside;
+
+			d = bk_f32x8_select(feature, bk_f32x8_splat(0.0f), bk_f32x8_min(d + 1.0f, bk_f32x8_splat(BKD_FAR)));
+			bk_f32x8_store(g + (size_t)y * j->stride, d);
+		}
+
+		for (int y = j->height - 2; y >= 0; y--) {
+			float* p = g + (size_t)y * j->stride;
+			d = bk_f32x8_min(bk_f32x8_load(p), d + 1.0f);
+			bk_f32x8_store(p, d);
+		}
+
+		for (int y = 0; y < j->height; y++) {
+			float* p = g + (size_t)y * j->stride;
+			bk_f32x8 v = bk_f32x8_load(p);
+			bk_f32x8_store(p, v * v);
+		}
+	}
+}
+
+// Squared 1D distance transform of f[0..n) into d, with v and z as scratch
+void bkd_edt_1d(const float* f, int n, float* d, int* v, float* z) {
+	int k = 0;
+	v[0] = 0;
+	z[0] = -INFINITY;
+	z[1] = INFINITY;
+
+	for (int q = 1; q < n; q++) {
+		float s;
+		for (;;) {
+			int p = v[k];
+			s = ((f[q] + (float)q * q) - (f[p] + (float)p * p)) / (2.0f * (q - p));
+			if (s > z[k]) break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = INFINITY;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++) {
+		while (z[k + 1] < q) k++;
+		float dq = (float)(q - v[k]);
+		d[q] = dq * dq + f[v[k]];
+	}
+}
+
+// Row pass for both fields, then the signed distance of each texel
+void bkd_rows(void* ctx, int band, int worker) {
+	bkd_job* j = ctx;
+	int n = j->width;
+	float* f = j->scratch + (size_t)worker * (4 * n + 3);
+	float* d = f + n + 1;
+	float* z = d + n + 1;
+	int* v = (int*)(z + n + 1);
+
+	int y0 = band * BKD_BAND_ROWS;
+	int y1 = y0 + BKD_BAND_ROWS < j->height ? y0 + BKD_BAND_ROWS : j->height;
+	for (int y = y0; y < y1; y++) {
+		for (int g = 0; g < 2; g++) {
+			float* row = j->grid[g] + (size_t)y * j->stride;
+			memcpy(f, row, n * sizeof(float));
+			bkd_edt_1d(f, n, d, v, z);
+			memcpy(row, d, n * sizeof(float));
+		}
+
+		// Edges lie half a texel from the centers on either side
+		const float* to_in = j->grid[0] + (size_t)y * j->stride;
+		const float* to_out = j->grid[1] + (size_t)y * j->stride;
+		float* out = j->out + (size_t)y * j->out_stride;
+		for (int x = 0; x < n; x += 8) {
+			bk_f32x8 a = bk_f32x8_load(to_in + x);
+			bk_f32x8 b = bk_f32x8_load(to_out + x);
+			bk_f32x8 half = bk_f32x8_select(a == 0.0f, bk_f32x8_splat(0.5f), bk_f32x8_splat(-0.5f));
+			bk_f32x8 sd = bk_f32x8_sqrt(a) - bk_f32x8_sqrt(b) + half;
+			int m = n - x < 8 ? n - x : 8;
+			memcpy(out + x, &sd, m * sizeof(float));
+		}
+	}
+}
+
+// Writes the signed distance in texels of every texel to 'out' (width
+// floats per row, 'out_stride' floats apart): positive outside the shape,
+// negative inside. 'stride' is in bytes. Returns 1 on success.
+int bkd_distance(const unsigned char* pixels, int width, int height, size_t stride, int threshold,
+	float* out, size_t out_stride, bkj_pool* pool) {
+	if (width <= 0 || height <= 0) return 0;
+
+	bkd_job j = {0};
+	j.pixels = pixels;
+	j.pixel_stride = stride;
+	j.width = width;
+	j.height = height;
+	j.stride = (width + 7) & ~7;
+	j.threshold = threshold;
+	j.out = out;
+	j.out_stride = out_stride;
+
+	size_t n = (size_t)j.stride * height;
+	j.grid[0] = malloc(n * sizeof(float));
+	j.grid[1] = malloc(n * sizeof(float));
+	j.scratch = malloc((size_t)bkj_pool_size(pool) * (4 * width + 3) * sizeof(float));
+	int ok = j.grid[0] && j.grid[1] && j.scratch;
+
+	if (ok) {
+		bkj_parallel_for(pool, j.stride / 8, bkd_columns, &j);
+		bkj_parallel_for(pool, (height + BKD_BAND_ROWS - 1) / BKD_BAND_ROWS, bkd_rows, &j);
+	}
+
+	free(j.grid[0]);
+	free(j.grid[1]);
+	free(j.scratch);
+	return ok;
+}
+
+typedef struct {
+	const float* field;
+	int width;
+	int height;
+	int scale;
+	float spread;
+	unsigned char* out;
+	int out_width;
+	int out_height;
+	size_t out_stride; // bytes
+} bkd_quantize_job;
+
+// Averages each scale x scale block of the field into one byte
+void bkd_quantize_row(void* ctx, int y, int worker) {
+	const bkd_quantize_job* j = ctx;
+	(void)worker;
+
+	int sy0 = y * j->scale;
+	int sy1 = sy0 + j->scale < j->height ? sy0 + j->scale : j->height;
+	unsigned char* out = j->out + (size_t)y * j->out_stride;
+	for (int x = 0; x < j->out_width; x++) {
+		int sx0 = x * j->scale;
+		int sx1 = sx0 + j->scale < j->width ? sx0 + j->scale : j->width;
+		float sum = 0.0f;
+		for (int sy = sy0; sy < sy1; sy++) {
+			const float* row = j->field + (size_t)sy * j->width;
+			for (int sx = sx0; sx < sx1; sx++) sum += row[sx];
+		}
+		float sd = sum / ((sy1 - sy0) * (sx1 - sx0));
+		float v = 128.0f - sd / j->spread * 127.0f;
+		out[x] = (unsigned char)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v + 0.5f));
+	}
+}
+
+// Writes an 8-bit field of ceil(width / scale) x ceil(height / scale)
+// texels to 'out' ('out_stride' bytes per row). Values above 128 are
+// inside; 'spread' is the distance in source texels that maps to 0 or
+// 255. Returns 1 on success.
+int bkd_generate(const unsigned char* pixels, int width, int height, size_t stride, int threshold,
+	int scale, float spread, unsigned char* out, size_t out_stride, bkj_pool* pool) {
+	if (scale < 1 || spread <= 0.0f) return 0;
+
+	float* field = malloc((size_t)width * height * sizeof(float));
+	if (!field) return 0;
+	if (!bkd_distance(pixels, width, height, stride, threshold, field, width, pool)) {
+		free(field);
+		return 0;
+	}
+
+	bkd_quantize_job j = {field, width, height, scale, spread, out,
+		(width + scale - 1) / scale, (height + scale - 1) / scale, out_stride};
+	bkj_parallel_for(pool, j.out_height, bkd_quantize_row, &j);
+
+	free(field);
+	return 1;
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,214 @@
+/*
+bk_seq.h - PNG image sequence playback for the Brickate project
+
+This header plays numbered PNG sequences (cutscenes, flipbook effects)
+without decoding on the render thread.
+
+Features:
+  - Frames named by a printf pattern with one integer, e.g.
+    "fx/smoke_%04d.png", counted automatically when no count is given
+  - Background threads decode frames ahead of playback straight into a
+    ring of RGBA buffers allocated once at open
+  - bkv_next_frame never allocates; it either waits for the next frame
+    or reports that it is not ready yet, so the caller can keep showing
+    the current one
+  - Optional looping
+
+Every frame must have the size of the first. The buffer returned by
+bkv_next_frame stays valid until the following call.
+*/
+
+#ifndef BK_SEQ_H
+#define BK_SEQ_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bk_png.h"
+
+#define BKV_ERROR -2 // the frame failed to decode; the next call moves on
+#define BKV_END -1
+#define BKV_WAIT 0
+#define BKV_READY 1
+
+#define BKV_SLOT_EMPTY 0
+#define BKV_SLOT_DECODING 1
+#define BKV_SLOT_READY 2
+#define BKV_SLOT_FAILED 3
+
+#define BKV_PATH_MAX 1024
+
+typedef struct {
+	char pattern[BKV_PATH_MAX];
+	int first;          // number of the first frame
+	int count;
+	int loop;
+	uint32_t width;
+	uint32_t height;
+	size_t frame_size;  // bytes per RGBA frame
+
+	// Playback positions count up forever; position p shows frame
+	// first + p % count and is decoded into slot p % ring_size
+	int ring_size;
+	unsigned char* frames;
+	int* slot_pos;
+	int* slot_state;    // BKV_SLOT_*
+	int next_decode;
+	int next_show;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;   // a slot was freed, or quit
+	pthread_cond_t ready_cv;  // a slot finished decoding
+	pthread_t* threads;
+	int n_threads;
+	int quit;
+} bkv_seq;
+
+int bkv_frame_path(const bkv_seq* s, int number, char* path) {
+	int n = snprintf(path, BKV_PATH_MAX, s->pattern, number);
+	return n > 0 && n < BKV_PATH_MAX;
+}
+
+// Whether position p may be decoded now: the ring keeps the frame last
+// returned by bkv_next_frame, so at most ring_size - 1 positions ahead
+int bkv_can_decode(const bkv_seq* s) {
+	int p = s->next_decode;
+	if (!s->loop && p >= s->count) return 0;
+	return p < s->next_show + s->ring_size - 1;
+}
+
+void* bkv_thread_main(void* arg) {
+	bkv_seq* s = arg;
+	char path[BKV_PATH_MAX];
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->quit && !bkv_can_decode(s)) pthread_cond_wait(&s->work_cv, &s->lock);
+		if (s->quit) break;
+
+		int p = s->next_decode++;
+		int slot = p % s->ring_size;
+		s->slot_pos[slot] = p;
+		s->slot_state[slot] = BKV_SLOT_DECODING;
+		pthread_mutex_unlock(&s->lock);
+
+		bkp_ihdr ihdr;
+		int ok = bkv_frame_path(s, s->first + p % s->count, path)
+			&& bkp_load_png_into(path, s->frames + (size_t)slot * s->frame_size, (size_t)s->width * 4, s->width, s->height, &ihdr)
+			&& ihdr.width == s->width && ihdr.height == s->height;
+
+		pthread_mutex_lock(&s->lock);
+		s->slot_state[slot] = ok ? BKV_SLOT_READY : BKV_SLOT_FAILED;
+		pthread_cond_broadcast(&s->ready_cv);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+void bkv_close(bkv_seq* s) {
+	if (s->threads) {
+		pthread_mutex_lock(&s->lock);
+		s->quit = 1;
+		pthread_cond_broadcast(&s->work_cv);
+		pthread_mutex_unlock(&s->lock);
+		for (int i = 0; i < s->n_threads; i++) pthread_join(s->threads[i], NULL);
+
+		pthread_mutex_destroy(&s->lock);
+		pthread_cond_destroy(&s->work_cv);
+		pthread_cond_destroy(&s->ready_cv);
+	}
+	free(s->threads);
+	free(s->frames);
+	free(s->slot_pos);
+	free(s->slot_state);
+	memset(s, 0, sizeof(*s));
+}
+
+// Opens a sequence of 'count' frames numbered from 'first' (count <= 0
+// counts the files that exist), keeping up to ring_size - 1 frames
+// decoded ahead on n_threads threads. Returns 1 on success.
+int bkv_open(bkv_seq* s, const char* pattern, int first, int count, int loop, int ring_size, int n_threads) {
+	memset(s, 0, sizeof(*s));
+	if (ring_size < 2 || n_threads < 1 || strlen(pattern) >= BKV_PATH_MAX) return 0;
+	strcpy(s->pattern, pattern);
+	s->first = first;
+	s->loop = loop;
+	s->ring_size = ring_size;
+
+	char path[BKV_PATH_MAX];
+	bkp_ihdr ihdr;
+	if (!bkv_frame_path(s, first, path) || !bkp_probe_png(path, &ihdr)) return 0;
+	s->width = ihdr.width;
+	s->height = ihdr.height;
+	s->frame_size = (size_t)ihdr.width * ihdr.height * 4;
+
+	if (count <= 0) {
+		bkp_ihdr next;
+		count = 1;
+		while (bkv_frame_path(s, first + count, path) && bkp_probe_png(path, &next)) count++;
+	}
+	s->count = count;
+
+	s->frames = malloc(s->frame_size * ring_size);
+	s->slot_pos = malloc(ring_size * sizeof(int));
+	s->slot_state = calloc(ring_size, sizeof(int));
+	s->threads = calloc(n_threads, sizeof(pthread_t));
+	if (!s->frames || !s->slot_pos || !s->slot_state || !s->threads) {
+		free(s->threads);
+		s->threads = NULL;
+		bkv_close(s);
+		return 0;
+	}
+	for (int i = 0; i < ring_size; i++) s->slot_pos[i] = -1;
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->work_cv, NULL);
+	pthread_cond_init(&s->ready_cv, NULL);
+	for (int i = 0; i < n_threads; i++) {
+		if (pthread_create(&s->threads[i], NULL, bkv_thread_main, s) != 0) break;
+		s->n_threads++;
+	}
+	if (s->n_threads == 0) {
+		bkv_close(s);
+		return 0;
+	}
+	return 1;
+}
+
+// Fetches the next frame into *out (width * height RGBA pixels). With
+// 'wait' it blocks until the frame is decoded; otherwise it returns
+// BKV_WAIT when it is not ready yet. Returns BKV_READY, BKV_WAIT, BKV_END
+// after the last frame of a sequence that does not loop, or BKV_ERROR.
+int bkv_next_frame(bkv_seq* s, const unsigned char** out, int wait) {
+	pthread_mutex_lock(&s->lock);
+	int p = s->next_show;
+	if (!s->loop && p >= s->count) {
+		pthread_mutex_unlock(&s->lock);
+		return BKV_END;
+	}
+
+	int slot = p % s->ring_size;
+	for (;;) {
+		int state = s->slot_state[slot];
+		if (s->slot_pos[slot] == p && (state == BKV_SLOT_READY || state == BKV_SLOT_FAILED)) break;
+		if (!wait) {
+			pthread_mutex_unlock(&s->lock);
+			return BKV_WAIT;
+		}
+		pthread_cond_wait(&s->ready_cv, &s->lock);
+	}
+
+	// Moving on releases the slot of the previous frame
+	int ok = s->slot_state[slot] == BKV_SLOT_READY;
+	s->next_show++;
+	pthread_cond_broadcast(&s->work_cv);
+	pthread_mutex_unlock(&s->lock);
+
+	*out = ok ? s->frames + (size_t)slot * s->frame_size : NULL;
+	return ok ? BKV_READY : BKV_ERROR;
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+bk_simd.h - 8-wide vector helpers for the Brickate project
+
+This header wraps the GCC/Clang vector extensions in a handful of
+fixed-width types so that the pixel and vertex loops in the other bk
+headers can be written once and compiled to whatever the target offers:
+SSE2 on plain x86-64 builds, AVX/AVX2 with -mavx2, NEON on ARM, or
+scalar code elsewhere.
+
+Types:
+  - bk_f32x8: 8 floats
+  - bk_i32x8: 8 signed 32-bit ints, also used as lane masks (0 / -1)
+  - bk_u32x8: 8 unsigned 32-bit ints (packed RGBA8 pixels)
+
+plus a few packed-RGBA8 helpers shared by the samplers and blitters.
+
+Loads and stores go through memcpy, so pointers need no alignment.
+
+GCC without -mavx warns (-Wpsabi) that 32-byte vectors change the
+calling convention. Nothing here passes them across a real call, so the
+bk headers switch the warning off around their vector code with
+BK_SIMD_BEGIN / BK_SIMD_END. GCC 12 still checks the return of each
+helper it inlines after the pragma has been popped, and reports that
+once, at the end of the file (with a note on parameter alignment).
+bk_png.h and bk_quant.h use plain vector operators instead of those
+helpers, so the loader and tools/bk_pngopt.c build without it.
+*/
+
+#ifndef BK_SIMD_H
+#define BK_SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Helpers that pass vectors by value, here and in the other headers, are
+// always inlined: without AVX an out-of-line copy (including the clones
+// GCC makes for constant arguments) would pass them through memory.
+#define BK_SIMD_INLINE static inline __attribute__((always_inline))
+
+// Around the vector code of each header that uses these types
+#if defined(__GNUC__) && !defined(__clang__)
+#define BK_SIMD_BEGIN _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wpsabi\"")
+#define BK_SIMD_END _Pragma("GCC diagnostic pop")
+#else
+#define BK_SIMD_BEGIN
+#define BK_SIMD_END
+#endif
+
+BK_SIMD_BEGIN
+
+typedef float bk_f32x8 __attribute__((vector_size(32)));
+typedef int32_t bk_i32x8 __attribute__((vector_size(32)));
+typedef uint32_t bk_u32x8 __attribute__((vector_size(32)));
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_splat(float x) {
+	return (bk_f32x8){x, x, x, x, x, x, x, x};
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_splat(int32_t x) {
+	return (bk_i32x8){x, x, x, x, x, x, x, x};
+}
+
+BK_SIMD_INLINE bk_u32x8 bk_u32x8_splat(uint32_t x) {
+	return (bk_u32x8){x, x, x, x, x, x, x, x};
+}
+
+// 0, 1, 2, ... 7
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_iota(void) {
+	return (bk_f32x8){0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f};
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_iota(void) {
+	return (bk_i32x8){0, 1, 2, 3, 4, 5, 6, 7};
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_load(const float* p) {
+	bk_f32x8 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+BK_SIMD_INLINE void bk_f32x8_store(float* p, bk_f32x8 v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_load(const int32_t* p) {
+	bk_i32x8 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+BK_SIMD_INLINE void bk_i32x8_store(int32_t* p, bk_i32x8 v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+BK_SIMD_INLINE bk_u32x8 bk_u32x8_load(const uint32_t* p) {
+	bk_u32x8 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+BK_SIMD_INLINE void bk_u32x8_store(uint32_t* p, bk_u32x8 v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_f32x8_bits(bk_f32x8 v) {
+	return (bk_i32x8)v;
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_from_bits(bk_i32x8 v) {
+	return (bk_f32x8)v;
+}
+
+// Per lane: mask ? a : b. Mask lanes must be all ones or all zeros.
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_select(bk_i32x8 mask, bk_f32x8 a, bk_f32x8 b) {
+	return (bk_f32x8)(((bk_i32x8)a & mask) | ((bk_i32x8)b & ~mask));
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_select(bk_i32x8 mask, bk_i32x8 a, bk_i32x8 b) {
+	return (a & mask) | (b & ~mask);
+}
+
+BK_SIMD_INLINE bk_u32x8 bk_u32x8_select(bk_i32x8 mask, bk_u32x8 a, bk_u32x8 b) {
+	return (a & (bk_u32x8)mask) | (b & ~(bk_u32x8)mask);
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_min(bk_f32x8 a, bk_f32x8 b) {
+	return bk_f32x8_select(a < b, a, b);
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_max(bk_f32x8 a, bk_f32x8 b) {
+	return bk_f32x8_select(a > b, a, b);
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_min(bk_i32x8 a, bk_i32x8 b) {
+	return bk_i32x8_select(a < b, a, b);
+}
+
+BK_SIMD_INLINE bk_i32x8 bk_i32x8_max(bk_i32x8 a, bk_i32x8 b) {
+	return bk_i32x8_select(a > b, a, b);
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_clamp(bk_f32x8 x, float lo, float hi) {
+	return bk_f32x8_min(bk_f32x8_max(x, bk_f32x8_splat(lo)), bk_f32x8_splat(hi));
+}
+
+// Truncates toward zero, like a C cast
+BK_SIMD_INLINE bk_i32x8 bk_f32x8_to_i32(bk_f32x8 v) {
+	return __builtin_convertvector(v, bk_i32x8);
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_i32x8_to_f32(bk_i32x8 v) {
+	return __builtin_convertvector(v, bk_f32x8);
+}
+
+BK_SIMD_INLINE bk_f32x8 bk_f32x8_sqrt(bk_f32x8 v) {
+#ifdef __AVX__
+	return (bk_f32x8)_mm256_sqrt_ps((__m256)v);
+#else
+	for (int i = 0; i < 8; i++) v[i] = __builtin_sqrtf(v[i]);
+	return v;
+#endif
+}
+
+// Rounds toward negative infinity
+BK_SIMD_INLINE bk_i32x8 bk_f32x8_floor_i32(bk_f32x8 v) {
+	bk_i32x8 t = bk_f32x8_to_i32(v);
+	return t + (bk_i32x8)(bk_i32x8_to_f32(t) > v); // true lanes are -1
+}
+
+// Per lane: the 32-bit word at index idx of base, with a hardware
+// gather on AVX2. base may point at bytes (e.g. RGBA8 pixels).
+BK_SIMD_INLINE bk_u32x8 bk_u32x8_gather(const void* base, bk_i32x8 idx) {
+#ifdef __AVX2__
+	return (bk_u32x8)_mm256_i32gather_epi32((const int*)base, (__m256i)idx, 4);
+#else
+	bk_u32x8 v;
+	for (int i = 0; i < 8; i++) memcpy(&v[i], (const unsigned char*)base + (size_t)idx[i] * 4, 4);
+	return v;
+#endif
+}
+
+// Weighted sum of four packed RGBA8 colors; the weights are 8-bit fixed point and
+// add up to 256. Red/blue and green/alpha are blended two at a time in the
+// 16-bit halves of each lane.
+BK_SIMD_INLINE bk_u32x8 bk_rgba8_blend4(bk_u32x8 c00, bk_u32x8 c10, bk_u32x8 c01, bk_u32x8 c11,
+	bk_u32x8 w00, bk_u32x8 w10, bk_u32x8 w01, bk_u32x8 w11) {
+	const uint32_t m = 0x00FF00FF;
+	bk_u32x8 rb = (c00 & m) * w00 + (c10 & m) * w10 + (c01 & m) * w01 + (c11 & m) * w11;
+	bk_u32x8 ga = ((c00 >> 8) & m) * w00 + ((c10 >> 8) & m) * w10 + ((c01 >> 8) & m) * w01 + ((c11 >> 8) & m) * w11;
+	rb = ((rb + 0x00800080) >> 8) & m;
+	ga = (ga + 0x00800080) & ~m;
+	return rb | ga;
+}
+
+// Lerp between two RGBA8 colors, t in [0, 256]
+BK_SIMD_INLINE bk_u32x8 bk_rgba8_lerp(bk_u32x8 a, bk_u32x8 b, bk_u32x8 t) {
+	const uint32_t m = 0x00FF00FF;
+	bk_u32x8 it = 256 - t;
+	bk_u32x8 rb = (((a & m) * it + (b & m) * t + 0x00800080) >> 8) & m;
+	bk_u32x8 ga = (((a >> 8) & m) * it + ((b >> 8) & m) * t + 0x00800080) & ~m;
+	return rb | ga;
+}
+
+// One bit per lane, lane 0 in bit 0
+BK_SIMD_INLINE int bk_i32x8_movemask(bk_i32x8 mask) {
+#ifdef __AVX__
+	return _mm256_movemask_ps((__m256)mask);
+#elif defined(__SSE2__)
+	__m128 lo, hi;
+	memcpy(&lo, &mask, 16);
+	memcpy(&hi, (const char*)&mask + 16, 16);
+	return _mm_movemask_ps(lo) | _mm_movemask_ps(hi) << 4;
+#else
+	int bits = 0;
+	for (int i = 0; i < 8; i++) bits |= (mask[i] < 0) << i;
+	return bits;
+#endif
+}
+
+BK_SIMD_INLINE int bk_i32x8_any(bk_i32x8 mask) {
+	bk_i32x8 t = mask;
+	for (int i = 1; i < 8; i++) t[0] |= t[i];
+	return t[0] != 0;
+}
+
+BK_SIMD_INLINE float bk_f32x8_hmin(bk_f32x8 v) {
+	float m = v[0];
+	for (int i = 1; i < 8; i++) m = v[i] < m ? v[i] : m;
+	return m;
+}
+
+BK_SIMD_INLINE float bk_f32x8_hmax(bk_f32x8 v) {
+	float m = v[0];
+	for (int i = 1; i < 8; i++) m = v[i] > m ? v[i] : m;
+	return m;
+}
+
+BK_SIMD_INLINE float bk_f32x8_hsum(bk_f32x8 v) {
+	return ((v[0] + v[4]) + (v[1] + v[5])) + ((v[2] + v[6]) + (v[3] + v[7]));
+}
+
+BK_SIMD_END
+
+#endif
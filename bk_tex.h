@@ -0,0 +1,215 @@
+/*
+bk_tex.h - Texture storage and 8-wide sampling for the Brickate project
+
+This header keeps decoded RGBA8 images in one of the bk_png layouts
+(linear, 4x4 tiled or Morton) together with a mip chain, and samples
+them 8 texture coordinates at a time.
+
+Row-major images make every rotated or minified lookup touch a new
+cache line per texel. In the 4x4 tiled layout a 64-byte line holds a
+4x4 block, and in the Morton layout each 32x32 tile is a 4 KB page in
+Z-order, so the four texels of a bilinear footprint share a line in
+most cases.
+
+Includes functions for:
+  - Loading a texture through bkp_load_png_layout, with optional mips
+  - Building a box-filtered mip chain in the texture's layout
+  - Nearest, bilinear and trilinear sampling of 8 UVs at once
+
+Coordinates wrap (repeat addressing). Samples are packed RGBA8 with R in
+the lowest byte, the same as the bytes bkp_load_png writes.
+*/
+
+#ifndef BK_TEX_H
+#define BK_TEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bk_png.h"
+#include "bk_simd.h"
+
+BK_SIMD_BEGIN
+
+#define BKT_MAX_LEVELS 16
+
+#define BKT_NEAREST 0
+#define BKT_BILINEAR 1
+#define BKT_TRILINEAR 2
+
+typedef struct {
+	unsigned char* pixels;
+	uint32_t width;
+	uint32_t height;
+} bkt_level;
+
+typedef struct {
+	bkt_level levels[BKT_MAX_LEVELS];
+	int n_levels;
+	int layout; // BK_PNG_LAYOUT_*
+} bkt_texture;
+
+void bkt_texture_free(bkt_texture* tex) {
+	for (int i = 0; i < tex->n_levels; i++) free(tex->levels[i].pixels);
+	memset(tex, 0, sizeof(*tex));
+}
+
+// Adds box-filtered levels down to 1x1. Odd edges repeat their last texel.
+int bkt_build_mips(bkt_texture* tex) {
+	while (tex->n_levels < BKT_MAX_LEVELS) {
+		const bkt_level* src = &tex->levels[tex->n_levels - 1];
+		if (src->width == 1 && src->height == 1) break;
+
+		bkt_level dst;
+		dst.width = src->width > 1 ? src->width / 2 : 1;
+		dst.height = src->height > 1 ? src->height / 2 : 1;
+		dst.pixels = calloc(1, bkp_layout_size(dst.width, dst.height, tex->layout));
+		if (!dst.pixels) return 0;
+
+		for (uint32_t y = 0; y < dst.height; y++) {
+			uint32_t y0 = y * 2;
+			uint32_t y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+			for (uint32_t x = 0; x < dst.width; x++) {
+				uint32_t x0 = x * 2;
+				uint32_t x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+				const unsigned char* p[4] = {
+					src->pixels + bkp_layout_index(x0, y0, src->width, tex->layout) * 4,
+					src->pixels + bkp_layout_index(x1, y0, src->width, tex->layout) * 4,
+					src->pixels + bkp_layout_index(x0, y1, src->width, tex->layout) * 4,
+					src->pixels + bkp_layout_index(x1, y1, src->width, tex->layout) * 4,
+				};
+				unsigned char* out = dst.pixels + bkp_layout_index(x, y, dst.width, tex->layout) * 4;
+				for (int c = 0; c < 4; c++) out[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) >> 2;
+			}
+		}
+
+		tex->levels[tex->n_levels++] = dst;
+	}
+	return 1;
+}
+
+int bkt_texture_load(bkt_texture* tex, const char* path, int layout, int mips) {
+	memset(tex, 0, sizeof(*tex));
+	tex->layout = layout;
+	tex->levels[0].pixels = bkp_load_png_layout(path, &tex->levels[0].width, &tex->levels[0].height, NULL, layout);
+	if (!tex->levels[0].pixels) return 0;
+	tex->n_levels = 1;
+
+	if (mips && !bkt_build_mips(tex)) {
+		bkt_texture_free(tex);
+		return 0;
+	}
+	return 1;
+}
+
+BK_SIMD_INLINE bk_i32x8 bkt_morton_spread(bk_i32x8 v) {
+	v = (v | (v << 4)) & 0x0F0F;
+	v = (v | (v << 2)) & 0x3333;
+	v = (v | (v << 1)) & 0x5555;
+	return v;
+}
+
+// Vector form of bkp_layout_index for in-range coordinates
+BK_SIMD_INLINE bk_i32x8 bkt_address(const bkt_level* l, int layout, bk_i32x8 x, bk_i32x8 y) {
+	switch (layout) {
+		case BK_PNG_LAYOUT_TILED: {
+			int blocks_x = (l->width + 3) / 4;
+			return ((y >> 2) * blocks_x + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3);
+		}
+		case BK_PNG_LAYOUT_MORTON: {
+			int tiles_x = (l->width + 31) / 32;
+			bk_i32x8 inner = bkt_morton_spread(x & 31) | (bkt_morton_spread(y & 31) << 1);
+			return ((y >> 5) * tiles_x + (x >> 5)) * 1024 + inner;
+		}
+		default:
+			return y * (int)l->width + x;
+	}
+}
+
+// Repeat addressing: maps any integer coordinate into [0, size)
+BK_SIMD_INLINE bk_i32x8 bkt_wrap(bk_i32x8 v, uint32_t size) {
+	if ((size & (size - 1)) == 0) return v & (int)(size - 1);
+	bk_i32x8 r = v % (int)size;
+	return r + ((r < 0) & (int)size);
+}
+
+BK_SIMD_INLINE bk_u32x8 bkt_fetch(const bkt_level* l, int layout, bk_i32x8 x, bk_i32x8 y) {
+	x = bkt_wrap(x, l->width);
+	y = bkt_wrap(y, l->height);
+	return bk_u32x8_gather(l->pixels, bkt_address(l, layout, x, y));
+}
+
+BK_SIMD_INLINE bk_u32x8 bkt_sample_nearest(const bkt_texture* tex, int level, bk_f32x8 u, bk_f32x8 v) {
+	const bkt_level* l = &tex->levels[level];
+	bk_i32x8 x = bk_f32x8_floor_i32(u * (float)l->width);
+	bk_i32x8 y = bk_f32x8_floor_i32(v * (float)l->height);
+	return bkt_fetch(l, tex->layout, x, y);
+}
+
+BK_SIMD_INLINE bk_u32x8 bkt_sample_bilinear(const bkt_texture* tex, int level, bk_f32x8 u, bk_f32x8 v) {
+	const bkt_level* l = &tex->levels[level];
+
+	// Texel centers sit at half-integer coordinates
+	bk_f32x8 fu = u * (float)l->width - 0.5f;
+	bk_f32x8 fv = v * (float)l->height - 0.5f;
+	bk_i32x8 x0 = bk_f32x8_floor_i32(fu);
+	bk_i32x8 y0 = bk_f32x8_floor_i32(fv);
+	bk_u32x8 tx = (bk_u32x8)bk_f32x8_to_i32((fu - bk_i32x8_to_f32(x0)) * 256.0f);
+	bk_u32x8 ty = (bk_u32x8)bk_f32x8_to_i32((fv - bk_i32x8_to_f32(y0)) * 256.0f);
+
+	bk_u32x8 c00 = bkt_fetch(l, tex->layout, x0, y0);
+	bk_u32x8 c10 = bkt_fetch(l, tex->layout, x0 + 1, y0);
+	bk_u32x8 c01 = bkt_fetch(l, tex->layout, x0, y0 + 1);
+	bk_u32x8 c11 = bkt_fetch(l, tex->layout, x0 + 1, y0 + 1);
+
+	bk_u32x8 itx = 256 - tx, ity = 256 - ty;
+	bk_u32x8 w00 = (itx * ity) >> 8;
+	bk_u32x8 w10 = (tx * ity) >> 8;
+	bk_u32x8 w01 = (itx * ty) >> 8;
+	bk_u32x8 w11 = 256 - w00 - w10 - w01;
+	return bk_rgba8_blend4(c00, c10, c01, c11, w00, w10, w01, w11);
+}
+
+// 'lod' is log2 of the texel-to-pixel ratio per lane. Lanes are grouped
+// by mip level, which for a coherent 8-pixel span is one or two groups.
+BK_SIMD_INLINE bk_u32x8 bkt_sample_trilinear(const bkt_texture* tex, bk_f32x8 u, bk_f32x8 v, bk_f32x8 lod) {
+	int last = tex->n_levels - 1;
+	lod = bk_f32x8_clamp(lod, 0.0f, (float)last);
+	bk_i32x8 level = bk_f32x8_to_i32(lod);
+	bk_u32x8 frac = (bk_u32x8)bk_f32x8_to_i32((lod - bk_i32x8_to_f32(level)) * 256.0f);
+
+	bk_u32x8 out = bk_u32x8_splat(0);
+	int todo = 0xFF;
+	while (todo) {
+		int lane = __builtin_ctz(todo);
+		int l0 = level[lane];
+		int l1 = l0 < last ? l0 + 1 : l0;
+		bk_i32x8 mask = level == l0;
+
+		bk_u32x8 a = bkt_sample_bilinear(tex, l0, u, v);
+		bk_u32x8 b = l1 != l0 ? bkt_sample_bilinear(tex, l1, u, v) : a;
+		out = bk_u32x8_select(mask, bk_rgba8_lerp(a, b, frac), out);
+		todo &= ~bk_i32x8_movemask(mask);
+	}
+	return out;
+}
+
+// Array form for callers that do not use bk_simd types. 'lod' is only read
+// for BKT_TRILINEAR and may be NULL otherwise.
+void bkt_sample8(const bkt_texture* tex, int filter, const float* u, const float* v, const float* lod, uint32_t* out) {
+	bk_f32x8 vu = bk_f32x8_load(u);
+	bk_f32x8 vv = bk_f32x8_load(v);
+	bk_u32x8 c;
+	switch (filter) {
+		case BKT_BILINEAR: c = bkt_sample_bilinear(tex, 0, vu, vv); break;
+		case BKT_TRILINEAR: c = bkt_sample_trilinear(tex, vu, vv, bk_f32x8_load(lod)); break;
+		default: c = bkt_sample_nearest(tex, 0, vu, vv); break;
+	}
+	bk_u32x8_store(out, c);
+}
+
+BK_SIMD_END
+
+#endif
@@ -0,0 +1,323 @@
+/*
+bk_watch.h - Texture hot reloading for the Brickate project
+
+This header keeps textures loaded with bkw_load up to date while artists
+edit them, for development builds on Linux (inotify).
+
+Features:
+  - Watches asset directories from a background thread
+  - Coalesces bursts of events per file: a texture is only looked at once
+    its file has been quiet for a while
+  - Fingerprints files by the CRCs of the chunks that affect pixels, read
+    without decoding, so saves that only touch metadata (or rewrite the
+    same image) are skipped
+  - Re-decodes changed textures on the background thread and keeps the
+    result pending until bkw_poll swaps it in on the caller's thread
+
+Paths are resolved with realpath, so a texture is matched to events no
+matter how either path was spelled.
+*/
+
+#ifndef BK_WATCH_H
+#define BK_WATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "bk_png.h"
+
+#define BKW_MAX_DIRS 64
+#define BKW_QUIET_MS 150
+
+typedef struct bkw_texture {
+	char path[PATH_MAX];
+	unsigned char* pixels; // RGBA, replaced by bkw_poll
+	uint32_t width;
+	uint32_t height;
+	int version;           // bumped on every swap
+
+	// Owned by the watcher thread, under the lock
+	uint64_t fingerprint;  // of the last decode
+	uint64_t due_us;       // when to look at the file again, or 0
+	unsigned char* next_pixels;
+	uint32_t next_width;
+	uint32_t next_height;
+
+	int swapped;           // scratch for bkw_poll
+	struct bkw_texture* next;
+} bkw_texture;
+
+typedef struct {
+	int fd;                // inotify
+	int wake[2];           // pipe that stops the thread
+	int quiet_ms;
+	int wds[BKW_MAX_DIRS];
+	char* dirs[BKW_MAX_DIRS];
+	int n_dirs;
+	bkw_texture* textures;
+
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int running;
+} bkw_watcher;
+
+// FNV-1a over the type and CRC of every chunk that affects decoded pixels.
+// Only chunk headers and CRCs are read. Returns 1 on success.
+int bkw_fingerprint(const char* path, uint64_t* out) {
+	static const char* const kinds[] = {"IHDR", "PLTE", "tRNS", "IDAT", "gAMA", "sRGB", "cHRM", "iCCP"};
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	unsigned char png_signature[8] = {137,80,78,71,13,10,26,10};
+	unsigned char signature_read[8];
+	int ok = fread(signature_read, 1, 8, f) == 8 && memcmp(png_signature, signature_read, 8) == 0;
+
+	uint64_t h = 0xCBF29CE484222325ull;
+	while (ok) {
+		uint32_t length, crc;
+		char type[5];
+		if (!bkp_read_chunk_header(f, &length, type) || fseek(f, length, SEEK_CUR) != 0 || !bkp_read_be32(f, &crc)) {
+			ok = 0;
+			break;
+		}
+		if (strcmp(type, "IEND") == 0) break;
+
+		for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+			if (memcmp(type, kinds[k], 4) != 0) continue;
+			unsigned char key[8];
+			memcpy(key, type, 4);
+			bkp_put_be32(key + 4, crc);
+			for (int i = 0; i < 8; i++) h = (h ^ key[i]) * 0x100000001B3ull;
+			break;
+		}
+	}
+
+	fclose(f);
+	if (ok) *out = h;
+	return ok;
+}
+
+// Marks the texture at 'path' (or all of them when path is NULL) to be
+// checked once no event has arrived for quiet_ms
+void bkw_touch(bkw_watcher* w, const char* path) {
+	uint64_t due = bkp_now_us() + (uint64_t)w->quiet_ms * 1000;
+	pthread_mutex_lock(&w->lock);
+	for (bkw_texture* t = w->textures; t; t = t->next) {
+		if (!path || strcmp(t->path, path) == 0) t->due_us = due;
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+void bkw_read_events(bkw_watcher* w) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char path[PATH_MAX];
+	ssize_t len = read(w->fd, buf, sizeof(buf));
+
+	for (ssize_t off = 0; off < len;) {
+		const struct inotify_event* e = (const struct inotify_event*)(buf + off);
+		off += sizeof(struct inotify_event) + e->len;
+
+		if (e->mask & IN_Q_OVERFLOW) {
+			bkw_touch(w, NULL);
+			continue;
+		}
+		if (!e->len) continue;
+		size_t n = strlen(e->name);
+		if (n < 4 || strcmp(e->name + n - 4, ".png") != 0) continue;
+
+		const char* dir = NULL;
+		pthread_mutex_lock(&w->lock);
+		for (int i = 0; i < w->n_dirs; i++) {
+			if (w->wds[i] == e->wd) dir = w->dirs[i];
+		}
+		pthread_mutex_unlock(&w->lock);
+		if (dir && snprintf(path, sizeof(path), "%s/%s", dir, e->name) < (int)sizeof(path)) bkw_touch(w, path);
+	}
+}
+
+// Fingerprints every texture that has gone quiet, and decodes the ones
+// that changed. Returns milliseconds until the next one is due, or -1.
+int bkw_reload_due(bkw_watcher* w) {
+	char path[PATH_MAX];
+	for (;;) {
+		uint64_t now = bkp_now_us(), next_due = 0;
+		bkw_texture* due = NULL;
+		uint64_t fingerprint = 0;
+
+		pthread_mutex_lock(&w->lock);
+		for (bkw_texture* t = w->textures; t; t = t->next) {
+			if (!t->due_us) continue;
+			if (t->due_us <= now) {
+				due = t;
+				break;
+			}
+			if (!next_due || t->due_us < next_due) next_due = t->due_us;
+		}
+		if (due) {
+			due->due_us = 0;
+			fingerprint = due->fingerprint;
+			memcpy(path, due->path, sizeof(path));
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (!due) return next_due ? (int)((next_due - now + 999) / 1000) : -1;
+
+		uint64_t fp;
+		if (!bkw_fingerprint(path, &fp) || fp == fingerprint) continue;
+
+		// A file still being written fails to decode; its next write
+		// brings it back here
+		uint32_t width, height;
+		unsigned char* pixels = bkp_load_png(path, &width, &height, NULL);
+		if (!pixels) continue;
+
+		pthread_mutex_lock(&w->lock);
+		free(due->next_pixels);
+		due->next_pixels = pixels;
+		due->next_width = width;
+		due->next_height = height;
+		due->fingerprint = fp;
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+void* bkw_thread_main(void* arg) {
+	bkw_watcher* w = arg;
+	int timeout = -1;
+	for (;;) {
+		struct pollfd fds[2] = {{w->fd, POLLIN, 0}, {w->wake[0], POLLIN, 0}};
+		if (poll(fds, 2, timeout) < 0) continue;
+		if (fds[1].revents) break;
+		if (fds[0].revents & POLLIN) bkw_read_events(w);
+		timeout = bkw_reload_due(w);
+	}
+	return NULL;
+}
+
+void bkw_close(bkw_watcher* w) {
+	if (w->running) {
+		char c = 0;
+		if (write(w->wake[1], &c, 1) == 1) pthread_join(w->thread, NULL);
+		pthread_mutex_destroy(&w->lock);
+	}
+	if (w->fd >= 0) close(w->fd);
+	if (w->wake[0] >= 0) close(w->wake[0]);
+	if (w->wake[1] >= 0) close(w->wake[1]);
+	for (int i = 0; i < w->n_dirs; i++) free(w->dirs[i]);
+
+	bkw_texture* t = w->textures;
+	while (t) {
+		bkw_texture* next = t->next;
+		free(t->pixels);
+		free(t->next_pixels);
+		free(t);
+		t = next;
+	}
+	memset(w, 0, sizeof(*w));
+	w->fd = w->wake[0] = w->wake[1] = -1;
+}
+
+// Starts the watcher thread. quiet_ms <= 0 uses BKW_QUIET_MS. Returns 1
+// on success.
+int bkw_init(bkw_watcher* w, int quiet_ms) {
+	memset(w, 0, sizeof(*w));
+	w->quiet_ms = quiet_ms > 0 ? quiet_ms : BKW_QUIET_MS;
+	w->wake[0] = w->wake[1] = -1;
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0 || pipe(w->wake) != 0) {
+		bkw_close(w);
+		return 0;
+	}
+
+	pthread_mutex_init(&w->lock, NULL);
+	if (pthread_create(&w->thread, NULL, bkw_thread_main, w) != 0) {
+		pthread_mutex_destroy(&w->lock);
+		bkw_close(w);
+		return 0;
+	}
+	w->running = 1;
+	return 1;
+}
+
+// Watches a directory (not its subdirectories) for changed PNGs
+int bkw_watch_dir(bkw_watcher* w, const char* dir) {
+	char* real = realpath(dir, NULL);
+	if (!real) return 0;
+
+	pthread_mutex_lock(&w->lock);
+	int wd = -1;
+	if (w->n_dirs < BKW_MAX_DIRS) wd = inotify_add_watch(w->fd, real, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd >= 0) {
+		w->wds[w->n_dirs] = wd;
+		w->dirs[w->n_dirs++] = real;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if (wd < 0) free(real);
+	return wd >= 0;
+}
+
+// Decodes a texture now and keeps it up to date from then on. Loading
+// the same file again returns the same texture. Returns NULL on failure.
+bkw_texture* bkw_load(bkw_watcher* w, const char* path) {
+	char real[PATH_MAX];
+	if (!realpath(path, real)) return NULL;
+
+	for (bkw_texture* t = w->textures; t; t = t->next) {
+		if (strcmp(t->path, real) == 0) return t;
+	}
+
+	bkw_texture* t = calloc(1, sizeof(bkw_texture));
+	if (!t) return NULL;
+	memcpy(t->path, real, sizeof(real));
+	if (!bkw_fingerprint(real, &t->fingerprint)) t->fingerprint = 0;
+	t->pixels = bkp_load_png(real, &t->width, &t->height, NULL);
+	if (!t->pixels) {
+		free(t);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	t->next = w->textures;
+	w->textures = t;
+	pthread_mutex_unlock(&w->lock);
+	return t;
+}
+
+// Swaps in every texture decoded since the last call, freeing the old
+// pixels, and calls on_reload (which may be NULL) for each one, e.g. to
+// upload it. Call from the thread that uses the textures. Returns the
+// number of textures swapped.
+int bkw_poll(bkw_watcher* w, void (*on_reload)(void* user, bkw_texture* t), void* user) {
+	int n = 0;
+	pthread_mutex_lock(&w->lock);
+	for (bkw_texture* t = w->textures; t; t = t->next) {
+		if (!t->next_pixels) continue;
+		free(t->pixels);
+		t->pixels = t->next_pixels;
+		t->width = t->next_width;
+		t->height = t->next_height;
+		t->next_pixels = NULL;
+		t->version++;
+		t->swapped = 1;
+		n++;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	// Textures are only added by this thread, so the list is stable here
+	for (bkw_texture* t = w->textures; n && t; t = t->next) {
+		if (!t->swapped) continue;
+		t->swapped = 0;
+		if (on_reload) on_reload(user, t);
+	}
+	return n;
+}
+
+#endif
@@ -0,0 +1,486 @@
+/*
+bk_pngopt.c - PNG recompressor for Brickate assets
+
+Re-encodes a PNG losslessly (the same samples and color chunks) so it is
+smaller and cheaper to decode:
+  - picks the smallest color type that holds every pixel exactly:
+    indexed when there are at most 256 colors, gray when R == G == B,
+    and drops alpha when every pixel is opaque; with a cHRM or iCCP
+    chunk, which only fits one kind, gray and color stay as they were
+  - tries each PNG filter on every row, the per-row minimum sum of
+    absolute values, and a per-row minimum byte entropy, each with two
+    zlib strategies at level 9; trials run in parallel on a bk_job pool
+  - writes IHDR, PLTE, tRNS, IDAT and IEND plus the input's gAMA, cHRM,
+    iCCP and sRGB chunks unchanged; text, time and other chunks are
+    stripped
+  - with --bake-color, applies the color chunks to the pixels the way
+    bkp_load_png does and drops them instead, which saves that work on
+    every load but changes the stored samples
+
+Among the trials within --slack percent of the smallest output, the one
+with the fewest bytes per pixel and the simplest filter wins, since
+those unfilter fastest. The result is decoded both raw and with color
+management and checked against the input, and the decode time of both
+is measured with bkp_load_png and reported.
+
+bk_png reads and writes 8-bit samples only, so bit depth stays at 8.
+
+Build:
+  cc -O2 -o bk_pngopt tools/bk_pngopt.c -lz -lm -lpthread
+
+Usage:
+  bk_pngopt [--threads n] [--runs n] [--slack pct] [--bake-color] input.png [output.png]
+
+Without an output path only the report is printed. Otherwise the result
+is written to a temporary file next to the output and renamed over it
+once it has been checked. When the result is not smaller, the output
+gets a copy of the input instead, and when the pixels differ the output
+is left alone. The output may be the input.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../bk_png.h"
+#include "../bk_quant.h"
+#include "../bk_job.h"
+
+#define OPT_FILTER_ENTROPY 6 // per row, the filter whose bytes have the lowest entropy
+#define OPT_N_FILTERS 7
+#define OPT_MAX_TYPES 2
+
+typedef struct {
+	int color_type;
+	unsigned char* pixels; // in the color type's own layout
+	size_t stride;
+	bkp_palette palette;
+} opt_image;
+
+typedef struct {
+	const opt_image* image;
+	int filter;   // 0..4, BKP_FILTER_ADAPTIVE or OPT_FILTER_ENTROPY
+	int strategy; // zlib strategy
+	bkp_buffer png;
+	int ok;
+} opt_trial;
+
+typedef struct {
+	opt_trial* trials;
+	uint32_t width;
+	uint32_t height;
+} opt_job;
+
+double opt_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+const char* opt_color_name(int color_type) {
+	switch (color_type) {
+		case BK_PNG_GRAY: return "gray";
+		case BK_PNG_GRAY_ALPHA: return "gray+alpha";
+		case BK_PNG_RGB: return "rgb";
+		case BK_PNG_INDEXED: return "indexed";
+		case BK_PNG_RGBA: return "rgba";
+		default: return "?";
+	}
+}
+
+const char* opt_filter_name(int filter) {
+	static const char* names[OPT_N_FILTERS] = {"none", "sub", "up", "average", "paeth", "min-sum", "min-entropy"};
+	return filter >= 0 && filter < OPT_N_FILTERS ? names[filter] : "?";
+}
+
+// Rough relative cost of unfiltering a row, for breaking near-ties
+int opt_filter_cost(int filter) {
+	static const int cost[OPT_N_FILTERS] = {0, 1, 1, 2, 3, 3, 3};
+	return cost[filter];
+}
+
+double opt_entropy(const unsigned char* bytes, size_t len) {
+	uint32_t hist[256] = {0};
+	for (size_t i = 0; i < len; i++) hist[bytes[i]]++;
+	double e = 0.0;
+	for (int i = 0; i < 256; i++) {
+		if (!hist[i]) continue;
+		double p = (double)hist[i] / len;
+		e -= p * log2(p);
+	}
+	return e;
+}
+
+// Picks a filter for every row by the entropy of its filtered bytes
+unsigned char* opt_entropy_filters(const opt_image* img, uint32_t width, uint32_t height) {
+	int bpp = bkp_bytes_per_pixel(img->color_type);
+	size_t len = (size_t)width * bpp;
+	unsigned char* filters = malloc(height);
+	unsigned char* trial = malloc(len);
+	if (!filters || !trial) {
+		free(filters);
+		free(trial);
+		return NULL;
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		const unsigned char* row = img->pixels + y * img->stride;
+		const unsigned char* prev = y > 0 ? row - img->stride : NULL;
+		double best = INFINITY;
+		for (int f = 0; f < 5; f++) {
+			bkp_filter_row(f, row, prev, len, bpp, trial);
+			double e = opt_entropy(trial, len);
+			if (e < best) {
+				best = e;
+				filters[y] = (unsigned char)f;
+			}
+		}
+	}
+
+	free(trial);
+	return filters;
+}
+
+void opt_run_trial(void* ctx, int index, int worker) {
+	opt_job* j = ctx;
+	opt_trial* t = &j->trials[index];
+	(void)worker;
+
+	bkp_encode_options opt = {t->filter, NULL, 9, t->strategy};
+	unsigned char* filters = NULL;
+	if (t->filter == OPT_FILTER_ENTROPY) {
+		filters = opt_entropy_filters(t->image, j->width, j->height);
+		if (!filters) return;
+		opt.filters = filters;
+	}
+
+	t->ok = bkp_encode_png(t->image->pixels, j->width, j->height, t->image->stride, t->image->color_type,
+		&t->image->palette, &opt, &t->png);
+	free(filters);
+}
+
+int opt_palette_cmp(const void* a, const void* b) {
+	const unsigned char* pa = a;
+	const unsigned char* pb = b;
+	// Translucent entries first, so tRNS stays short; then by luma
+	if (pa[3] != pb[3]) return pa[3] - pb[3];
+	int la = pa[0] * 2 + pa[1] * 5 + pa[2];
+	int lb = pb[0] * 2 + pb[1] * 5 + pb[2];
+	return la - lb;
+}
+
+// Converts RGBA to the candidate color types and returns how many there are.
+// 'kind' is -1 to choose freely, or 0 / 1 to allow only color / gray types.
+int opt_candidates(const unsigned char* rgba, uint32_t width, uint32_t height, int kind, opt_image* out) {
+	size_t n = (size_t)width * height;
+	int opaque = 1, gray = kind != 0;
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char* p = rgba + i * 4;
+		if (p[3] != 255) opaque = 0;
+		if (p[0] != p[1] || p[1] != p[2]) gray = 0;
+	}
+	if (kind == 1 && !gray) return 0;
+
+	int n_out = 0;
+	memset(out, 0, sizeof(opt_image) * OPT_MAX_TYPES);
+
+	// Gray already has one byte per pixel and needs no palette
+	bkp_palette pal;
+	if (kind != 1 && !(gray && opaque) && bkq_exact_palette(rgba, width, height, (size_t)width * 4, 256, &pal)) {
+		opt_image* img = &out[n_out];
+		img->color_type = BK_PNG_INDEXED;
+		img->stride = width;
+		img->pixels = malloc(n);
+		if (!img->pixels) return -1;
+		qsort(pal.palette, pal.size, 4, opt_palette_cmp);
+		img->palette = pal;
+		bkq_map(rgba, width, height, (size_t)width * 4, &img->palette, 0, img->pixels, width);
+		n_out++;
+	}
+
+	opt_image* img = &out[n_out];
+	img->color_type = gray ? (opaque ? BK_PNG_GRAY : BK_PNG_GRAY_ALPHA) : (opaque ? BK_PNG_RGB : BK_PNG_RGBA);
+	int bpp = bkp_bytes_per_pixel(img->color_type);
+	img->stride = (size_t)width * bpp;
+	img->pixels = malloc(n * bpp);
+	if (!img->pixels) return -1;
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char* p = rgba + i * 4;
+		unsigned char* d = img->pixels + i * bpp;
+		switch (img->color_type) {
+			case BK_PNG_GRAY: d[0] = p[0]; break;
+			case BK_PNG_GRAY_ALPHA: d[0] = p[0]; d[1] = p[3]; break;
+			default: memcpy(d, p, bpp); break;
+		}
+	}
+	return n_out + 1;
+}
+
+// Fastest of 'runs' decodes of the file at 'path', in milliseconds
+double opt_decode_ms(const char* path, int runs) {
+	double best = INFINITY;
+	for (int r = 0; r < runs; r++) {
+		uint32_t w, h;
+		double t0 = opt_now_ms();
+		unsigned char* px = bkp_load_png(path, &w, &h, NULL);
+		double t = opt_now_ms() - t0;
+		if (!px) return -1.0;
+		free(px);
+		if (t < best) best = t;
+	}
+	return best;
+}
+
+long opt_file_size(const char* path) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return -1;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+int opt_write_file(const char* path, const bkp_buffer* buf) {
+	FILE* f = fopen(path, "wb");
+	int ok = f && fwrite(buf->data, 1, buf->size, f) == buf->size;
+	if (f && fclose(f) != 0) ok = 0;
+	return ok;
+}
+
+int opt_read_file(const char* path, bkp_buffer* buf) {
+	long size = opt_file_size(path);
+	FILE* f = size >= 0 ? fopen(path, "rb") : NULL;
+	buf->data = malloc(size > 0 ? size : 1);
+	buf->size = size > 0 ? (size_t)size : 0;
+	int ok = f && buf->data && fread(buf->data, 1, buf->size, f) == buf->size;
+	if (f) fclose(f);
+	return ok;
+}
+
+// RGBA pixels as stored, without gamma or color management
+unsigned char* opt_load_raw(const char* path, uint32_t* out_width, uint32_t* out_height) {
+	bkp_layout_sink s = {BK_PNG_LAYOUT_LINEAR, NULL, NULL};
+	bkp_row_sink sink = {bkp_layout_begin_row, bkp_layout_end_row, &s, NULL, 1};
+	bkp_ihdr ihdr;
+	int ok = bkp_decode_rows(path, &ihdr, &sink);
+	free(s.row);
+	if (!ok) {
+		free(s.pixels);
+		return NULL;
+	}
+	*out_width = ihdr.width;
+	*out_height = ihdr.height;
+	return s.pixels;
+}
+
+// Appends the gAMA, cHRM, iCCP and sRGB chunks of 'png', a file that has
+// already decoded, to 'out' unchanged. Sets *has_space if cHRM or iCCP is
+// among them, since those describe RGB or gray data only.
+int opt_color_chunks(const bkp_buffer* png, bkp_buffer* out, int* has_space) {
+	*has_space = 0;
+	size_t pos = 8;
+	while (pos + 12 <= png->size) {
+		const unsigned char* chunk = png->data + pos;
+		size_t size = (size_t)bkp_be32(chunk) + 12;
+		if (size > png->size - pos) return 0;
+		if (memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "IEND", 4) == 0) break;
+		int space = memcmp(chunk + 4, "cHRM", 4) == 0 || memcmp(chunk + 4, "iCCP", 4) == 0;
+		if (space) *has_space = 1;
+		if (space || memcmp(chunk + 4, "gAMA", 4) == 0 || memcmp(chunk + 4, "sRGB", 4) == 0) {
+			if (!bkp_buffer_append(out, chunk, size)) return 0;
+		}
+		pos += size;
+	}
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	const char* input = NULL;
+	const char* output = NULL;
+	int threads = 0;
+	int runs = 10;
+	double slack = 0.5;
+	int bake = 0;
+	int usage = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--slack") == 0 && i + 1 < argc) slack = atof(argv[++i]);
+		else if (strcmp(argv[i], "--bake-color") == 0) bake = 1;
+		else if (argv[i][0] != '-' && !input) input = argv[i];
+		else if (argv[i][0] != '-' && !output) output = argv[i];
+		else usage = 1;
+	}
+	if (usage || !input || runs < 1) {
+		fprintf(stderr, "usage: %s [--threads n] [--runs n] [--slack pct] [--bake-color] input.png [output.png]\n", argv[0]);
+		return 1;
+	}
+
+	// 'shown' is what bkp_load_png returns, 'rgba' the pixels to encode:
+	// the stored samples, or with --bake-color the shown ones
+	bkp_buffer in_png;
+	uint32_t width, height;
+	int in_type;
+	unsigned char* shown = opt_read_file(input, &in_png) ? bkp_load_png(input, &width, &height, &in_type) : NULL;
+	unsigned char* rgba = shown;
+	bkp_buffer chunks = {0};
+	int has_space = 0;
+	if (shown && !bake) {
+		uint32_t w, h;
+		rgba = opt_load_raw(input, &w, &h);
+		if (rgba && !opt_color_chunks(&in_png, &chunks, &has_space)) {
+			free(rgba);
+			rgba = NULL;
+		}
+	}
+	if (!rgba) {
+		fprintf(stderr, "%s: cannot decode\n", input);
+		return 1;
+	}
+
+	int in_gray = in_type == BK_PNG_GRAY || in_type == BK_PNG_GRAY_ALPHA;
+	opt_image images[OPT_MAX_TYPES];
+	int n_images = opt_candidates(rgba, width, height, has_space ? in_gray : -1, images);
+	if (n_images < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	static const int strategies[2] = {Z_DEFAULT_STRATEGY, Z_FILTERED};
+	int n_trials = n_images * OPT_N_FILTERS * 2;
+	opt_trial* trials = calloc(n_trials ? n_trials : 1, sizeof(opt_trial));
+	if (!trials) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (int i = 0; i < n_trials; i++) {
+		trials[i].image = &images[i / (OPT_N_FILTERS * 2)];
+		trials[i].filter = i / 2 % OPT_N_FILTERS;
+		trials[i].strategy = strategies[i % 2];
+	}
+
+	bkj_pool* pool = bkj_pool_create(threads);
+	opt_job job = {trials, width, height};
+	double t0 = opt_now_ms();
+	bkj_parallel_for(pool, n_trials, opt_run_trial, &job);
+	double search_ms = opt_now_ms() - t0;
+	bkj_pool_destroy(pool);
+
+	size_t smallest = (size_t)-1;
+	for (int i = 0; i < n_trials; i++) {
+		if (trials[i].ok && trials[i].png.size < smallest) smallest = trials[i].png.size;
+	}
+	if (smallest == (size_t)-1) {
+		fprintf(stderr, "%s: encoding failed\n", input);
+		return 1;
+	}
+
+	opt_trial* best = NULL;
+	size_t limit = smallest + (size_t)(smallest * slack / 100.0);
+	for (int i = 0; i < n_trials; i++) {
+		opt_trial* t = &trials[i];
+		if (!t->ok || t->png.size > limit) continue;
+		if (best) {
+			int bpp = bkp_bytes_per_pixel(t->image->color_type);
+			int best_bpp = bkp_bytes_per_pixel(best->image->color_type);
+			if (bpp > best_bpp) continue;
+			if (bpp == best_bpp && opt_filter_cost(t->filter) > opt_filter_cost(best->filter)) continue;
+			if (bpp == best_bpp && opt_filter_cost(t->filter) == opt_filter_cost(best->filter) && t->png.size >= best->png.size) continue;
+		}
+		best = t;
+	}
+
+	// The color chunks go right after IHDR, which the encoder writes first
+	const size_t ihdr_end = 8 + 12 + 13;
+	bkp_buffer result = {0};
+	if (!bkp_buffer_append(&result, best->png.data, ihdr_end) || !bkp_buffer_append(&result, chunks.data, chunks.size)
+		|| !bkp_buffer_append(&result, best->png.data + ihdr_end, best->png.size - ihdr_end)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	// Decode the result through bk_png from a file, like the game would. The
+	// file sits next to the output so it can be renamed over it, which
+	// leaves the input intact until the result has been checked.
+	char* tmp_path = malloc((output ? strlen(output) : 0) + 32);
+	int fd = -1;
+	if (tmp_path) {
+		if (output) sprintf(tmp_path, "%s.XXXXXX", output);
+		else strcpy(tmp_path, "/tmp/bk_pngopt_XXXXXX");
+		fd = mkstemp(tmp_path);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "cannot create a temporary file\n");
+		return 1;
+	}
+	// mkstemp creates the file private; give it the mode a new file would get
+	mode_t mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+	close(fd);
+
+	int status = 0;
+	int renamed = 0;
+	if (!opt_write_file(tmp_path, &result)) {
+		fprintf(stderr, "%s: cannot write\n", tmp_path);
+		status = 1;
+	} else {
+		size_t bytes = (size_t)width * height * 4;
+		uint32_t w, h;
+		unsigned char* check = bkp_load_png(tmp_path, &w, &h, NULL);
+		int same = check && w == width && h == height && memcmp(check, shown, bytes) == 0;
+		free(check);
+		if (same && !bake) {
+			check = opt_load_raw(tmp_path, &w, &h);
+			same = check && w == width && h == height && memcmp(check, rgba, bytes) == 0;
+			free(check);
+		}
+
+		double in_ms = opt_decode_ms(input, runs);
+		double out_ms = opt_decode_ms(tmp_path, runs);
+
+		printf("%s: %ux%u %s -> %s, filter %s%s\n", input, width, height, opt_color_name(in_type),
+			opt_color_name(best->image->color_type), opt_filter_name(best->filter),
+			best->strategy == Z_FILTERED ? " (zlib filtered)" : "");
+		printf("  size:   %zu -> %zu bytes (%.1f%%)\n", in_png.size, result.size,
+			in_png.size > 0 ? 100.0 * result.size / in_png.size : 0.0);
+		printf("  decode: %.3f -> %.3f ms (best of %d)\n", in_ms, out_ms, runs);
+		printf("  search: %d trials in %.1f ms\n", n_trials, search_ms);
+
+		if (!same) {
+			fprintf(stderr, "%s: decoded pixels differ, output left alone\n", input);
+			status = 1;
+		} else if (output) {
+			// Not smaller: the output gets the input unchanged, so it always exists
+			int ok = 1;
+			if (result.size >= in_png.size) {
+				printf("  kept the input, it is already smaller\n");
+				ok = opt_write_file(tmp_path, &in_png);
+			}
+			if (ok && rename(tmp_path, output) == 0) {
+				renamed = 1;
+			} else {
+				fprintf(stderr, "%s: cannot write\n", output);
+				status = 1;
+			}
+		}
+	}
+
+	if (!renamed) remove(tmp_path);
+	free(tmp_path);
+	for (int i = 0; i < n_trials; i++) free(trials[i].png.data);
+	for (int i = 0; i < n_images; i++) free(images[i].pixels);
+	free(trials);
+	free(result.data);
+	free(chunks.data);
+	free(in_png.data);
+	if (rgba != shown) free(rgba);
+	free(shown);
+	return status;
+}